@@ -0,0 +1,171 @@
+//
+// arena.c - Bump allocator for the memory of one command line
+//
+
+#include "arena.h"
+
+/* Global variables */
+struct arena command_arena;     // Holds the data of the current command
+
+/*
+ * Rounds a size up to the alignment of arena allocations.
+ */
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+}
+
+/*
+ * Moves an arena to a block that has at least size free bytes, reusing
+ * the blocks kept from earlier commands before adding a new one.
+ *
+ * @param arena the arena.
+ * @param size the number of bytes needed.
+ * @return void
+ */
+static void next_block(struct arena *arena, size_t size) {
+    struct arena_block *block = arena->block;
+    size_t block_size;
+
+    while (block != NULL && block->next != NULL) {
+        block = block->next;
+        if (block->size >= size) {
+            arena->block = block;
+            arena->used = 0;
+            return;
+        }
+    }
+
+    // Blocks double in size, so a command needs few of them
+    block_size = block != NULL ? 2 * block->size : ARENA_BLOCKSIZE;
+    while (block_size < size) {
+        block_size *= 2;
+    }
+    struct arena_block *fresh = Malloc(sizeof(struct arena_block) + block_size);
+    fresh->next = NULL;
+    fresh->size = block_size;
+    if (block == NULL) {
+        arena->first = fresh;
+    } else {
+        block->next = fresh;
+    }
+    arena->block = fresh;
+    arena->used = 0;
+}
+
+/*
+ * Allocates memory from an arena. The memory is not initialized, and is
+ * only freed when the arena is reset or released past it.
+ *
+ * @param arena the arena to allocate from.
+ * @param size the number of bytes needed.
+ * @return the allocated memory, aligned for any type.
+ */
+void *arena_alloc(struct arena *arena, size_t size) {
+    size = align_up(size ? size : 1);
+    if (arena->block == NULL || arena->block->size - arena->used < size) {
+        next_block(arena, size);
+    }
+    arena->last = arena->block->data + arena->used;
+    arena->used += size;
+    return arena->last;
+}
+
+/*
+ * Resizes the most recent allocation of an arena in place when it fits,
+ * and otherwise moves it to a new allocation. Growing a vector by
+ * doubling it this way copies each element a constant number of times.
+ *
+ * @param arena the arena the memory was allocated from.
+ * @param ptr the memory to resize, or NULL.
+ * @param old_size its current size.
+ * @param new_size the size needed.
+ * @return the resized memory.
+ */
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size,
+                 size_t new_size) {
+    size_t offset;
+    void *moved;
+
+    if (ptr != NULL && ptr == arena->last) {
+        offset = (char *) ptr - arena->block->data;
+        if (arena->block->size - offset >= align_up(new_size)) {
+            arena->used = offset + align_up(new_size);
+            return ptr;
+        }
+    }
+    moved = arena_alloc(arena, new_size);
+    if (ptr != NULL) {
+        memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return moved;
+}
+
+/*
+ * Copies a string into an arena.
+ *
+ * @param arena the arena to allocate from.
+ * @param str the string to copy.
+ * @param len the number of bytes of str to copy.
+ * @return the NUL terminated copy.
+ */
+char *arena_strndup(struct arena *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/*
+ * Returns the current allocation point of an arena, for arena_release.
+ *
+ * @param arena the arena.
+ * @return the current allocation point.
+ */
+struct arena_mark arena_save(struct arena *arena) {
+    struct arena_mark mark = {arena->block, arena->used};
+    return mark;
+}
+
+/*
+ * Frees everything allocated from an arena since the supplied mark, so a
+ * nested command can give its memory back without touching its caller's.
+ *
+ * @param arena the arena.
+ * @param mark a point returned by arena_save.
+ * @return void
+ */
+void arena_release(struct arena *arena, struct arena_mark mark) {
+    arena->block = mark.block;
+    arena->used = mark.used;
+    arena->last = NULL;
+}
+
+/*
+ * Frees everything allocated from an arena. The blocks are kept for the
+ * next command, so a steady stream of commands allocates nothing.
+ *
+ * @param arena the arena.
+ * @return void
+ */
+void arena_reset(struct arena *arena) {
+    arena->block = arena->first;
+    arena->used = 0;
+    arena->last = NULL;
+}
+
+/*
+ * Frees the blocks of an arena, for an arena that is not used again. The
+ * arena is left empty, and allocating from it starts over.
+ *
+ * @param arena the arena.
+ * @return void
+ */
+void arena_free(struct arena *arena) {
+    struct arena_block *block, *next;
+
+    for (block = arena->first; block != NULL; block = next) {
+        next = block->next;
+        Free(block);
+    }
+    memset(arena, 0, sizeof(struct arena));
+}
@@ -0,0 +1,106 @@
+//
+// arena.h - Bump allocator for the memory of one command line
+//
+
+#ifndef TINY_LINUX_SHELL_ARENA_H
+#define TINY_LINUX_SHELL_ARENA_H
+
+#include "csapp.h"
+
+#define ARENA_BLOCKSIZE 65536   // Size of the first block of an arena
+#define ARENA_ALIGN     16      // Alignment of every allocation
+
+struct arena_block              // A block of memory handed out by an arena
+{
+    struct arena_block *next;   // The next, larger block
+    size_t size;                // Number of usable bytes in data
+    char data[];                // The memory handed out
+};
+
+struct arena                    // A bump allocator that is freed all at once
+{
+    struct arena_block *first;  // The first block, kept across resets
+    struct arena_block *block;  // The block allocations come from
+    size_t used;                // Bytes of block already handed out
+    void *last;                 // The most recent allocation
+};
+
+struct arena_mark               // A point an arena can be released back to
+{
+    struct arena_block *block;  // The block in use at that point
+    size_t used;                // Bytes of it in use at that point
+};
+
+extern struct arena command_arena;  // Holds the data of the current command
+
+/*
+ * Allocates memory from an arena. The memory is not initialized, and is
+ * only freed when the arena is reset or released past it.
+ *
+ * @param arena the arena to allocate from.
+ * @param size the number of bytes needed.
+ * @return the allocated memory, aligned for any type.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/*
+ * Resizes the most recent allocation of an arena in place when it fits,
+ * and otherwise moves it to a new allocation. Growing a vector by
+ * doubling it this way copies each element a constant number of times.
+ *
+ * @param arena the arena the memory was allocated from.
+ * @param ptr the memory to resize, or NULL.
+ * @param old_size its current size.
+ * @param new_size the size needed.
+ * @return the resized memory.
+ */
+void *arena_grow(struct arena *arena, void *ptr, size_t old_size,
+                 size_t new_size);
+
+/*
+ * Copies a string into an arena.
+ *
+ * @param arena the arena to allocate from.
+ * @param str the string to copy.
+ * @param len the number of bytes of str to copy.
+ * @return the NUL terminated copy.
+ */
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+
+/*
+ * Returns the current allocation point of an arena, for arena_release.
+ *
+ * @param arena the arena.
+ * @return the current allocation point.
+ */
+struct arena_mark arena_save(struct arena *arena);
+
+/*
+ * Frees everything allocated from an arena since the supplied mark, so a
+ * nested command can give its memory back without touching its caller's.
+ *
+ * @param arena the arena.
+ * @param mark a point returned by arena_save.
+ * @return void
+ */
+void arena_release(struct arena *arena, struct arena_mark mark);
+
+/*
+ * Frees everything allocated from an arena. The blocks are kept for the
+ * next command, so a steady stream of commands allocates nothing.
+ *
+ * @param arena the arena.
+ * @return void
+ */
+void arena_reset(struct arena *arena);
+
+/*
+ * Frees the blocks of an arena, for an arena that is not used again. The
+ * arena is left empty, and allocating from it starts over.
+ *
+ * @param arena the arena.
+ * @return void
+ */
+void arena_free(struct arena *arena);
+
+#endif //TINY_LINUX_SHELL_ARENA_H
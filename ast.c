@@ -0,0 +1,814 @@
+//
+// ast.c - Parser of compound commands into trees of parsed pipelines
+//
+
+#include "ast.h"
+
+struct parser                   // The state of ast_parse
+{
+    char *p;                    // The next byte of the script
+    ast_result result;          // AST_OK until parsing fails
+};
+
+/* Global variables */
+unsigned long ast_generation = 0;   // Changes when command names do
+
+/* The words that start compound commands */
+static const char *const starts[] = {"for", "while", "until", "if", "case",
+                                     "{", NULL};
+
+/* The words that may only end or continue a compound command */
+static const char *const reserved[] = {"do", "done", "then", "elif", "else",
+                                       "fi", "esac", "}", NULL};
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/*
+ * Checks whether a byte ends an unquoted word.
+ */
+static bool ends_word(char c) {
+    return c == '\0' || is_blank(c) || strchr("\n;&|()<>", c) != NULL;
+}
+
+/*
+ * Checks whether a word starts at p.
+ *
+ * @param p the position in the script.
+ * @param word the word.
+ * @return true if the script has the word at p, followed by a delimiter.
+ */
+static bool word_at(const char *p, const char *word) {
+    size_t len = strlen(word);
+    return strncmp(p, word, len) == 0 && ends_word(p[len]);
+}
+
+/*
+ * Returns the word of a NULL terminated list that starts at p, or NULL.
+ */
+static const char *list_word_at(const char *p, const char *const *words) {
+    for (; words != NULL && *words != NULL; words++) {
+        if (word_at(p, *words)) {
+            return *words;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Checks whether a function definition, name(), starts at p.
+ *
+ * @param p the position in the script.
+ * @return the ) of the definition, or NULL.
+ */
+static const char *function_at(const char *p) {
+    const char *name = p;
+
+    while (!ends_word(*p)) {
+        p++;
+    }
+    if (!var_valid_name(name, p - name)) {
+        return NULL;
+    }
+    p += strspn(p, " \t");
+    if (*p++ != '(') {
+        return NULL;
+    }
+    p += strspn(p, " \t");
+    return *p == ')' ? p : NULL;
+}
+
+/*
+ * Checks whether a command line starts a compound command, for, while,
+ * until, if, case or {, or a function definition, at the start of one of
+ * its commands, a pipeline's included, so it has to be parsed as a script
+ * rather than as a command list.
+ *
+ * @param line the command line.
+ * @return true if the line needs ast_parse.
+ */
+bool ast_wanted(const char *line) {
+    const char *p = line, *quote, *subst;
+    bool command_start = true, word_start = true;
+
+    for (; *p != '\0'; p++) {
+        if (command_start) {
+            p += strspn(p, " \t\r\n");
+            if (list_word_at(p, starts) != NULL || function_at(p) != NULL) {
+                return true;
+            }
+            command_start = false;
+            if (*p == '\0') {
+                break;
+            }
+        }
+        if (word_start && (*p == '\'' || *p == '"')) {
+            if ((quote = strchr(p + 1, *p)) == NULL) {
+                break;
+            }
+            p = quote;
+            word_start = false;
+            continue;
+        }
+        if (strchr("$<>", *p) != NULL && p[1] == '(' &&
+            (subst = subst_end(p)) != NULL) {
+            p = subst - 1;
+            word_start = false;
+            continue;
+        }
+        command_start = *p == ';' || *p == '\n' || *p == '|' ||
+                        (*p == '&' && p > line &&
+                         p[-1] != '>' && p[-1] != '<');
+        word_start = is_blank(*p) || *p == '|' || *p == '<' || *p == '>';
+    }
+    return false;
+}
+
+/*
+ * Marks the parse as failed with a syntax error at the current position,
+ * or as incomplete if the script ended there.
+ *
+ * @param parser the parser.
+ * @return NULL, for the callers to return.
+ */
+static void *syntax_error(struct parser *parser) {
+    size_t len;
+
+    if (parser->result != AST_OK) {
+        return NULL;
+    }
+    if (*parser->p == '\0') {
+        parser->result = AST_INCOMPLETE;
+        return NULL;
+    }
+    len = ends_word(*parser->p) ? (parser->p[1] == *parser->p ? 2 : 1)
+                                : strcspn(parser->p, " \t\r\n;&|()<>");
+    fprintf(stderr, "Error: syntax error near '%.*s'\n", (int) len, parser->p);
+    parser->result = AST_ERROR;
+    return NULL;
+}
+
+/*
+ * Skips blanks, and newlines as well if newlines is true.
+ */
+static void skip_blanks(struct parser *parser, bool newlines) {
+    while (is_blank(*parser->p) || (newlines && *parser->p == '\n')) {
+        parser->p++;
+    }
+}
+
+/*
+ * Consumes a word the grammar requires next, after blanks and newlines.
+ *
+ * @return true if the word was there, false after marking an error.
+ */
+static bool expect_word(struct parser *parser, const char *word) {
+    skip_blanks(parser, true);
+    if (!word_at(parser->p, word)) {
+        syntax_error(parser);
+        return false;
+    }
+    parser->p += strlen(word);
+    return true;
+}
+
+/*
+ * Finds the end of the pipeline at p: the next ;, &, &&, || or newline
+ * outside quotes and $(...), except the & of a >& or <& redirection.
+ * Quotes start words, as in parseline. With stop_at_pipe, finds the end
+ * of its first command, at a | too.
+ */
+static char *pipeline_end(char *p, bool stop_at_pipe) {
+    char *start = p, *quote;
+    const char *subst;
+    bool word_start = true;
+
+    for (; *p != '\0'; p++) {
+        if (word_start && (*p == '\'' || *p == '"')) {
+            if ((quote = strchr(p + 1, *p)) == NULL) {
+                return p + strlen(p);
+            }
+            p = quote;
+            word_start = false;
+            continue;
+        }
+        if (strchr("$<>", *p) != NULL && p[1] == '(' &&
+            (subst = subst_end(p)) != NULL) {
+            p = (char *) subst - 1;
+            word_start = false;
+            continue;
+        }
+        if (*p == ';' || *p == '\n' ||
+            (*p == '|' && (p[1] == '|' || stop_at_pipe)) ||
+            (*p == '&' && (p == start || (p[-1] != '>' && p[-1] != '<')))) {
+            break;
+        }
+        word_start = is_blank(*p) || *p == '|' || *p == '<' || *p == '>';
+    }
+    return p;
+}
+
+/*
+ * Allocates a node, with the fields no parser sets cleared.
+ */
+static struct ast_node *new_node(node_type type, char *start) {
+    struct ast_node *node;
+
+    node = arena_alloc(&command_arena, sizeof(struct ast_node));
+    memset(node, 0, sizeof(struct ast_node));
+    node->type = type;
+    node->text = start;         // Replaced by the text once the end is known
+    return node;
+}
+
+/*
+ * Sets the text of a node to the script from its start to the parser.
+ */
+static struct ast_node *end_node(struct parser *parser, struct ast_node *node) {
+    node->text = arena_strndup(&command_arena, node->text,
+                               parser->p - node->text);
+    return node;
+}
+
+/*
+ * Parses the pipeline at the parser into a node, with parseline, or with
+ * stop_at_pipe only its first command, for a NODE_PIPE.
+ */
+static struct ast_node *parse_pipeline(struct parser *parser,
+                                       bool stop_at_pipe) {
+    struct ast_node *node = new_node(NODE_PIPELINE, parser->p);
+    char *end = pipeline_end(parser->p, stop_at_pipe);
+
+    while (end > parser->p && is_blank(end[-1])) {
+        end--;
+    }
+    if (end == parser->p) {
+        return syntax_error(parser);
+    }
+    parser->p = end;
+    end_node(parser, node);
+    if (parseline(node->text, &node->tokens) != PARSELINE_FG) {
+        parser->result = AST_ERROR;
+        return NULL;
+    }
+    node->generation = ast_generation;
+    return node;
+}
+
+/*
+ * Checks whether a redirection, [n]< or [n]> but not <( or >(, starts at p.
+ */
+static bool redirection_at(const char *p) {
+    p += strspn(p, "0123456789");
+    return (*p == '<' || *p == '>') && p[1] != '(';
+}
+
+/*
+ * Parses the redirections after a compound command, if any, into its
+ * redirs, with parseline. A word among them is a syntax error.
+ *
+ * @return false after marking an error.
+ */
+static bool parse_redirections(struct parser *parser, struct ast_node *node) {
+    struct cmdline_tokens *token;
+    struct cmd_stage *stage;
+    char *start, *end;
+
+    skip_blanks(parser, false);
+    if (!redirection_at(parser->p)) {
+        return true;
+    }
+    start = parser->p;
+    end = pipeline_end(start, true);
+    while (end > start && is_blank(end[-1])) {
+        end--;
+    }
+
+    token = arena_alloc(&command_arena, sizeof(struct cmdline_tokens));
+    switch (parseline(arena_strndup(&command_arena, start, end - start),
+                      token)) {
+    case PARSELINE_EMPTY:
+        break;
+    case PARSELINE_ERROR:
+        parser->result = AST_ERROR;
+        return false;
+    default:
+        stage = &token->stages[0];
+        parser->p = start + (stage->argv[-stage->nassigns] - token->text);
+        syntax_error(parser);
+        return false;
+    }
+    token->builtin = token->stages[0].builtin = BUILTIN_NONE;
+    node->redirs = token;
+    parser->p = end;
+    return true;
+}
+
+static struct ast_node *parse_list(struct parser *parser,
+                                   const char *const *stops, bool allow_empty);
+
+/*
+ * Parses for name in word...; do list; done. The header is parsed as a
+ * pipeline, for the expansion of its words.
+ */
+static struct ast_node *parse_for(struct parser *parser) {
+    struct ast_node *node = new_node(NODE_FOR, parser->p);
+    char *name, *end;
+
+    parser->p += strlen("for");
+    skip_blanks(parser, false);
+    name = parser->p;
+    while (!ends_word(*parser->p)) {
+        parser->p++;
+    }
+    if (!var_valid_name(name, parser->p - name)) {
+        parser->p = name;
+        return syntax_error(parser);
+    }
+    skip_blanks(parser, false);
+    if (!word_at(parser->p, "in")) {
+        return syntax_error(parser);
+    }
+
+    end = pipeline_end(parser->p, false);
+    if (*end == '&' || *end == '|') {
+        parser->p = end;
+        return syntax_error(parser);
+    }
+    if (parseline(arena_strndup(&command_arena, node->text, end - node->text),
+                  &node->tokens) != PARSELINE_FG) {
+        parser->result = AST_ERROR;
+        return NULL;
+    }
+    parser->p = *end == ';' ? end + 1 : end;
+
+    if (!expect_word(parser, "do") ||
+        (node->body = parse_list(parser, (const char *[]) {"done", NULL},
+                                 false)) == NULL ||
+        !expect_word(parser, "done")) {
+        return NULL;
+    }
+    return end_node(parser, node);
+}
+
+/*
+ * Parses while list; do list; done, or the same with until.
+ */
+static struct ast_node *parse_loop(struct parser *parser, node_type type) {
+    struct ast_node *node = new_node(type, parser->p);
+
+    parser->p += strlen(type == NODE_WHILE ? "while" : "until");
+    if ((node->cond = parse_list(parser, (const char *[]) {"do", NULL},
+                                 false)) == NULL ||
+        !expect_word(parser, "do") ||
+        (node->body = parse_list(parser, (const char *[]) {"done", NULL},
+                                 false)) == NULL ||
+        !expect_word(parser, "done")) {
+        return NULL;
+    }
+    return end_node(parser, node);
+}
+
+/*
+ * Parses the rest of an if or elif, from its test to the fi. An elif
+ * becomes a nested node in the else part, which consumes the fi.
+ */
+static struct ast_node *parse_if(struct parser *parser, char *start,
+                                 size_t keyword_len) {
+    static const char *const then_stops[] = {"elif", "else", "fi", NULL};
+    struct ast_node *node = new_node(NODE_IF, start);
+
+    parser->p += keyword_len;
+    if ((node->cond = parse_list(parser, (const char *[]) {"then", NULL},
+                                 false)) == NULL ||
+        !expect_word(parser, "then") ||
+        (node->body = parse_list(parser, then_stops, false)) == NULL) {
+        return NULL;
+    }
+
+    skip_blanks(parser, true);
+    if (word_at(parser->p, "elif")) {
+        if ((node->else_part = parse_if(parser, parser->p,
+                                        strlen("elif"))) == NULL) {
+            return NULL;
+        }
+        return end_node(parser, node);
+    }
+    if (word_at(parser->p, "else")) {
+        parser->p += strlen("else");
+        if ((node->else_part = parse_list(parser, (const char *[]) {"fi", NULL},
+                                          false)) == NULL) {
+            return NULL;
+        }
+    }
+    if (!expect_word(parser, "fi")) {
+        return NULL;
+    }
+    return end_node(parser, node);
+}
+
+/*
+ * Reads a word of a case, a quoted string or the bytes up to a delimiter.
+ *
+ * @param parser the parser.
+ * @param quote receives the quote of the word, or 0.
+ * @return the word, or NULL after marking an error.
+ */
+static char *case_word(struct parser *parser, char *quote) {
+    char *start, *end;
+
+    skip_blanks(parser, false);
+    start = parser->p;
+    *quote = 0;
+    if (*start == '\'' || *start == '"') {
+        if ((end = strchr(start + 1, *start)) == NULL) {
+            parser->p += strlen(parser->p);
+            return syntax_error(parser);
+        }
+        *quote = *start;
+        parser->p = end + 1;
+        return arena_strndup(&command_arena, start + 1, end - start - 1);
+    }
+    while (!ends_word(*parser->p)) {
+        if (*parser->p == '$' && parser->p[1] == '(' &&
+            (end = (char *) subst_end(parser->p)) != NULL) {
+            parser->p = end;
+        } else {
+            parser->p++;
+        }
+    }
+    if (parser->p == start) {
+        return syntax_error(parser);
+    }
+    return arena_strndup(&command_arena, start, parser->p - start);
+}
+
+/*
+ * Parses case word in [(]pattern[|pattern]...) list;; ... esac.
+ */
+static struct ast_node *parse_case(struct parser *parser) {
+    struct ast_node *node = new_node(NODE_CASE, parser->p);
+    struct case_item **item = &node->items, *it;
+    char *pattern, quote;
+    int cap;
+
+    parser->p += strlen("case");
+    if ((node->word = case_word(parser, &node->quote)) == NULL ||
+        !expect_word(parser, "in")) {
+        return NULL;
+    }
+
+    while (skip_blanks(parser, true), !word_at(parser->p, "esac")) {
+        if (*parser->p == '(') {
+            parser->p++;
+        }
+        it = *item = arena_alloc(&command_arena, sizeof(struct case_item));
+        memset(it, 0, sizeof(struct case_item));
+        cap = 0;
+        while (true) {
+            if ((pattern = case_word(parser, &quote)) == NULL) {
+                return NULL;
+            }
+            if (it->npatterns == cap) {
+                cap = cap ? 2 * cap : 4;
+                it->patterns = arena_grow(&command_arena, it->patterns,
+                                          it->npatterns * sizeof(char *),
+                                          cap * sizeof(char *));
+                it->quotes = arena_grow(&command_arena, it->quotes,
+                                        it->npatterns, cap);
+            }
+            it->patterns[it->npatterns] = pattern;
+            it->quotes[it->npatterns++] = quote;
+            skip_blanks(parser, false);
+            if (*parser->p != '|') {
+                break;
+            }
+            parser->p++;
+        }
+        if (*parser->p != ')') {
+            return syntax_error(parser);
+        }
+        parser->p++;
+
+        it->body = parse_list(parser, (const char *[]) {"esac", NULL}, true);
+        if (parser->result != AST_OK) {
+            return NULL;
+        }
+        skip_blanks(parser, true);
+        if (parser->p[0] == ';' && parser->p[1] == ';') {
+            parser->p += 2;
+        } else if (!word_at(parser->p, "esac")) {
+            return syntax_error(parser);
+        }
+        item = &it->next;
+    }
+    parser->p += strlen("esac");
+    return end_node(parser, node);
+}
+
+/*
+ * Parses { list; }.
+ */
+static struct ast_node *parse_group(struct parser *parser) {
+    struct ast_node *node = new_node(NODE_GROUP, parser->p);
+
+    parser->p++;
+    if ((node->body = parse_list(parser, (const char *[]) {"}", NULL},
+                                 false)) == NULL ||
+        !expect_word(parser, "}")) {
+        return NULL;
+    }
+    return end_node(parser, node);
+}
+
+static struct ast_node *parse_compound(struct parser *parser,
+                                      const char *word);
+
+/*
+ * Parses name() followed by the compound command that is its body.
+ */
+static struct ast_node *parse_function(struct parser *parser,
+                                       const char *paren) {
+    struct ast_node *node = new_node(NODE_FUNCTION, parser->p);
+
+    node->word = arena_strndup(&command_arena, parser->p,
+                               strcspn(parser->p, " \t("));
+    parser->p = (char *) paren + 1;
+    skip_blanks(parser, true);
+    if (list_word_at(parser->p, starts) == NULL) {
+        return syntax_error(parser);
+    }
+    if ((node->body = parse_compound(parser,
+                                     list_word_at(parser->p, starts))) == NULL) {
+        return NULL;
+    }
+    return end_node(parser, node);
+}
+
+/*
+ * Parses the compound command a word of starts begins, and the
+ * redirections after it.
+ */
+static struct ast_node *parse_compound(struct parser *parser,
+                                      const char *word) {
+    char *start = parser->p;
+    struct ast_node *node;
+
+    if (strcmp(word, "{") == 0) {
+        node = parse_group(parser);
+    } else if (strcmp(word, "for") == 0) {
+        node = parse_for(parser);
+    } else if (strcmp(word, "while") == 0) {
+        node = parse_loop(parser, NODE_WHILE);
+    } else if (strcmp(word, "until") == 0) {
+        node = parse_loop(parser, NODE_UNTIL);
+    } else if (strcmp(word, "if") == 0) {
+        node = parse_if(parser, parser->p, strlen("if"));
+    } else {
+        node = parse_case(parser);
+    }
+    if (node == NULL || !parse_redirections(parser, node)) {
+        return NULL;
+    }
+    if (node->redirs != NULL) {
+        node->text = start;     // The text takes in the redirections
+        end_node(parser, node);
+    }
+    return node;
+}
+
+/*
+ * Parses one command of a pipeline, a compound command or a simple
+ * command, with stop_at_pipe only the first of the latter's pipeline.
+ */
+static struct ast_node *parse_stage(struct parser *parser, bool stop_at_pipe) {
+    const char *word = list_word_at(parser->p, starts);
+
+    if (word != NULL) {
+        return parse_compound(parser, word);
+    }
+    if (list_word_at(parser->p, reserved) != NULL ||
+        function_at(parser->p) != NULL) {
+        return syntax_error(parser);
+    }
+    return parse_pipeline(parser, stop_at_pipe);
+}
+
+/*
+ * Checks whether a command after a single | of the pipeline at p starts
+ * with a word of starts, so it has to be a NODE_PIPE.
+ */
+static bool pipe_to_compound(char *p) {
+    for (p = pipeline_end(p, true); *p == '|' && p[1] != '|';
+         p = pipeline_end(p, true)) {
+        p++;
+        p += strspn(p, " \t\r\n");
+        if (list_word_at(p, starts) != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Parses a pipeline of which first, starting at start, is the first
+ * command, up to a || or the end of the pipeline, into a NODE_PIPE.
+ * Newlines may follow a |.
+ */
+static struct ast_node *parse_pipe(struct parser *parser,
+                                   struct ast_node *first, char *start) {
+    struct ast_node *node = new_node(NODE_PIPE, start), **tail = &first->next;
+
+    node->body = first;
+    while (skip_blanks(parser, false),
+           parser->p[0] == '|' && parser->p[1] != '|') {
+        parser->p++;
+        skip_blanks(parser, true);
+        if ((*tail = parse_stage(parser, true)) == NULL) {
+            return NULL;
+        }
+        tail = &(*tail)->next;
+    }
+    while (is_blank(parser->p[-1])) {
+        parser->p--;            // Not part of the text
+    }
+    return end_node(parser, node);
+}
+
+/*
+ * Parses one command, a compound command, a function definition or a
+ * pipeline, which is a NODE_PIPE if it has a compound command in it.
+ */
+static struct ast_node *parse_command(struct parser *parser) {
+    const char *word = list_word_at(parser->p, starts), *paren;
+    char *start = parser->p;
+    struct ast_node *node;
+
+    if (word == NULL) {
+        if (list_word_at(parser->p, reserved) != NULL) {
+            return syntax_error(parser);
+        }
+        if ((paren = function_at(parser->p)) != NULL) {
+            return parse_function(parser, paren);
+        }
+        if (!pipe_to_compound(parser->p)) {
+            return parse_pipeline(parser, false);
+        }
+    }
+    if ((node = parse_stage(parser, true)) == NULL) {
+        return NULL;
+    }
+    skip_blanks(parser, false);
+    if (parser->p[0] != '|' || parser->p[1] == '|') {
+        return node;
+    }
+    return parse_pipe(parser, node, start);
+}
+
+/*
+ * Parses a list of commands joined by ;, &, &&, || and newlines, up to
+ * one of the stop words at the start of a command, a ;; or the end of the
+ * script. The stop word is left for the caller.
+ *
+ * @param parser the parser.
+ * @param stops the words that end the list, NULL for the whole script.
+ * @param allow_empty true if the list may have no commands.
+ * @return the first node of the list, or NULL if it is empty or parsing
+ *         failed.
+ */
+static struct ast_node *parse_list(struct parser *parser,
+                                   const char *const *stops, bool allow_empty) {
+    struct ast_node *head = NULL, **tail = &head, *node;
+
+    while (skip_blanks(parser, true), *parser->p != '\0') {
+        if (list_word_at(parser->p, stops) != NULL ||
+            (parser->p[0] == ';' && parser->p[1] == ';' && stops != NULL)) {
+            break;
+        }
+        if ((node = parse_command(parser)) == NULL) {
+            return NULL;
+        }
+        *tail = node;
+        tail = &node->next;
+
+        skip_blanks(parser, false);
+        if (parser->p[0] == '&' && parser->p[1] == '&') {
+            node->op = LIST_AND;
+        } else if (parser->p[0] == '|' && parser->p[1] == '|') {
+            node->op = LIST_OR;
+        } else if (parser->p[0] == ';' && parser->p[1] == ';') {
+            node->op = LIST_END;
+            continue;
+        } else if (*parser->p == ';' || *parser->p == '\n') {
+            node->op = LIST_SEQ;
+        } else if (*parser->p == '&') {
+            node->op = LIST_BG;
+        } else if (*parser->p == '\0') {
+            node->op = LIST_END;
+            continue;
+        } else {
+            return syntax_error(parser);
+        }
+        parser->p += (node->op == LIST_AND || node->op == LIST_OR) ? 2 : 1;
+
+        // A command must follow && and ||, on this line or a later one
+        if (node->op == LIST_AND || node->op == LIST_OR) {
+            skip_blanks(parser, true);
+            if (*parser->p == '\0' || list_word_at(parser->p, stops) != NULL ||
+                strchr(";&|", *parser->p) != NULL) {
+                return syntax_error(parser);
+            }
+        }
+    }
+
+    if (*parser->p == '\0' && stops != NULL) {
+        return syntax_error(parser);    // The compound command goes on
+    }
+    if (head == NULL && !allow_empty) {
+        return syntax_error(parser);
+    }
+    return head;
+}
+
+/*
+ * Parses a script, one or more lines of commands, into a list of nodes.
+ *
+ * Each pipeline of the script is parsed with parseline right away, so
+ * running a node, however many times a loop runs it, only takes a copy of
+ * its tokens and their expansion. The nodes and their tokens are allocated
+ * from command_arena.
+ *
+ * @param script the script; lines are separated by newlines.
+ * @param list receives the first node of the list, NULL for a blank script.
+ * @return AST_OK, AST_INCOMPLETE if the script ends inside a command or
+ *         after && or ||, so more lines are needed, or AST_ERROR after
+ *         printing an error.
+ */
+ast_result ast_parse(const char *script, struct ast_node **list) {
+    struct parser parser;
+
+    parser.p = arena_strndup(&command_arena, script, strlen(script));
+    parser.result = AST_OK;
+    *list = parse_list(&parser, NULL, true);
+    return parser.result;
+}
+
+/*
+ * Parses a script as ast_parse does, into another arena than
+ * command_arena, for a script that outlives the command line.
+ *
+ * @param arena the arena the nodes and tokens are allocated from.
+ * @param script the script.
+ * @param list receives the first node of the list, NULL for a blank script.
+ * @return the result of ast_parse.
+ */
+ast_result ast_parse_into(struct arena *arena, const char *script,
+                          struct ast_node **list) {
+    struct arena saved = command_arena;
+    ast_result result;
+
+    // parseline allocates the tokens from command_arena, so swap it out
+    command_arena = *arena;
+    result = ast_parse(script, list);
+    *arena = command_arena;
+    command_arena = saved;
+    return result;
+}
+
+/*
+ * Copies the tokens of a node into command_arena, so they can be expanded
+ * without changing the node. The strings are shared with the node.
+ *
+ * @param from the tokens of a node: those of a NODE_PIPELINE or NODE_FOR,
+ *        or the redirections of a compound command.
+ * @param token receives the copy.
+ * @return void
+ */
+void ast_load_tokens(const struct cmdline_tokens *from,
+                     struct cmdline_tokens *token) {
+    const struct cmd_stage *from_stage;
+    struct cmd_stage *stage;
+    size_t nwords;
+    int i;
+
+    *token = *from;
+    token->stages = arena_alloc(&command_arena,
+                                token->nstages * sizeof(struct cmd_stage));
+    for (i = 0; i < token->nstages; i++) {
+        from_stage = &from->stages[i];
+        stage = &token->stages[i];
+        *stage = *from_stage;
+        nwords = from_stage->nassigns + from_stage->argc + 1;
+        stage->argv = arena_alloc(&command_arena, nwords * sizeof(char *));
+        memcpy(stage->argv, from_stage->argv - from_stage->nassigns,
+               nwords * sizeof(char *));
+        stage->argv += from_stage->nassigns;
+        stage->redirs = arena_alloc(&command_arena,
+                                    from_stage->nredirs *
+                                    sizeof(struct redirection));
+        memcpy(stage->redirs, from_stage->redirs,
+               from_stage->nredirs * sizeof(struct redirection));
+    }
+    token->argv = token->stages[0].argv;
+}
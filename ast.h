@@ -0,0 +1,127 @@
+//
+// ast.h - Parser of compound commands into trees of parsed pipelines
+//
+
+#ifndef TINY_LINUX_SHELL_AST_H
+#define TINY_LINUX_SHELL_AST_H
+
+#include "tsh_helper.h"
+#include "cmdlist.h"
+
+// The kind of command a node of a script stands for
+typedef enum node_type
+{
+    NODE_PIPELINE,              // A pipeline, as parseline parses it
+    NODE_FOR,                   // for name in word...; do list; done
+    NODE_WHILE,                 // while list; do list; done
+    NODE_UNTIL,                 // until list; do list; done
+    NODE_IF,                    // if list; then list; [elif...] [else list;] fi
+    NODE_CASE,                  // case word in pattern) list;; ... esac
+    NODE_GROUP,                 // { list; }
+    NODE_FUNCTION,              // name() compound-command
+    NODE_PIPE                   // A pipeline with a compound command in it
+} node_type;
+
+// The outcome of parsing a script
+typedef enum ast_result
+{
+    AST_OK,                     // The script was parsed
+    AST_INCOMPLETE,             // The script ends inside a command
+    AST_ERROR                   // The script is not valid
+} ast_result;
+
+struct case_item                // One pattern list and body of a case
+{
+    char **patterns;            // The patterns, as typed
+    char *quotes;               // The quote each pattern was in, or 0
+    int npatterns;              // Number of patterns
+    struct ast_node *body;      // The list run when one matches
+    struct case_item *next;     // The next item
+};
+
+struct ast_node                 // A command of a script
+{
+    node_type type;             // What the command is
+    char *text;                 // The command as typed, for job listings
+    list_op op;                 // The operator after it in its list
+    struct ast_node *next;      // The next command of its list
+
+    struct cmdline_tokens tokens;   // NODE_PIPELINE: the parsed pipeline;
+                                    // NODE_FOR: "for name in word..."
+    unsigned long generation;   // NODE_PIPELINE: ast_generation when parsed
+    struct ast_node *cond;      // NODE_WHILE, NODE_UNTIL, NODE_IF: the test
+    struct ast_node *body;      // Loops, NODE_GROUP: the body; NODE_IF: the
+                                // then list; NODE_FUNCTION: the command;
+                                // NODE_PIPE: its commands, linked by next
+    struct ast_node *else_part; // NODE_IF: the else list, or the elif node
+    char *word;                 // NODE_CASE: the word, as typed;
+                                // NODE_FUNCTION: the name
+    char quote;                 // NODE_CASE: the quote it was in, or 0
+    struct case_item *items;    // NODE_CASE: the items, in order
+    struct cmdline_tokens *redirs;  // Compound commands: the redirections
+                                    // after them, in stage 0, or NULL
+};
+
+/*
+ * Changes whenever what the command names of a script stand for changes,
+ * as when a function is defined, so pipelines parsed before can tell.
+ */
+extern unsigned long ast_generation;
+
+/*
+ * Checks whether a command line starts a compound command, for, while,
+ * until, if, case or {, or a function definition, at the start of one of
+ * its commands, so it has to be parsed as a script rather than as a
+ * command list.
+ *
+ * @param line the command line.
+ * @return true if the line needs ast_parse.
+ */
+bool ast_wanted(const char *line);
+
+/*
+ * Parses a script, one or more lines of commands, into a list of nodes.
+ *
+ * Each pipeline of the script is parsed with parseline right away, so
+ * running a node, however many times a loop runs it, only takes a copy of
+ * its tokens and their expansion. The nodes and their tokens are allocated
+ * from command_arena.
+ *
+ * A compound command may be followed by redirections, which apply to all
+ * of it, and may be a command of a pipeline. Such a pipeline is a
+ * NODE_PIPE, whose commands each run in a subshell of their own; a
+ * pipeline of simple commands only is still one NODE_PIPELINE.
+ *
+ * @param script the script; lines are separated by newlines.
+ * @param list receives the first node of the list, NULL for a blank script.
+ * @return AST_OK, AST_INCOMPLETE if the script ends inside a command or
+ *         after && or ||, so more lines are needed, or AST_ERROR after
+ *         printing an error.
+ */
+ast_result ast_parse(const char *script, struct ast_node **list);
+
+/*
+ * Parses a script as ast_parse does, into another arena than
+ * command_arena, for a script that outlives the command line.
+ *
+ * @param arena the arena the nodes and tokens are allocated from.
+ * @param script the script.
+ * @param list receives the first node of the list, NULL for a blank script.
+ * @return the result of ast_parse.
+ */
+ast_result ast_parse_into(struct arena *arena, const char *script,
+                          struct ast_node **list);
+
+/*
+ * Copies the tokens of a node into command_arena, so they can be expanded
+ * without changing the node. The strings are shared with the node.
+ *
+ * @param from the tokens of a node: those of a NODE_PIPELINE or NODE_FOR,
+ *        or the redirections of a compound command.
+ * @param token receives the copy.
+ * @return void
+ */
+void ast_load_tokens(const struct cmdline_tokens *from,
+                     struct cmdline_tokens *token);
+
+#endif //TINY_LINUX_SHELL_AST_H
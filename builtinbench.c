@@ -0,0 +1,83 @@
+// Measures the latency of the small commands scripts run most, as fast
+// builtins in the shell process and as programs started with posix_spawn
+// and waited for, the way run() starts them.
+//
+// Usage: builtinbench [-n runs]
+//
+// Output of the commands goes to /dev/null.
+//
+
+#include "fastbuiltins.h"
+#include <spawn.h>
+#include <time.h>
+
+struct bench_cmd                // A command to time
+{
+    int (*function)(int, char **);  // The fast builtin
+    char *argv[8];                  // The arguments, argv[0] the program
+};
+
+static struct bench_cmd cmds[] = {
+        {fast_true,   {"/bin/true", NULL}},
+        {fast_echo,   {"/bin/echo", "-e", "tsh\\076", "./myspin1", "\\046", NULL}},
+        {fast_printf, {"/usr/bin/printf", "%s %5d\\n", "job", "42", NULL}},
+        {fast_test,   {"/usr/bin/test", "-d", "/tmp", "-a", "x", "=", "x", NULL}},
+        {fast_cat,    {"/bin/cat", "/etc/hostname", NULL}},
+};
+
+static double elapsed_us(struct timespec *t0, struct timespec *t1, int runs) {
+    return ((t1->tv_sec - t0->tv_sec) * 1e9 +
+            (t1->tv_nsec - t0->tv_nsec)) / 1e3 / runs;
+}
+
+int main(int argc, char **argv) {
+    struct timespec t0, t1;
+    double in_us, spawn_us;
+    int runs = 2000, opt, argn, status, null_fd;
+    size_t c;
+    int i;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            runs = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n runs]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    // Results go to stderr, the commands write to /dev/null
+    if ((null_fd = open("/dev/null", O_WRONLY)) < 0) {
+        unix_error("open error");
+    }
+    Dup2(null_fd, STDOUT_FILENO);
+    fprintf(stderr, "%-16s %12s %12s %8s\n", "command", "in-process",
+            "spawned", "speedup");
+
+    for (c = 0; c < sizeof(cmds) / sizeof(cmds[0]); c++) {
+        for (argn = 0; cmds[c].argv[argn] != NULL; argn++);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < runs; i++) {
+            cmds[c].function(argn, cmds[c].argv);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        in_us = elapsed_us(&t0, &t1, runs);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < runs; i++) {
+            if (posix_spawn(&pid, cmds[c].argv[0], NULL, NULL,
+                            cmds[c].argv, environ) != 0) {
+                unix_error("posix_spawn error");
+            }
+            Waitpid(pid, &status, 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        spawn_us = elapsed_us(&t0, &t1, runs);
+
+        fprintf(stderr, "%-16s %9.2f us %9.2f us %7.0fx\n", cmds[c].argv[0],
+                in_us, spawn_us, spawn_us / in_us);
+    }
+    return 0;
+}
@@ -6,64 +6,655 @@
 
 /*
  * Terminates the shell
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return does not return.
  */
-void quit() {
+int quit(int argc, char **argv) {
     exit(0);
 }
 
 /*
  * Lists the running and stopped background jobs.
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0.
  */
-void jobs() {
-    Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
-    listjobs(job_list, STDOUT_FILENO);
-    Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+int jobs(int argc, char **argv) {
+    block_job_signals(NULL);
+    listjobs(&job_list, STDOUT_FILENO);
+    unblock_job_signals();
+    return 0;
+}
+
+/*
+ * Finds the job a job ID (%jid) or process ID argument names.
+ *
+ * Expects the job control signals to be blocked.
+ *
+ * @param arg the argument.
+ * @return the job, or NULL if there is none.
+ */
+static struct job_t *arg_to_job(char *arg) {
+    if (arg[0] == '%') {
+        return getjobjid(&job_list, cmdjid_to_int(arg));
+    }
+    return getjobpid(&job_list, (pid_t) strtol(arg, NULL, 10));
+}
+
+/*
+ * Finds the job the argument of bg or fg names, printing an error if it
+ * is missing, malformed or names no job.
+ *
+ * Expects the job control signals to be blocked.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return the job, or NULL.
+ */
+static struct job_t *job_control_arg(int argc, char **argv) {
+    struct job_t *job;
+    char *digits;
+
+    if (argc < 2) {
+        printf("%s command requires PID or %%jobid argument\n", argv[0]);
+        return NULL;
+    }
+    digits = argv[1][0] == '%' ? argv[1] + 1 : argv[1];
+    if (!isdigit((unsigned char) *digits)) {
+        printf("%s: argument must be a PID or %%jobid\n", argv[0]);
+        return NULL;
+    }
+    if ((job = arg_to_job(argv[1])) == NULL) {
+        if (argv[1][0] == '%') {
+            printf("%s: No such job\n", argv[1]);
+        } else {
+            printf("(%s): No such process\n", argv[1]);
+        }
+    }
+    return job;
 }
 
 /*
  * Changes a stopped job to a running foreground job.
- * @param tokens from parsing the command line.
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if there is no such job, 0 otherwise.
  */
-void bg(struct cmdline_tokens *tokens) {
-    Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
-    int jid = cmdjid_to_int(tokens->argv[1]);
-    struct job_t *job = getjobjid(job_list, jid);
-    printf("[%d] (%d) %s\n", jid, job->pid, job->cmdline);
-    if (job != NULL &&job->state == ST) {
-        job->state = BG;
-        Kill(-job->pid, SIGCONT);
+int bg(int argc, char **argv) {
+    block_job_signals(NULL);
+    struct job_t *job = job_control_arg(argc, argv);
+    if (job == NULL) {
+        unblock_job_signals();
+        return 1;
+    }
+    printf("[%d] (%d) %s\n", job->jid, job->pid, jobcmdline(&job_list, job));
+    if (job->state == ST) {
+        setjobstate(&job_list, job, BG);
+        signal_job(job, SIGCONT);
     }
-    Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+    unblock_job_signals();
+    return 0;
 }
 
 /*
  * Changes a stopped job or running background job
  * into a running foreground job.
- * @param tokens from parsing the command line.
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return the status of the job once it stopped or finished, 0 if there
+ *         was no job to wait for, 1 if there is no such job.
  */
-void fg(struct cmdline_tokens *tokens) {
+int fg(int argc, char **argv) {
     sigset_t old_mask;      // Has SIGINT, SIGTSTP and SIGCHLD Unblocked
-    Sigprocmask(SIG_BLOCK, &job_control_mask, &old_mask);
+    int status = 0;
+    block_job_signals(&old_mask);
 
-    int jid = cmdjid_to_int(tokens->argv[1]);
-    struct job_t *job = getjobjid(job_list, jid);
-
-    if (job != NULL && (job->state == ST || job->state == BG)) {
+    struct job_t *job = job_control_arg(argc, argv);
+    if (job == NULL) {
+        status = 1;
+    } else if (job->state == ST || job->state == BG) {
         if (job->state == ST) {
-            Kill(-job->pid, SIGCONT);
+            signal_job(job, SIGCONT);
+        }
+
+        setjobstate(&job_list, job, FG);
+        wait_for_fg(&old_mask);
+        status = last_status;
+    }
+
+    unblock_job_signals();
+    return status;
+}
+
+/*
+ * Waits for background jobs to be done or stopped.
+ *
+ * wait               waits for every background job.
+ * wait %jid|pid...   waits for each job named.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 127 if a job named does not exist, 0 otherwise.
+ */
+int wait_jobs(int argc, char **argv) {
+    sigset_t old_mask;      // Has SIGINT, SIGTSTP and SIGCHLD Unblocked
+    struct job_t *job;
+    int i, jid, status = 0;
+
+    block_job_signals(&old_mask);
+    if (argc == 1) {
+        for (jid = 1; jid <= job_list.maxjid; jid++) {
+            if ((job = getjobjid(&job_list, jid)) != NULL &&
+                job->state == BG) {
+                wait_for_job(jid, &old_mask);
+            }
+        }
+    }
+    for (i = 1; i < argc; i++) {
+        if ((job = arg_to_job(argv[i])) == NULL) {
+            printf("wait: %s: no such job\n", argv[i]);
+            status = 127;
+            continue;
+        }
+        wait_for_job(job->jid, &old_mask);
+    }
+    unblock_job_signals();
+    return status;
+}
+
+/*
+ * Sends a signal to jobs or processes.
+ *
+ * kill [-sig] %jid|pid...   sends sig, SIGTERM by default, to the process
+ *                           group of each job, or to each process. sig is
+ *                           a number or a name, with or without SIG.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a signal could not be sent, 2 on a usage error, 0 otherwise.
+ */
+int kill_jobs(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        int sig;
+    } signals[] = {
+            {"HUP",  SIGHUP},  {"INT",  SIGINT},  {"QUIT", SIGQUIT},
+            {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+            {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+            {"TSTP", SIGTSTP},
+    };
+    struct job_t *job;
+    char *name, *ep;
+    int i, sig = SIGTERM, status = 0;
+    size_t s;
+
+    i = 1;
+    if (argc > 1 && argv[1][0] == '-') {
+        name = argv[1] + 1;
+        if (strncmp(name, "SIG", 3) == 0) {
+            name += 3;
+        }
+        sig = (int) strtol(name, &ep, 10);
+        if (ep == name || *ep != '\0') {
+            sig = -1;
+            for (s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+                if (strcmp(name, signals[s].name) == 0) {
+                    sig = signals[s].sig;
+                }
+            }
+        }
+        if (sig < 0 || sig >= NSIG) {
+            printf("kill: %s: invalid signal\n", argv[1]);
+            return 2;
+        }
+        i = 2;
+    }
+    if (i == argc) {
+        printf("kill: usage: kill [-sig] %%jid|pid...\n");
+        return 2;
+    }
+
+    block_job_signals(NULL);
+    for (; i < argc; i++) {
+        if ((job = arg_to_job(argv[i])) != NULL) {
+            signal_job(job, sig);
+        } else if (argv[i][0] == '%') {
+            printf("kill: %s: no such job\n", argv[i]);
+            status = 1;
+        } else if (kill((pid_t) strtol(argv[i], NULL, 10), sig) < 0) {
+            printf("kill: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+        }
+    }
+    unblock_job_signals();
+    return status;
+}
+
+/*
+ * Lists, clears or fills the cache of command paths.
+ *
+ * hash           lists the remembered lookups and their hit counts.
+ * hash -r        forgets all remembered lookups.
+ * hash name...   looks up each name in PATH and remembers the result.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a name was not found, 0 otherwise.
+ */
+int hash(int argc, char **argv) {
+    int i, status = 0;
+
+    if (argc == 1) {
+        pathcache_list(STDOUT_FILENO);
+    } else if (strcmp(argv[1], "-r") == 0) {
+        pathcache_clear();
+    } else {
+        for (i = 1; i < argc; i++) {
+            char *name[2] = {argv[i], NULL};
+            if (pathcache_fill(name) > 0) {
+                printf("hash: %s: command not found\n", argv[i]);
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
+
+/*
+ * Shows or clears the cache of parsed command lines.
+ *
+ * parsecache     prints the hit and miss counters and the cache size.
+ * parsecache -r  forgets all cached command lines and resets the counters.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 2 on a usage error, 0 otherwise.
+ */
+int parsecache(int argc, char **argv) {
+    if (argc == 1) {
+        parsecache_stats(STDOUT_FILENO);
+    } else if (strcmp(argv[1], "-r") == 0) {
+        parsecache_clear();
+    } else {
+        printf("parsecache: usage: parsecache [-r]\n");
+        return 2;
+    }
+    return 0;
+}
+
+/*
+ * Turns builtins on or off, so a builtin can give way to the program of
+ * the same name, such as echo to /bin/echo, and loads builtins from
+ * shared objects, so a utility runs in the shell instead of a process.
+ *
+ * enable                     lists the builtins, with -n before those
+ *                            turned off, and the loaded builtins.
+ * enable name...             turns each builtin on.
+ * enable -n name...          turns each builtin off.
+ * enable -f module.so name...  loads each builtin from module.so, see
+ *                            tsh_builtin.h.
+ * enable -d name...          unloads each loaded builtin.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a name is not a builtin or could not be loaded, 2 on a
+ *         usage error, 0 otherwise.
+ */
+int enable(int argc, char **argv) {
+    bool disable = argc > 1 && strcmp(argv[1], "-n") == 0;
+    int i, id, status = 0;
+
+    if (argc == 1) {
+        for (id = BUILTIN_NONE + 1; id < NBUILTINS; id++) {
+            printf("enable %s%s\n", builtin_disabled[id] ? "-n " : "",
+                   builtin_info[id].name);
         }
+        fflush(stdout);
+        module_list(STDOUT_FILENO);
+        return 0;
+    }
 
-        job->state = FG;
+    if (strcmp(argv[1], "-f") == 0) {
+        if (argc < 4) {
+            printf("enable: usage: enable -f module.so name...\n");
+            return 2;
+        }
+        for (i = 3; i < argc; i++) {
+            if (module_load(argv[2], argv[i]) == BUILTIN_NONE) {
+                status = 1;
+            }
+        }
+        def_recompile();
+        return status;
+    }
+    if (strcmp(argv[1], "-d") == 0) {
+        for (i = 2; i < argc; i++) {
+            if (!module_unload(argv[i])) {
+                printf("enable: %s: not a loaded builtin\n", argv[i]);
+                status = 1;
+            }
+        }
+        def_recompile();
+        return status;
+    }
 
-         while (fgpid(job_list)) {
-             Sigsuspend(&old_mask);
-         }
+    for (i = disable ? 2 : 1; i < argc; i++) {
+        for (id = BUILTIN_NONE + 1; id < NBUILTINS; id++) {
+            if (strcmp(argv[i], builtin_info[id].name) == 0) {
+                break;
+            }
+        }
+        if (id == NBUILTINS) {
+            printf("enable: %s: not a shell builtin\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        builtin_disabled[id] = disable;
     }
 
-    Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
-    return;
+    // Parsed commands and bodies name the builtins they found
+    def_recompile();
+    return status;
+}
+
+/*
+ * Checks that an argument of a variable builtin is a valid name, or with
+ * allow_assign a valid assignment, printing an error if it is not.
+ *
+ * @param builtin the name of the builtin, for the error message.
+ * @param arg the argument.
+ * @param allow_assign true if name=value is allowed.
+ * @param require_assign true if name=value is required.
+ * @return true if the argument is valid, false otherwise.
+ */
+static bool valid_var_arg(const char *builtin, const char *arg,
+                          bool allow_assign, bool require_assign) {
+    const char *eq = allow_assign ? strchr(arg, '=') : NULL;
+
+    if ((eq == NULL && require_assign) ||
+        !var_valid_name(arg, eq != NULL ? (size_t) (eq - arg) : strlen(arg))) {
+        printf("%s: `%s': not a valid identifier\n", builtin, arg);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Sets shell variables, or lists them.
+ *
+ * set                  lists the variables as name=value, sorted by name.
+ * set name=value...    sets each variable, keeping exported ones exported.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument is not a valid assignment, 0 otherwise.
+ */
+int set_vars(int argc, char **argv) {
+    int i, status = 0;
+
+    if (argc == 1) {
+        vars_list(false);
+        return 0;
+    }
+    for (i = 1; i < argc; i++) {
+        if (!valid_var_arg("set", argv[i], true, true)) {
+            status = 1;
+            continue;
+        }
+        var_set(argv[i], false);
+    }
+    return status;
+}
+
+/*
+ * Exports shell variables to the environment of the commands the shell
+ * starts, or lists the exported variables.
+ *
+ * export               lists them as export name=value, sorted by name.
+ * export name...       exports each variable, set to "" if it is not set.
+ * export name=value... sets and exports each variable.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument is not a valid name or assignment, 0 otherwise.
+ */
+int export_vars(int argc, char **argv) {
+    int i, status = 0;
+
+    if (argc == 1) {
+        vars_list(true);
+        return 0;
+    }
+    for (i = 1; i < argc; i++) {
+        if (!valid_var_arg("export", argv[i], true, false)) {
+            status = 1;
+        } else if (strchr(argv[i], '=') != NULL) {
+            var_set(argv[i], true);
+        } else {
+            var_export(argv[i]);
+        }
+    }
+    return status;
+}
+
+/*
+ * Removes shell variables, and with them their environment entries, or
+ * shell functions.
+ *
+ * unset name...
+ * unset -f name...
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument is not a valid name, 0 otherwise.
+ */
+int unset_vars(int argc, char **argv) {
+    bool functions = argc > 1 && strcmp(argv[1], "-f") == 0;
+    int i, status = 0;
+
+    for (i = functions ? 2 : 1; i < argc; i++) {
+        if (!valid_var_arg("unset", argv[i], false, false)) {
+            status = 1;
+        } else if (functions) {
+            def_remove(argv[i], DEF_FUNCTION);
+        } else {
+            var_unset(argv[i]);
+        }
+    }
+    return status;
+}
+
+/*
+ * Defines aliases, or prints them.
+ *
+ * alias                lists the aliases as alias name='value', sorted.
+ * alias name...        prints each alias.
+ * alias name=value...  defines each alias. The value is parsed right away,
+ *                      and the arguments the alias is run with are added
+ *                      to the last command of the value.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an alias is not defined or its value does not parse, 0
+ *         otherwise.
+ */
+int alias(int argc, char **argv) {
+    int i, status = 0;
+    char *eq, *name;
+
+    if (argc == 1) {
+        alias_print(NULL);
+        return 0;
+    }
+    for (i = 1; i < argc; i++) {
+        if ((eq = strchr(argv[i], '=')) == NULL) {
+            if (!alias_print(argv[i])) {
+                printf("alias: %s: not found\n", argv[i]);
+                status = 1;
+            }
+            continue;
+        }
+        name = strndup(argv[i], eq - argv[i]);
+        if (name == NULL) {
+            unix_error("strndup error");
+        }
+        if (*name == '\0' || strpbrk(name, " \t/$'\"=") != NULL) {
+            printf("alias: `%s': invalid alias name\n", name);
+            status = 1;
+        } else if (!alias_define(name, eq + 1)) {
+            status = 1;
+        }
+        Free(name);
+    }
+    return status;
+}
+
+/*
+ * Removes aliases.
+ *
+ * unalias name...
+ * unalias -a           removes them all.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an alias is not defined, 2 on a usage error, 0 otherwise.
+ */
+int unalias(int argc, char **argv) {
+    int i, status = 0;
+
+    if (argc == 1) {
+        printf("unalias: usage: unalias [-a] name...\n");
+        return 2;
+    }
+    if (strcmp(argv[1], "-a") == 0) {
+        def_remove_all(DEF_ALIAS);
+        return 0;
+    }
+    for (i = 1; i < argc; i++) {
+        if (!def_remove(argv[i], DEF_ALIAS)) {
+            printf("unalias: %s: not found\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/*
+ * Leaves the running function, with a status.
+ *
+ * return [n]
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return n, by default the status of the last command, or 1 outside a
+ *         function, 2 if n is not a number.
+ */
+int return_function(int argc, char **argv) {
+    char *end;
+    long n = last_status;
+
+    if (!def_running()) {
+        printf("return: can only return from a function\n");
+        return 1;
+    }
+    if (argc > 1) {
+        n = strtol(argv[1], &end, 10);
+        if (*end != '\0' || end == argv[1]) {
+            printf("return: %s: numeric argument required\n", argv[1]);
+            n = 2;
+        }
+    }
+    returning = true;
+    return (int) (n & 0xff);
+}
+
+/*
+ * Reads the number of loops break or continue applies to, capped at the
+ * loops the command runs in.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return the number of loops, 0 outside a loop, or -1 after printing an
+ *         error.
+ */
+static int loop_levels(int argc, char **argv) {
+    char *end;
+    long n = 1;
+
+    if (argc > 1) {
+        n = strtol(argv[1], &end, 10);
+        if (*end != '\0' || end == argv[1] || n <= 0 || argc > 2) {
+            printf("%s: usage: %s [n]\n", argv[0], argv[0]);
+            return -1;
+        }
+    }
+    if (loop_depth == 0) {
+        printf("%s: only meaningful in a loop\n", argv[0]);
+        return 0;
+    }
+    return n < loop_depth ? (int) n : loop_depth;
+}
+
+/*
+ * Leaves the innermost loop, or the innermost n loops.
+ *
+ * break [n]
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0, or 1 if n is not a positive number.
+ */
+int break_loop(int argc, char **argv) {
+    int n = loop_levels(argc, argv);
+
+    if (n < 0) {
+        return 1;
+    }
+    loop_breaks = n;
+    return 0;
+}
+
+/*
+ * Starts the next iteration of the innermost loop, or of the nth one,
+ * leaving the loops inside it.
+ *
+ * continue [n]
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0, or 1 if n is not a positive number.
+ */
+int continue_loop(int argc, char **argv) {
+    int n = loop_levels(argc, argv);
+
+    if (n < 0) {
+        return 1;
+    }
+    loop_continues = n;
+    return 0;
+}
+
+/*
+ * Runs a builtin command.
+ *
+ * @param builtin the builtin.
+ * @param argc the number of arguments.
+ * @param argv the arguments, argv[0] naming the builtin.
+ * @return the exit status of the builtin.
+ */
+int run_builtin(builtin_state builtin, int argc, char **argv) {
+    static int (*const functions[NBUILTINS])(int, char **) = {
+#define BUILTIN(id, name, function, flags) [BUILTIN_##id] = function,
+#include "builtins.def"
+#undef BUILTIN
+    };
+
+    if (builtin >= DEFS_BASE) {
+        return def_run(builtin, argc, argv);
+    }
+    if (builtin >= NBUILTINS) {
+        return module_run(builtin, argc, argv);
+    }
+    return functions[builtin](argc, argv);
 }
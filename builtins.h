@@ -7,33 +7,229 @@
 
 #include "tsh_helper.h"
 #include "utilities.h"
+#include "sighandlers.h"
+#include "pathcache.h"
+#include "parsecache.h"
+#include "fastbuiltins.h"
+#include "modules.h"
+#include "vars.h"
+#include "chunk.h"
+#include "functions.h"
 #include <stdlib.h>
 
 /*
  * Terminates the shell
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return does not return.
  */
-void quit();
+int quit(int argc, char **argv);
 
 /*
  * Lists the running and stopped background jobs.
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0.
  */
-void jobs();
+int jobs(int argc, char **argv);
 
 /*
  * Changes a stopped job to a running foreground job.
- * @param tokens from parsing the command line.
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0.
  */
-void bg(struct cmdline_tokens *tokens);
+int bg(int argc, char **argv);
 
 /*
  * Changes a stopped job or running background job
  * into a running foreground job.
- * @param tokens from parsing the command line.
- * @return void
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0.
  */
-void fg(struct cmdline_tokens *tokens);
+int fg(int argc, char **argv);
+
+/*
+ * Waits for background jobs to be done or stopped.
+ *
+ * wait               waits for every background job.
+ * wait %jid|pid...   waits for each job named.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 127 if a job named does not exist, 0 otherwise.
+ */
+int wait_jobs(int argc, char **argv);
+
+/*
+ * Sends a signal to jobs or processes.
+ *
+ * kill [-sig] %jid|pid...   sends sig, SIGTERM by default, to the process
+ *                           group of each job, or to each process. sig is
+ *                           a number or a name, with or without SIG.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a signal could not be sent, 2 on a usage error, 0 otherwise.
+ */
+int kill_jobs(int argc, char **argv);
+
+/*
+ * Lists, clears or fills the cache of command paths.
+ *
+ * hash           lists the remembered lookups and their hit counts.
+ * hash -r        forgets all remembered lookups.
+ * hash name...   looks up each name in PATH and remembers the result.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a name was not found, 0 otherwise.
+ */
+int hash(int argc, char **argv);
+
+/*
+ * Shows or clears the cache of parsed command lines.
+ *
+ * parsecache     prints the hit and miss counters and the cache size.
+ * parsecache -r  forgets all cached command lines and resets the counters.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 2 on a usage error, 0 otherwise.
+ */
+int parsecache(int argc, char **argv);
+
+/*
+ * Turns builtins on or off, so a builtin can give way to the program of
+ * the same name, such as echo to /bin/echo, and loads builtins from
+ * shared objects, so a utility runs in the shell instead of a process.
+ *
+ * enable                     lists the builtins, with -n before those
+ *                            turned off, and the loaded builtins.
+ * enable name...             turns each builtin on.
+ * enable -n name...          turns each builtin off.
+ * enable -f module.so name...  loads each builtin from module.so, see
+ *                            tsh_builtin.h.
+ * enable -d name...          unloads each loaded builtin.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a name is not a builtin or could not be loaded, 2 on a
+ *         usage error, 0 otherwise.
+ */
+int enable(int argc, char **argv);
+
+/*
+ * Sets shell variables, or lists them.
+ *
+ * set                  lists the variables as name=value, sorted by name.
+ * set name=value...    sets each variable, keeping exported ones exported.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument is not a valid assignment, 0 otherwise.
+ */
+int set_vars(int argc, char **argv);
+
+/*
+ * Exports shell variables to the environment of the commands the shell
+ * starts, or lists the exported variables.
+ *
+ * export               lists them as export name=value, sorted by name.
+ * export name...       exports each variable, set to "" if it is not set.
+ * export name=value... sets and exports each variable.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument is not a valid name or assignment, 0 otherwise.
+ */
+int export_vars(int argc, char **argv);
+
+/*
+ * Removes shell variables, and with them their environment entries, or
+ * shell functions.
+ *
+ * unset name...
+ * unset -f name...
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument is not a valid name, 0 otherwise.
+ */
+int unset_vars(int argc, char **argv);
+
+/*
+ * Defines aliases, or prints them.
+ *
+ * alias                lists the aliases as alias name='value', sorted.
+ * alias name...        prints each alias.
+ * alias name=value...  defines each alias. The value is parsed right away,
+ *                      and the arguments the alias is run with are added
+ *                      to the last command of the value.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an alias is not defined or its value does not parse, 0
+ *         otherwise.
+ */
+int alias(int argc, char **argv);
+
+/*
+ * Removes aliases.
+ *
+ * unalias name...
+ * unalias -a           removes them all.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an alias is not defined, 2 on a usage error, 0 otherwise.
+ */
+int unalias(int argc, char **argv);
+
+/*
+ * Leaves the running function, with a status.
+ *
+ * return [n]
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return n, by default the status of the last command, or 1 outside a
+ *         function, 2 if n is not a number.
+ */
+int return_function(int argc, char **argv);
+
+/*
+ * Leaves the innermost loop, or the innermost n loops.
+ *
+ * break [n]
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0, or 1 if n is not a positive number.
+ */
+int break_loop(int argc, char **argv);
+
+/*
+ * Starts the next iteration of the innermost loop, or of the nth one,
+ * leaving the loops inside it.
+ *
+ * continue [n]
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0, or 1 if n is not a positive number.
+ */
+int continue_loop(int argc, char **argv);
+
+/*
+ * Runs a builtin command.
+ *
+ * @param builtin the builtin.
+ * @param argc the number of arguments.
+ * @param argv the arguments, argv[0] naming the builtin.
+ * @return the exit status of the builtin.
+ */
+int run_builtin(builtin_state builtin, int argc, char **argv);
 
 #endif //TINY_LINUX_SHELL_BUILTINS_H
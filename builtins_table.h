@@ -0,0 +1,72 @@
+// Generated from builtins.def by mkbuiltins, do not edit.
+
+#define BUILTIN_HASH_SEED 244u
+#define BUILTIN_HASH_SLOTS 64
+
+static const builtin_state builtin_slots[BUILTIN_HASH_SLOTS] =
+{
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_ECHO,
+    BUILTIN_NONE,
+    BUILTIN_ALIAS,
+    BUILTIN_NONE,
+    BUILTIN_EXPORT,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_CONTINUE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_BREAK,
+    BUILTIN_ENABLE,
+    BUILTIN_UNSET,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_CAT,
+    BUILTIN_FALSE,
+    BUILTIN_QUIT,
+    BUILTIN_NONE,
+    BUILTIN_CHUNK,
+    BUILTIN_PRINTF,
+    BUILTIN_WAIT,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_RETURN,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_SET,
+    BUILTIN_NONE,
+    BUILTIN_TRUE,
+    BUILTIN_NONE,
+    BUILTIN_HASH,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_FG,
+    BUILTIN_KILL,
+    BUILTIN_PARSECACHE,
+    BUILTIN_NONE,
+    BUILTIN_JOBS,
+    BUILTIN_NONE,
+    BUILTIN_UNALIAS,
+    BUILTIN_TEST,
+    BUILTIN_BG,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_NONE,
+    BUILTIN_BRACKET,
+    BUILTIN_NONE,
+};
@@ -0,0 +1,178 @@
+//
+// chunk.c - The chunk builtin, which splits long argument lists
+//
+
+#include "chunk.h"
+
+/*
+ * Returns the bytes execve needs for a string: the string, its NUL and the
+ * pointer to it.
+ */
+static size_t arg_size(const char *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+/*
+ * Waits for one invocation to finish.
+ *
+ * @return true if it succeeded, false otherwise.
+ */
+static bool wait_invocation(void) {
+    int wstatus;
+
+    while (wait(&wstatus) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+}
+
+/*
+ * Reads a count option of chunk, either attached (-P4) or as the next
+ * argument (-P 4).
+ *
+ * @param argv the arguments, at the option.
+ * @param i the index of the option, advanced past its value.
+ * @param value receives the count.
+ * @return true if the count is valid, false otherwise.
+ */
+static bool count_option(char **argv, int *i, int *value) {
+    char *arg = argv[*i][2] != '\0' ? argv[*i] + 2 : argv[++*i];
+    char *end;
+
+    if (arg == NULL) {
+        return false;
+    }
+    *value = (int) strtol(arg, &end, 10);
+    return *end == '\0' && end != arg && *value >= 0;
+}
+
+/*
+ * Runs a command whose arguments may not fit in one execve, as xargs does
+ * with arguments from its input.
+ *
+ * chunk [-P jobs] [-k count] command [arg...]
+ *
+ * If the arguments and the environment fit in ARG_MAX, the command simply
+ * replaces the process. Otherwise the arguments after the fixed ones are
+ * split into batches that fit, and the command is run once per batch with
+ * the fixed arguments in front, up to jobs (1 by default) at a time. The
+ * fixed arguments are the first count (by default the leading ones that
+ * start with -, up to a --).
+ *
+ * chunk runs in a forked subshell, the process group of its job, so the
+ * invocations are members of the one job and are stopped, continued and
+ * interrupted with it.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0 if every invocation succeeded, CHUNK_FAILED if one failed,
+ *         126 if the command could not be run, 127 if it was not found,
+ *         2 on a usage error.
+ */
+int chunk(int argc, char **argv) {
+    int i, j, nfixed = -1, max_jobs = 1, running = 0, err;
+    size_t limit, fixed_size = sizeof(char *), size;
+    char **cmd, **batch, **e;
+    const char *path;
+    bool failed = false;
+    pid_t pid;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (strncmp(argv[i], "-P", 2) == 0 &&
+            count_option(argv, &i, &max_jobs) && max_jobs > 0) {
+            continue;
+        }
+        if (strncmp(argv[i], "-k", 2) == 0 &&
+            count_option(argv, &i, &nfixed)) {
+            continue;
+        }
+        break;
+    }
+    if (i >= argc || argv[i][0] == '-') {
+        printf("chunk: usage: chunk [-P jobs] [-k count] command [arg...]\n");
+        return 2;
+    }
+    cmd = argv + i;
+    argc -= i;
+
+    if ((path = resolve_command(cmd[0], NULL)) == NULL) {
+        printf("%s: command not found\n", cmd[0]);
+        return 127;
+    }
+
+    // The environment goes to every invocation
+    size = CHUNK_HEADROOM + sizeof(char *);
+    for (e = environ; *e != NULL; e++) {
+        size += arg_size(*e);
+    }
+    if (size >= (size_t) sysconf(_SC_ARG_MAX)) {
+        printf("%s: %s\n", cmd[0], strerror(E2BIG));
+        return 126;
+    }
+    limit = sysconf(_SC_ARG_MAX) - size;
+
+    if (nfixed < 0) {
+        for (nfixed = 1; nfixed < argc && cmd[nfixed][0] == '-'; nfixed++) {
+            if (strcmp(cmd[nfixed], "--") == 0) {
+                nfixed++;
+                break;
+            }
+        }
+    } else if (++nfixed > argc) {
+        nfixed = argc;
+    }
+    for (i = 0, size = 0; i < argc; i++) {
+        size += arg_size(cmd[i]);
+        if (i == nfixed - 1) {
+            fixed_size += size;
+        }
+    }
+
+    fflush(stdout);
+    if (size + sizeof(char *) <= limit) {
+        execve(path, cmd, environ);
+        printf("%s: %s\n", cmd[0], strerror(errno));
+        return 126;
+    }
+
+    if (nfixed == argc || fixed_size > limit) {
+        printf("%s: %s\n", cmd[0], strerror(E2BIG));
+        return 126;
+    }
+
+    // Fill each batch up to the limit, and keep up to max_jobs running
+    batch = Malloc((argc + 1) * sizeof(char *));
+    memcpy(batch, cmd, nfixed * sizeof(char *));
+    for (i = nfixed; i < argc; i = j) {
+        size = fixed_size;
+        for (j = i; j < argc && size + arg_size(cmd[j]) <= limit; j++) {
+            size += arg_size(cmd[j]);
+            batch[nfixed + j - i] = cmd[j];
+        }
+        if (j == i) {
+            printf("%s: %s\n", cmd[0], strerror(E2BIG));
+            failed = true;
+            break;
+        }
+        batch[nfixed + j - i] = NULL;
+
+        if (running == max_jobs) {
+            failed |= !wait_invocation();
+            running--;
+        }
+        if ((err = posix_spawn(&pid, path, NULL, NULL, batch, environ)) != 0) {
+            printf("%s: %s\n", cmd[0], strerror(err));
+            failed = true;
+            break;
+        }
+        running++;
+    }
+
+    while (running-- > 0) {
+        failed |= !wait_invocation();
+    }
+    Free(batch);
+    return failed ? CHUNK_FAILED : 0;
+}
@@ -0,0 +1,40 @@
+//
+// chunk.h - The chunk builtin, which splits long argument lists
+//
+
+#ifndef TINY_LINUX_SHELL_CHUNK_H
+#define TINY_LINUX_SHELL_CHUNK_H
+
+#include "tsh_helper.h"
+#include "pathcache.h"
+#include <spawn.h>
+
+#define CHUNK_HEADROOM  2048    // Bytes of ARG_MAX left unused, as xargs does
+#define CHUNK_FAILED    123     // Status when an invocation failed, as xargs
+
+/*
+ * Runs a command whose arguments may not fit in one execve, as xargs does
+ * with arguments from its input.
+ *
+ * chunk [-P jobs] [-k count] command [arg...]
+ *
+ * If the arguments and the environment fit in ARG_MAX, the command simply
+ * replaces the process. Otherwise the arguments after the fixed ones are
+ * split into batches that fit, and the command is run once per batch with
+ * the fixed arguments in front, up to jobs (1 by default) at a time. The
+ * fixed arguments are the first count (by default the leading ones that
+ * start with -, up to a --).
+ *
+ * chunk runs in a forked subshell, the process group of its job, so the
+ * invocations are members of the one job and are stopped, continued and
+ * interrupted with it.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0 if every invocation succeeded, CHUNK_FAILED if one failed,
+ *         126 if the command could not be run, 127 if it was not found,
+ *         2 on a usage error.
+ */
+int chunk(int argc, char **argv);
+
+#endif //TINY_LINUX_SHELL_CHUNK_H
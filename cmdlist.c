@@ -0,0 +1,121 @@
+//
+// cmdlist.c - Splits command lines into lists joined by ;, &, && and ||
+//
+
+#include "cmdlist.h"
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+ * Trims the blanks around a pipeline, in place.
+ *
+ * @param start the first byte of the pipeline.
+ * @param end the byte after the pipeline.
+ * @return the pipeline, or NULL if it is blank.
+ */
+static char *trim(char *start, char *end) {
+    while (start < end && is_blank(*start)) {
+        start++;
+    }
+    while (end > start && is_blank(end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    return start < end ? start : NULL;
+}
+
+/*
+ * Splits a command line into the pipelines of a command list,
+ *
+ *     pipeline [op pipeline]... [; | &]
+ *
+ * where op is ;, &, && or ||. Operators inside quotes or a $(...), and
+ * the & of a >& or <& redirection, do not split the line. Quotes start words, as in
+ * parseline, and an unmatched quote is left for parseline to report.
+ *
+ * The pipelines are copied to command_arena, so the line is not changed.
+ *
+ * @param line the command line.
+ * @param cmds receives the pipelines, in order.
+ * @return the number of pipelines, 0 for a blank line, or -1 after
+ *         printing an error if an operator has no pipeline before it, or
+ *         && or || none after it.
+ */
+int split_list(const char *line, struct list_cmd **cmds) {
+    static const char *op_names[] = {"", ";", "&", "&&", "||"};
+    size_t len = strlen(line), cap = 4;
+    char *text = arena_strndup(&command_arena, line, len);
+    char *p, *start, *quote;
+    const char *subst;
+    bool word_start = true;
+    list_op op;
+    int n = 0;
+
+    *cmds = arena_alloc(&command_arena, cap * sizeof(struct list_cmd));
+    for (p = start = text; *p != '\0'; p++) {
+        if (word_start && (*p == '\'' || *p == '"')) {
+            if ((quote = strchr(p + 1, *p)) == NULL) {
+                break;
+            }
+            p = quote;
+            word_start = false;
+            continue;
+        }
+        if (strchr("$<>", *p) != NULL && p[1] == '(' &&
+            (subst = subst_end(p)) != NULL) {
+            p = (char *) subst - 1;
+            word_start = false;
+            continue;
+        }
+
+        if (*p == ';') {
+            op = LIST_SEQ;
+        } else if (*p == '&' && p[1] == '&') {
+            op = LIST_AND;
+        } else if (*p == '|' && p[1] == '|') {
+            op = LIST_OR;
+        } else if (*p == '&' && (p == text || (p[-1] != '>' && p[-1] != '<'))) {
+            op = LIST_BG;
+        } else {
+            // Quotes also start the words after blanks, pipes and redirections
+            word_start = is_blank(*p) || *p == '|' || *p == '<' || *p == '>';
+            continue;
+        }
+
+        if (n == cap) {
+            *cmds = arena_grow(&command_arena, *cmds,
+                               cap * sizeof(struct list_cmd),
+                               2 * cap * sizeof(struct list_cmd));
+            cap *= 2;
+        }
+        *p = '\0';
+        if (((*cmds)[n].text = trim(start, p)) == NULL) {
+            fprintf(stderr, "Error: syntax error near '%s'\n", op_names[op]);
+            return -1;
+        }
+        (*cmds)[n++].op = op;
+        if (op == LIST_AND || op == LIST_OR) {
+            p++;
+        }
+        start = p + 1;
+        word_start = true;
+    }
+
+    // The last pipeline, which may be left out after ; and &
+    if (n == cap) {
+        *cmds = arena_grow(&command_arena, *cmds,
+                           cap * sizeof(struct list_cmd),
+                           (cap + 1) * sizeof(struct list_cmd));
+    }
+    if (((*cmds)[n].text = trim(start, text + len)) != NULL) {
+        (*cmds)[n++].op = LIST_END;
+    } else if (n > 0 && ((*cmds)[n - 1].op == LIST_AND ||
+                         (*cmds)[n - 1].op == LIST_OR)) {
+        fprintf(stderr, "Error: syntax error near '%s'\n",
+                op_names[(*cmds)[n - 1].op]);
+        return -1;
+    }
+    return n;
+}
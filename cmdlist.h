@@ -0,0 +1,45 @@
+//
+// cmdlist.h - Splits command lines into lists joined by ;, &, && and ||
+//
+
+#ifndef TINY_LINUX_SHELL_CMDLIST_H
+#define TINY_LINUX_SHELL_CMDLIST_H
+
+#include "tsh_helper.h"
+
+// The operator that ends a pipeline of a command list
+typedef enum list_op
+{
+    LIST_END,                   // End of the line
+    LIST_SEQ,                   // ;
+    LIST_BG,                    // &
+    LIST_AND,                   // &&
+    LIST_OR                     // ||
+} list_op;
+
+struct list_cmd                 // One pipeline of a command list
+{
+    char *text;                 // The pipeline, without blanks around it
+    list_op op;                 // The operator after it
+};
+
+/*
+ * Splits a command line into the pipelines of a command list,
+ *
+ *     pipeline [op pipeline]... [; | &]
+ *
+ * where op is ;, &, && or ||. Operators inside quotes, and the & of a
+ * >& or <& redirection, do not split the line. Quotes start words, as in
+ * parseline, and an unmatched quote is left for parseline to report.
+ *
+ * The pipelines are copied to command_arena, so the line is not changed.
+ *
+ * @param line the command line.
+ * @param cmds receives the pipelines, in order.
+ * @return the number of pipelines, 0 for a blank line, or -1 after
+ *         printing an error if an operator has no pipeline before it, or
+ *         && or || none after it.
+ */
+int split_list(const char *line, struct list_cmd **cmds);
+
+#endif //TINY_LINUX_SHELL_CMDLIST_H
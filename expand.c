@@ -0,0 +1,286 @@
+//
+// expand.c - Expansion of parameters, substitutions and patterns in words
+//
+
+#include "expand.h"
+
+#define MAXSTATUSLEN    12      // Digits of an int, a sign and a NUL
+
+/*
+ * Finds the value of the parameter a $ starts.
+ *
+ * @param p the $.
+ * @param used receives the length of the parameter, with the $.
+ * @param status a buffer of MAXSTATUSLEN bytes for the value of $? or $#.
+ * @return the value, "" for an unset variable, or NULL if the $ does not
+ *         start a parameter and stands for itself.
+ */
+static const char *param_value(const char *p, size_t *used, char *status) {
+    const char *name = p + 1, *value;
+    size_t len;
+
+    if (*name == '?' || *name == '#') {
+        sprintf(status, "%d", *name == '?' ? last_status : script_argc);
+        *used = 2;
+        return status;
+    }
+    if (*name == '{' && name[1] >= '1' && name[1] <= '9' && name[2] == '}') {
+        *used = 4;
+        name++;
+    } else if (*name >= '1' && *name <= '9') {
+        *used = 2;
+    } else {
+        name = NULL;
+    }
+    if (name != NULL) {
+        return *name - '0' <= script_argc ? script_argv[*name - '1'] : "";
+    }
+
+    name = p + 1;
+    if (*name == '{') {
+        name++;
+        len = strcspn(name, "}");
+        if (name[len] != '}' || !var_valid_name(name, len)) {
+            return NULL;
+        }
+        *used = len + 3;
+    } else {
+        for (len = 0; isalnum((unsigned char) name[len]) || name[len] == '_';
+             len++);
+        if (!var_valid_name(name, len)) {
+            return NULL;
+        }
+        *used = len + 1;
+    }
+    return (value = var_get(name, len)) != NULL ? value : "";
+}
+
+/*
+ * Expands the parameters and command substitutions of one word. The word
+ * is built in one pass, growing as needed, since each command substitution
+ * may only run once.
+ *
+ * @param word the word, which contains a $.
+ * @return the expanded word, in command_arena.
+ */
+static char *expand_word(const char *word) {
+    char status[MAXSTATUSLEN], *out;
+    size_t len = 0, size = strlen(word) + 1, n, used;
+    const char *p, *value, *end;
+
+    out = arena_alloc(&command_arena, size);
+    for (p = word; *p != '\0'; p += used) {
+        if (*p == '$' && p[1] == '(' && (end = subst_end(p)) != NULL) {
+            value = capture_output(arena_strndup(&command_arena, p + 2,
+                                                 end - p - 3), &n);
+            used = end - p;
+        } else if (*p == '$' &&
+                   (value = param_value(p, &used, status)) != NULL) {
+            n = strlen(value);
+        } else {
+            value = p;
+            n = used = 1;
+        }
+        if (len + n >= size) {
+            out = arena_grow(&command_arena, out, size, 2 * (len + n) + 1);
+            size = 2 * (len + n) + 1;
+        }
+        memcpy(out + len, value, n);
+        len += n;
+    }
+    out[len] = '\0';
+    return out;
+}
+
+/*
+ * Splits an unquoted word with a command substitution, once expanded, into
+ * fields at blanks and newlines, in place.
+ *
+ * @param word the expanded word.
+ * @param fields receives the fields, in command_arena.
+ * @return the number of fields, 0 if the word is blank.
+ */
+static int split_fields(char *word, char ***fields) {
+    static const char blanks[] = " \t\n";
+    int n = 0, cap = 4;
+
+    *fields = arena_alloc(&command_arena, cap * sizeof(char *));
+    for (word += strspn(word, blanks); *word != '\0';
+         word += strspn(word, blanks)) {
+        if (n == cap) {
+            *fields = arena_grow(&command_arena, *fields, cap * sizeof(char *),
+                                 2 * cap * sizeof(char *));
+            cap *= 2;
+        }
+        (*fields)[n++] = word;
+        word += strcspn(word, blanks);
+        if (*word != '\0') {
+            *word++ = '\0';
+        }
+    }
+    return n;
+}
+
+/*
+ * Checks whether a word starts with a process substitution, <(...) or >(...).
+ */
+static bool process_word(const char *word) {
+    return (*word == '<' || *word == '>') && word[1] == '(';
+}
+
+/*
+ * Starts the command of the process substitution a word starts with, and
+ * replaces it by the path of the pipe the command reads or writes. What
+ * follows the ) is kept as it is.
+ *
+ * @param word the word, which starts with <( or >(.
+ * @return the expanded word, in command_arena.
+ */
+static char *expand_process(const char *word) {
+    const char *end = subst_end(word);
+    char *path, *out;
+    size_t len;
+
+    path = process_subst(arena_strndup(&command_arena, word + 2,
+                                       end - word - 3), *word == '>');
+    if (*end == '\0') {
+        return path;
+    }
+    len = strlen(path);
+    out = arena_alloc(&command_arena, len + strlen(end) + 1);
+    memcpy(out, path, len);
+    strcpy(out + len, end);
+    return out;
+}
+
+/*
+ * Expands the parameters and command substitutions of a word that is not
+ * part of parsed tokens, such as the word and the patterns of a case
+ * command. The word is not split.
+ *
+ * @param word the word.
+ * @return the expanded word, in command_arena, or the word itself if it
+ *         has no parameters.
+ */
+const char *expand_parameters(const char *word) {
+    return strchr(word, '$') != NULL ? expand_word(word) : word;
+}
+
+/*
+ * Expands the parameters in the assignments, arguments and redirection
+ * files of parsed tokens: $? becomes the exit status of the last command,
+ * $1 to $9 and $# the arguments of the running function and their number,
+ * and $name and ${name} the value of a variable. A command substitution,
+ * $(command), becomes the output of the command, less the newlines at its
+ * end, and an unquoted argument with one is split into one argument per
+ * field of blanks and newlines. Words in single quotes are left as they
+ * are, and an unquoted argument that expands to nothing is removed. An
+ * unquoted argument or redirection file that starts with a process
+ * substitution, <(command) or >(command), starts the command and becomes
+ * the /dev/fd path of the pipe it writes or reads.
+ *
+ * Then unquoted arguments that are patterns are replaced by the paths that
+ * match them, sorted, or left as they are if none do, and an unquoted
+ * redirection file that is a pattern by the one path that matches it. The
+ * body of a here-document is decoded, and its parameters are expanded
+ * unless its delimiter was quoted, and so are those of a here-string
+ * unless it is in single quotes.
+ *
+ * Expanded words are new strings in command_arena, and the text of the
+ * tokens is not changed, so tokens from the parse cache are expanded
+ * afresh each time they run. A stage that gains arguments gets a new argv
+ * in command_arena, so only the argv of the stages is valid afterwards.
+ *
+ * @param token the tokens from parseline.
+ */
+void expand_words(struct cmdline_tokens *token) {
+    struct cmd_stage *stage;
+    struct redirection *redir;
+    char **words, **out, **matches, *word, quote;
+    int i, j, n, total, size, nmatches;
+    bool split;
+
+    for (i = 0; i < token->nstages; i++) {
+        stage = &token->stages[i];
+        words = stage->argv - stage->nassigns;
+        total = stage->nassigns + stage->argc;
+
+        // The words are expanded in place until a pattern adds some
+        out = words;
+        size = total + 1;
+        for (j = 0, n = 0; j < total; j++) {
+            word = words[j];
+            if ((quote = word_quote(token, word)) == '\'') {
+                out[n++] = word;
+                continue;
+            }
+            if (j >= stage->nassigns && quote == 0 && process_word(word)) {
+                out[n++] = expand_process(word);
+                continue;
+            }
+            split = false;
+            if (strchr(word, '$') != NULL) {
+                split = j >= stage->nassigns && quote == 0 &&
+                        strstr(word, "$(") != NULL;
+                word = expand_word(word);
+                if (*word == '\0' && j >= stage->nassigns && quote == 0) {
+                    continue;
+                }
+            }
+            if (split) {
+                nmatches = split_fields(word, &matches);
+            } else if (j < stage->nassigns || quote != 0 ||
+                       !wildcard_pattern(word) ||
+                       (nmatches = wildcard_expand(word, &matches)) == 0) {
+                out[n++] = word;
+                continue;
+            }
+            if (nmatches <= 1) {    // Fits in place of the word
+                if (nmatches == 1) {
+                    out[n++] = matches[0];
+                }
+                continue;
+            }
+            if (out == words || n + nmatches + total - j >= size) {
+                size = 2 * (n + nmatches + total - j) + 1;
+                out = memcpy(arena_alloc(&command_arena, size * sizeof(char *)),
+                             out, n * sizeof(char *));
+            }
+            memcpy(out + n, matches, nmatches * sizeof(char *));
+            n += nmatches;
+        }
+        stage->argv = out + stage->nassigns;
+        stage->argc = n - stage->nassigns;
+        stage->argv[stage->argc] = NULL;
+
+        for (j = 0; j < stage->nredirs; j++) {
+            redir = &stage->redirs[j];
+            if (redir->file == NULL) {
+                continue;
+            }
+            quote = word_quote(token, redir->file);
+            if (redir->type == REDIR_HEREDOC) {
+                redir->file = heredoc_decode(redir->file);
+            }
+            if (quote == '\'') {
+                continue;
+            }
+            if (quote == 0 && redir->type != REDIR_HEREDOC &&
+                redir->type != REDIR_HERESTRING &&
+                process_word(redir->file)) {
+                redir->file = expand_process(redir->file);
+                continue;
+            }
+            if (strchr(redir->file, '$') != NULL) {
+                redir->file = expand_word(redir->file);
+            }
+            if (quote == 0 && redir->type != REDIR_HEREDOC &&
+                redir->type != REDIR_HERESTRING &&
+                wildcard_pattern(redir->file) &&
+                wildcard_expand(redir->file, &matches) == 1) {
+                redir->file = matches[0];
+            }
+        }
+    }
+    token->argc = token->stages[0].argc;
+}
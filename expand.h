@@ -0,0 +1,74 @@
+//
+// expand.h - Expansion of parameters, substitutions and patterns in words
+//
+
+#ifndef TINY_LINUX_SHELL_EXPAND_H
+#define TINY_LINUX_SHELL_EXPAND_H
+
+#include "tsh_helper.h"
+#include "utilities.h"
+#include "vars.h"
+#include "wildcard.h"
+
+/*
+ * Expands the parameters in the assignments, arguments and redirection
+ * files of parsed tokens: $? becomes the exit status of the last command,
+ * $1 to $9 and $# the arguments of the running function and their number,
+ * and $name and ${name} the value of a variable. A command substitution,
+ * $(command), becomes the output of the command, less the newlines at its
+ * end, and an unquoted argument with one is split into one argument per
+ * field of blanks and newlines. Words in single quotes are left as they
+ * are, and an unquoted argument that expands to nothing is removed. An
+ * unquoted argument or redirection file that starts with a process
+ * substitution, <(command) or >(command), starts the command and becomes
+ * the /dev/fd path of the pipe it writes or reads.
+ *
+ * Then unquoted arguments that are patterns are replaced by the paths that
+ * match them, sorted, or left as they are if none do, and a redirection
+ * file that is a pattern by the one path that matches it. The body of a
+ * here-document is decoded, and its parameters are expanded unless its
+ * delimiter was quoted.
+ *
+ * Expanded words are new strings in command_arena, and the text of the
+ * tokens is not changed, so tokens from the parse cache are expanded
+ * afresh each time they run. A stage that gains arguments gets a new argv
+ * in command_arena, so only the argv of the stages is valid afterwards.
+ *
+ * @param token the tokens from parseline.
+ */
+void expand_words(struct cmdline_tokens *token);
+
+/*
+ * Expands the parameters and command substitutions of a word that is not
+ * part of parsed tokens, such as the word and the patterns of a case
+ * command. The word is not split.
+ *
+ * @param word the word.
+ * @return the expanded word, in command_arena, or the word itself if it
+ *         has no parameters.
+ */
+const char *expand_parameters(const char *word);
+
+/*
+ * Runs the command of a command substitution and returns its output, less
+ * the newlines at its end. Defined in tsh.c, which runs commands.
+ *
+ * @param cmdline the command, the text between $( and ).
+ * @param len receives the length of the output.
+ * @return the output, in command_arena.
+ */
+char *capture_output(const char *cmdline, size_t *len);
+
+/*
+ * Starts the command of a process substitution, connected to the shell by
+ * a pipe, and returns the /dev/fd path of the shell's end, for the command
+ * line the substitution is in. Defined in tsh.c, which runs commands.
+ *
+ * @param cmdline the command, the text between <( or >( and ).
+ * @param output true for >(command), which reads what is written to the
+ *        path, false for <(command), whose output is read from it.
+ * @return the path, in command_arena.
+ */
+char *process_subst(const char *cmdline, bool output);
+
+#endif //TINY_LINUX_SHELL_EXPAND_H
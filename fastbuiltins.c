@@ -0,0 +1,800 @@
+//
+// fastbuiltins.c - Builtins that run in place of common small programs
+//
+
+#include "fastbuiltins.h"
+
+#define CATBUFSIZE  65536   // Bytes copied by cat per read
+
+/*
+ * Output of a fast builtin. Bytes are collected in buf and written to fd
+ * once it fills up or the builtin finishes.
+ */
+struct out_buf
+{
+    char *buf;              // The bytes not written yet
+    size_t len;             // Number of bytes in buf
+    size_t size;            // Number of bytes in buf at most
+    int fd;                 // The descriptor written to
+    int error;              // errno of the first failed write, or 0
+};
+
+/*
+ * Starts output to a descriptor, into a buffer of OUTBUFSIZE bytes.
+ * Whatever the shell printed with stdio goes first.
+ */
+static void out_init(struct out_buf *out, char *buf, int fd) {
+    fflush(stdout);
+    out->buf = buf;
+    out->len = 0;
+    out->size = OUTBUFSIZE;
+    out->fd = fd;
+    out->error = 0;
+}
+
+/*
+ * Writes the buffered bytes to the descriptor. After a failure, later
+ * bytes are dropped.
+ */
+static void out_flush(struct out_buf *out) {
+    if (out->len > 0 && out->error == 0 &&
+        rio_writen(out->fd, out->buf, out->len) < 0) {
+        out->error = errno;
+    }
+    out->len = 0;
+}
+
+/*
+ * Appends bytes to the output.
+ */
+static void out_write(struct out_buf *out, const char *bytes, size_t n) {
+    if (out->len + n > out->size) {
+        out_flush(out);
+    }
+    if (n > out->size) {        // Too big to buffer, so write it directly
+        if (out->error == 0 && rio_writen(out->fd, (void *) bytes, n) < 0) {
+            out->error = errno;
+        }
+        return;
+    }
+    memcpy(out->buf + out->len, bytes, n);
+    out->len += n;
+}
+
+static void out_putc(struct out_buf *out, char c) {
+    if (out->len == out->size) {
+        out_write(out, &c, 1);
+    } else {
+        out->buf[out->len++] = c;
+    }
+}
+
+/*
+ * Appends text formatted by vsnprintf to the output.
+ */
+static void out_printf(struct out_buf *out, const char *fmt, ...) {
+    char small[256], *text = small;
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (n >= (int) sizeof(small)) {
+        text = Malloc(n + 1);
+        va_start(ap, fmt);
+        vsnprintf(text, n + 1, fmt, ap);
+        va_end(ap);
+    }
+    if (n > 0) {
+        out_write(out, text, n);
+    }
+    if (text != small) {
+        Free(text);
+    }
+}
+
+/*
+ * Writes the rest of the output, and reports whether any of it failed.
+ *
+ * @param out the output.
+ * @param name the name of the builtin, for the error message.
+ * @return 1 if a write failed, 0 otherwise.
+ */
+static int out_close(struct out_buf *out, const char *name) {
+    out_flush(out);
+    if (out->error != 0) {
+        fprintf(stderr, "%s: write error: %s\n", name, strerror(out->error));
+        return 1;
+    }
+    return 0;
+}
+
+static bool is_octal(char c) {
+    return c >= '0' && c <= '7';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Appends a string to the output with its backslash escapes interpreted,
+ * as echo -e, printf %b and printf formats do.
+ *
+ * @param out the output.
+ * @param s the string.
+ * @param zero_octal true if octal escapes are \0NNN, as for echo and %b,
+ *        rather than \NNN, as in printf formats.
+ * @param stop_at_percent true to stop at a % directive of a format.
+ * @return the end of the text appended, or NULL if \c ended all output.
+ */
+static const char *put_escaped(struct out_buf *out, const char *s,
+                               bool zero_octal, bool stop_at_percent) {
+    int c, i, digit;
+
+    for (; *s != '\0'; s++) {
+        if (stop_at_percent && *s == '%') {
+            return s;
+        }
+        if (*s != '\\' || s[1] == '\0') {
+            out_putc(out, *s);
+            continue;
+        }
+
+        switch (*++s) {
+            case 'a': out_putc(out, '\a'); break;
+            case 'b': out_putc(out, '\b'); break;
+            case 'c': return NULL;
+            case 'e': out_putc(out, '\033'); break;
+            case 'f': out_putc(out, '\f'); break;
+            case 'n': out_putc(out, '\n'); break;
+            case 'r': out_putc(out, '\r'); break;
+            case 't': out_putc(out, '\t'); break;
+            case 'v': out_putc(out, '\v'); break;
+            case '\\': out_putc(out, '\\'); break;
+            case 'x':
+                if (hex_value(s[1]) < 0) {
+                    out_write(out, "\\x", 2);
+                    break;
+                }
+                for (c = 0, i = 0; i < 2 && (digit = hex_value(s[1])) >= 0; i++) {
+                    c = c * 16 + digit;
+                    s++;
+                }
+                out_putc(out, (char) c);
+                break;
+            default:
+                if (!is_octal(*s)) {
+                    out_putc(out, '\\');
+                    out_putc(out, *s);
+                    break;
+                }
+                if (zero_octal && *s == '0') {
+                    s++;
+                }
+                s--;
+                for (c = 0, i = 0; i < 3 && is_octal(s[1]); i++) {
+                    c = c * 8 + (*++s - '0');
+                }
+                out_putc(out, (char) c);
+                break;
+        }
+    }
+    return s;
+}
+
+/*
+ * Prints its arguments separated by spaces and followed by a newline.
+ *
+ * echo [-neE] [arg...]   -n omits the newline, -e interprets backslash
+ *                        escapes and -E (the default) does not.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if the output could not be written, 0 otherwise.
+ */
+int fast_echo(int argc, char **argv) {
+    char buf[OUTBUFSIZE];
+    struct out_buf out;
+    bool newline = true, escapes = false;
+    int i;
+    char *opt;
+
+    // Leading arguments made only of n, e and E are options
+    for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (argv[i][strspn(argv[i] + 1, "neE") + 1] != '\0') {
+            break;
+        }
+        for (opt = argv[i] + 1; *opt != '\0'; opt++) {
+            if (*opt == 'n') {
+                newline = false;
+            } else {
+                escapes = *opt == 'e';
+            }
+        }
+    }
+
+    out_init(&out, buf, STDOUT_FILENO);
+    for (; i < argc; i++) {
+        if (!escapes) {
+            out_write(&out, argv[i], strlen(argv[i]));
+        } else if (put_escaped(&out, argv[i], true, false) == NULL) {
+            newline = false;
+            break;
+        }
+        if (i < argc - 1) {
+            out_putc(&out, ' ');
+        }
+    }
+    if (newline) {
+        out_putc(&out, '\n');
+    }
+    return out_close(&out, argv[0]);
+}
+
+/*
+ * Reports an argument of printf that was not entirely converted to a
+ * number by strtoimax and friends.
+ *
+ * @param name the name of the builtin.
+ * @param arg the argument.
+ * @param end the end of the number in arg.
+ * @param status set to 1 if the argument is not a valid number.
+ */
+static void check_number(const char *name, const char *arg, const char *end,
+                         int *status) {
+    if (end == arg) {
+        fprintf(stderr, "%s: '%s': expected a numeric value\n", name, arg);
+        *status = 1;
+    } else if (*end != '\0') {
+        fprintf(stderr, "%s: '%s': value not completely converted\n",
+                name, arg);
+        *status = 1;
+    } else if (errno == ERANGE) {
+        fprintf(stderr, "%s: '%s': %s\n", name, arg, strerror(ERANGE));
+        *status = 1;
+    }
+}
+
+/*
+ * Convert the arguments of printf directives; a missing argument is 0, and
+ * 'c or "c stands for the code of the character c.
+ */
+
+static intmax_t arg_to_int(const char *name, const char *arg, int *status) {
+    char *end;
+    intmax_t value;
+
+    if (arg == NULL) {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char) arg[1];
+    }
+    errno = 0;
+    value = strtoimax(arg, &end, 0);
+    check_number(name, arg, end, status);
+    return value;
+}
+
+static uintmax_t arg_to_uint(const char *name, const char *arg, int *status) {
+    char *end;
+    uintmax_t value;
+
+    if (arg == NULL) {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char) arg[1];
+    }
+    errno = 0;
+    value = strtoumax(arg, &end, 0);
+    check_number(name, arg, end, status);
+    return value;
+}
+
+static long double arg_to_float(const char *name, const char *arg,
+                                int *status) {
+    char *end;
+    long double value;
+
+    if (arg == NULL) {
+        return 0;
+    }
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char) arg[1];
+    }
+    errno = 0;
+    value = strtold(arg, &end);
+    check_number(name, arg, end, status);
+    return value;
+}
+
+/*
+ * Prints the format of printf once, taking the arguments its directives
+ * consume.
+ *
+ * @param out the output.
+ * @param name the name of the builtin, for error messages.
+ * @param fmt the format.
+ * @param args the next argument, advanced past the arguments consumed.
+ * @param status set to 1 if a directive or an argument is not valid.
+ * @return false if printf should stop, because of \c or an error.
+ */
+static bool print_format(struct out_buf *out, const char *name,
+                         const char *fmt, char ***args, int *status) {
+    char spec[32], *arg, conv;
+    const char *dir;
+    size_t nflags;
+    int width, prec;
+
+    while (*fmt != '\0') {
+        if ((fmt = put_escaped(out, fmt, false, true)) == NULL) {
+            return false;
+        }
+        if (*fmt == '\0') {
+            break;
+        }
+        if (fmt[1] == '%') {
+            out_putc(out, '%');
+            fmt += 2;
+            continue;
+        }
+
+        // Flags, then a width and a precision, either of which may be *
+        dir = fmt++;
+        nflags = strspn(fmt, "-+ #0'");
+        fmt += nflags;
+        nflags = nflags < 8 ? nflags : 8;
+        spec[0] = '%';
+        memcpy(spec + 1, fmt - nflags, nflags);
+        if (*fmt == '*') {
+            width = (int) arg_to_int(name, **args, status);
+            *args += **args != NULL;
+            fmt++;
+        } else {
+            width = (int) strtol(fmt, (char **) &fmt, 10);
+        }
+        prec = -1;
+        if (*fmt == '.') {
+            fmt++;
+            if (*fmt == '*') {
+                prec = (int) arg_to_int(name, **args, status);
+                *args += **args != NULL;
+                fmt++;
+            } else {
+                prec = (int) strtol(fmt, (char **) &fmt, 10);
+            }
+        }
+        fmt += strspn(fmt, "hlLqjzt");
+
+        conv = *fmt++;
+        if (conv == 'b' && fmt - dir > 2) {
+            conv = '?';     // %b takes no flags, width or precision
+        }
+        arg = **args;
+        if (conv != '\0' && strchr("diouxXcsbeEfFgGaA", conv) != NULL) {
+            *args += arg != NULL;
+        }
+        switch (conv) {
+            case 'd':
+            case 'i':
+                sprintf(spec + 1 + nflags, "*.*j%c", conv);
+                out_printf(out, spec, width, prec, arg_to_int(name, arg, status));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                sprintf(spec + 1 + nflags, "*.*j%c", conv);
+                out_printf(out, spec, width, prec,
+                           arg_to_uint(name, arg, status));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                sprintf(spec + 1 + nflags, "*.*L%c", conv);
+                out_printf(out, spec, width, prec,
+                           arg_to_float(name, arg, status));
+                break;
+            case 'c':
+                sprintf(spec + 1 + nflags, "*c");
+                out_printf(out, spec, width, arg != NULL ? arg[0] : '\0');
+                break;
+            case 's':
+                sprintf(spec + 1 + nflags, "*.*s");
+                out_printf(out, spec, width, prec, arg != NULL ? arg : "");
+                break;
+            case 'b':
+                if (arg != NULL && put_escaped(out, arg, true, false) == NULL) {
+                    return false;
+                }
+                break;
+            default:
+                fprintf(stderr, "%s: %.*s: invalid conversion specification\n",
+                        name, (int) (fmt - dir), dir);
+                *status = 1;
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Prints its arguments under the control of a format.
+ *
+ * printf format [arg...]   the format is reused while arguments are left.
+ *                          Supports the escapes and the d, i, o, u, x, X,
+ *                          c, s, b, e, E, f, F, g, G, a, A and % directives
+ *                          with flags, width and precision, including *.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument was not a valid number or the output could not
+ *         be written, 0 otherwise.
+ */
+int fast_printf(int argc, char **argv) {
+    char buf[OUTBUFSIZE];
+    struct out_buf out;
+    char **args, **start;
+    bool done = false;
+    int status = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "%s: missing operand\n", argv[0]);
+        fprintf(stderr, "Try '%s --help' for more information.\n", argv[0]);
+        return 1;
+    }
+
+    out_init(&out, buf, STDOUT_FILENO);
+    args = argv + 2;
+    do {
+        start = args;
+        done = !print_format(&out, argv[0], argv[1], &args, &status);
+    } while (!done && *args != NULL && args != start);
+
+    status |= out_close(&out, argv[0]);
+    if (!done && *args != NULL) {
+        fprintf(stderr, "%s: warning: ignoring excess arguments, "
+                        "starting with '%s'\n", argv[0], *args);
+    }
+    return status;
+}
+
+/*
+ * Does nothing, successfully.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0.
+ */
+int fast_true(int argc, char **argv) {
+    return 0;
+}
+
+/*
+ * Does nothing, unsuccessfully.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1.
+ */
+int fast_false(int argc, char **argv) {
+    return 1;
+}
+
+/*
+ * The state of test while it parses an expression. A syntax error is
+ * reported once, and makes test return 2.
+ */
+struct test_state
+{
+    const char *name;       // The name of the builtin
+    char **argv;            // The operands of the expression
+    int argc;               // Number of operands
+    int pos;                // The next operand
+    bool error;             // If true, a syntax error was reported
+};
+
+static void test_error(struct test_state *ts, const char *fmt,
+                       const char *arg) {
+    if (!ts->error) {
+        fprintf(stderr, "%s: ", ts->name);
+        fprintf(stderr, fmt, arg);
+        fprintf(stderr, "\n");
+        ts->error = true;
+    }
+}
+
+static bool is_unary_op(const char *op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+           strchr("bcdefghknprsStuwxzL", op[1]) != NULL;
+}
+
+static bool is_binary_op(const char *op) {
+    static const char *ops[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le",
+                                "-gt", "-ge"};
+    size_t i;
+
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(op, ops[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Converts an operand of an integer comparison, which may have blanks
+ * around it.
+ */
+static long long test_int(struct test_state *ts, const char *arg) {
+    char *end;
+    long long value;
+
+    errno = 0;
+    value = strtoll(arg, &end, 10);
+    while (isspace((unsigned char) *end)) {
+        end++;
+    }
+    if (end == arg || *end != '\0' || errno == ERANGE) {
+        test_error(ts, "invalid integer '%s'", arg);
+        return 0;
+    }
+    return value;
+}
+
+static bool test_unary(struct test_state *ts, char op, const char *arg) {
+    struct stat sb;
+    long long fd;
+
+    switch (op) {
+        case 'n':
+            return arg[0] != '\0';
+        case 'z':
+            return arg[0] == '\0';
+        case 't':
+            fd = test_int(ts, arg);
+            return fd >= 0 && fd <= INT_MAX && isatty((int) fd);
+        case 'r':
+            return access(arg, R_OK) == 0;
+        case 'w':
+            return access(arg, W_OK) == 0;
+        case 'x':
+            return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L':
+            return lstat(arg, &sb) == 0 && S_ISLNK(sb.st_mode);
+        default:
+            break;
+    }
+
+    if (stat(arg, &sb) < 0) {
+        return false;
+    }
+    switch (op) {
+        case 'b': return S_ISBLK(sb.st_mode);
+        case 'c': return S_ISCHR(sb.st_mode);
+        case 'd': return S_ISDIR(sb.st_mode);
+        case 'f': return S_ISREG(sb.st_mode);
+        case 'p': return S_ISFIFO(sb.st_mode);
+        case 'S': return S_ISSOCK(sb.st_mode);
+        case 's': return sb.st_size > 0;
+        case 'g': return (sb.st_mode & S_ISGID) != 0;
+        case 'u': return (sb.st_mode & S_ISUID) != 0;
+        case 'k': return (sb.st_mode & S_ISVTX) != 0;
+        default:  return true;      // -e
+    }
+}
+
+static bool test_binary(struct test_state *ts, const char *left,
+                        const char *op, const char *right) {
+    long long l, r;
+
+    if (op[0] != '-') {
+        return (strcmp(left, right) == 0) == (op[0] != '!');
+    }
+    l = test_int(ts, left);
+    r = test_int(ts, right);
+    switch (op[1] + op[2]) {
+        case 'e' + 'q': return l == r;
+        case 'n' + 'e': return l != r;
+        case 'l' + 't': return l < r;
+        case 'l' + 'e': return l <= r;
+        case 'g' + 't': return l > r;
+        default:        return l >= r;
+    }
+}
+
+static bool test_or(struct test_state *ts);
+
+/*
+ * Evaluates a primary: a parenthesized expression, a negation, a unary or
+ * binary test, or a lone string.
+ */
+static bool test_primary(struct test_state *ts) {
+    char **argv = ts->argv + ts->pos;
+    int left = ts->argc - ts->pos;
+    bool value;
+
+    if (left <= 0) {
+        test_error(ts, "argument expected%s", "");
+        return false;
+    }
+    if (left >= 3 && is_binary_op(argv[1])) {
+        ts->pos += 3;
+        return test_binary(ts, argv[0], argv[1], argv[2]);
+    }
+    if (strcmp(argv[0], "!") == 0) {
+        ts->pos++;
+        return !test_primary(ts);
+    }
+    if (strcmp(argv[0], "(") == 0 && left >= 2) {
+        ts->pos++;
+        value = test_or(ts);
+        if (ts->pos >= ts->argc || strcmp(ts->argv[ts->pos], ")") != 0) {
+            test_error(ts, "missing ')'%s", "");
+            return false;
+        }
+        ts->pos++;
+        return value;
+    }
+    if (is_unary_op(argv[0]) && left >= 2) {
+        ts->pos += 2;
+        return test_unary(ts, argv[0][1], argv[1]);
+    }
+    ts->pos++;
+    return argv[0][0] != '\0';
+}
+
+static bool test_and(struct test_state *ts) {
+    bool value = test_primary(ts);
+
+    while (ts->pos < ts->argc && strcmp(ts->argv[ts->pos], "-a") == 0) {
+        ts->pos++;
+        value = test_primary(ts) && value;
+    }
+    return value;
+}
+
+static bool test_or(struct test_state *ts) {
+    bool value = test_and(ts);
+
+    while (ts->pos < ts->argc && strcmp(ts->argv[ts->pos], "-o") == 0) {
+        ts->pos++;
+        value = test_and(ts) || value;
+    }
+    return value;
+}
+
+/*
+ * Evaluates a conditional expression, as test or [ ... ].
+ *
+ * Supports the file tests -b -c -d -e -f -g -h -L -k -p -r -s -S -t -u
+ * -w -x, the string tests -n -z = != and a lone string, the integer
+ * comparisons -eq -ne -lt -le -gt -ge, and !, -a, -o and parentheses.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments, ending with ] if argv[0] is [.
+ * @return 0 if the expression is true, 1 if false, 2 on a syntax error.
+ */
+int fast_test(int argc, char **argv) {
+    struct test_state ts;
+    const char *base = strrchr(argv[0], '/');
+    bool value;
+
+    ts.name = argv[0];
+    ts.argv = argv + 1;
+    ts.argc = argc - 1;
+    ts.pos = 0;
+    ts.error = false;
+
+    if (strcmp(base != NULL ? base + 1 : argv[0], "[") == 0) {
+        if (ts.argc == 0 || strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "%s: missing ']'\n", argv[0]);
+            return 2;
+        }
+        ts.argc--;
+    }
+    if (ts.argc == 0) {
+        return 1;
+    }
+
+    // With up to two operands, the first never acts as an operator
+    if (ts.argc == 1) {
+        value = ts.argv[0][0] != '\0';
+    } else if (ts.argc == 2 && strcmp(ts.argv[0], "!") == 0) {
+        value = ts.argv[1][0] == '\0';
+    } else if (ts.argc == 2 && !is_unary_op(ts.argv[0])) {
+        test_error(&ts, "missing argument after '%s'", ts.argv[1]);
+        value = false;
+    } else {
+        value = test_or(&ts);
+        if (ts.pos < ts.argc) {
+            test_error(&ts, "extra argument '%s'", ts.argv[ts.pos]);
+        }
+    }
+    return ts.error ? 2 : !value;
+}
+
+/*
+ * Copies files, or standard input for - or no files, to standard output.
+ *
+ * cat [-u] [file...]   -u is accepted and ignored, as output is unbuffered.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a file could not be read or written, 0 otherwise.
+ */
+int fast_cat(int argc, char **argv) {
+    static char buf[CATBUFSIZE];
+    char *stdin_args[] = {"-", NULL};
+    char **files = argv + 1;
+    int fd, status = 0;
+    ssize_t n;
+
+    fflush(stdout);
+    for (; *files != NULL && (*files)[0] == '-' && (*files)[1] != '\0';
+           files++) {
+        if (strcmp(*files, "--") == 0) {
+            files++;
+            break;
+        }
+        if (strspn(*files + 1, "u") != strlen(*files + 1)) {
+            fprintf(stderr, "%s: invalid option -- '%c'\n", argv[0],
+                    (*files)[1 + strspn(*files + 1, "u")]);
+            return 1;
+        }
+    }
+    if (*files == NULL) {
+        files = stdin_args;
+    }
+
+    for (; *files != NULL; files++) {
+        if (strcmp(*files, "-") == 0) {
+            fd = STDIN_FILENO;
+        } else if ((fd = open(*files, O_RDONLY | O_CLOEXEC)) < 0) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], *files, strerror(errno));
+            status = 1;
+            continue;
+        }
+        while ((n = read(fd, buf, sizeof(buf))) != 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                fprintf(stderr, "%s: %s: %s\n", argv[0], *files,
+                        strerror(errno));
+                status = 1;
+                break;
+            }
+            if (rio_writen(STDOUT_FILENO, buf, n) < 0) {
+                fprintf(stderr, "%s: standard output: %s\n", argv[0],
+                        strerror(errno));
+                if (fd != STDIN_FILENO) {
+                    close(fd);
+                }
+                return 1;
+            }
+        }
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    return status;
+}
@@ -0,0 +1,95 @@
+//
+// fastbuiltins.h - Builtins that run in place of common small programs
+//
+
+#ifndef TINY_LINUX_SHELL_FASTBUILTINS_H
+#define TINY_LINUX_SHELL_FASTBUILTINS_H
+
+#include "tsh_helper.h"
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <limits.h>
+
+#define OUTBUFSIZE  4096    // Output buffered by a fast builtin before write
+
+/*
+ * The fast builtins run the small commands scripts call most, in the shell
+ * process and without fork or exec, with the output of the coreutils
+ * programs of the same names. They read and write the shell's descriptors
+ * 0 and 1 directly, so redirections saved and restored around them by
+ * eval apply to them as to any builtin. In builtins.def they also stand in
+ * for /bin/name and /usr/bin/name; enable -n name runs the program instead.
+ */
+
+/*
+ * Prints its arguments separated by spaces and followed by a newline.
+ *
+ * echo [-neE] [arg...]   -n omits the newline, -e interprets backslash
+ *                        escapes and -E (the default) does not.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if the output could not be written, 0 otherwise.
+ */
+int fast_echo(int argc, char **argv);
+
+/*
+ * Prints its arguments under the control of a format.
+ *
+ * printf format [arg...]   the format is reused while arguments are left.
+ *                          Supports the escapes and the d, i, o, u, x, X,
+ *                          c, s, b, e, E, f, F, g, G, a, A and % directives
+ *                          with flags, width and precision, including *.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if an argument was not a valid number or the output could not
+ *         be written, 0 otherwise.
+ */
+int fast_printf(int argc, char **argv);
+
+/*
+ * Does nothing, successfully.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 0.
+ */
+int fast_true(int argc, char **argv);
+
+/*
+ * Does nothing, unsuccessfully.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1.
+ */
+int fast_false(int argc, char **argv);
+
+/*
+ * Evaluates a conditional expression, as test or [ ... ].
+ *
+ * Supports the file tests -b -c -d -e -f -g -h -L -k -p -r -s -S -t -u
+ * -w -x, the string tests -n -z = != and a lone string, the integer
+ * comparisons -eq -ne -lt -le -gt -ge, and !, -a, -o and parentheses.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments, ending with ] if argv[0] is [.
+ * @return 0 if the expression is true, 1 if false, 2 on a syntax error.
+ */
+int fast_test(int argc, char **argv);
+
+/*
+ * Copies files, or standard input for - or no files, to standard output.
+ *
+ * cat [-u] [file...]   -u is accepted and ignored, as output is unbuffered.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return 1 if a file could not be read or written, 0 otherwise.
+ */
+int fast_cat(int argc, char **argv);
+
+#endif //TINY_LINUX_SHELL_FASTBUILTINS_H
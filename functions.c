@@ -0,0 +1,341 @@
+//
+// functions.c - Shell functions and aliases
+//
+
+#include "functions.h"
+
+struct definition                   // A function or an alias
+{
+    struct builtin_info info;       // Name and flags, NULL name if removed
+    def_kind kind;                  // What it is
+    unsigned hash;                  // Hash of the name
+    char *source;                   // The body or value, as typed
+    struct ast_node *body;          // The body, parsed into defs_arena
+    int next;                       // 1 + index of the next in its bucket
+};
+
+/* Global variables */
+static struct definition *defs = NULL;  // Indexed by state - DEFS_BASE
+static int ndefs = 0;                   // Entries used in defs
+static int capacity = 0;                // Entries allocated in defs
+static int nlive = 0;                   // Definitions not removed
+static int buckets[DEFS_BUCKETS];       // 1 + index of the first, or 0
+static struct arena defs_arena;         // Holds the bodies
+static struct arena *retired = NULL;    // Arenas of bodies that may run
+static int nretired = 0;                // Entries used in retired
+static int retired_size = 0;            // Entries allocated in retired
+static int depth = 0;                   // Definitions running
+static const struct definition *compiling = NULL;  // Being parsed
+
+/*
+ * Hashes a name, FNV-1a.
+ */
+static unsigned hash_name(const char *name) {
+    unsigned h = 2166136261u;
+    while (*name != '\0') {
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Finds a definition.
+ *
+ * @param name the name.
+ * @param h the hash of the name.
+ * @param kind what it is.
+ * @return the index of the definition, or -1.
+ */
+static int find_def(const char *name, unsigned h, def_kind kind) {
+    int i;
+
+    for (i = buckets[h % DEFS_BUCKETS] - 1; i >= 0; i = defs[i].next - 1) {
+        if (defs[i].hash == h && defs[i].kind == kind &&
+            strcmp(defs[i].info.name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Parses every body again into a fresh arena, so each refers to the
+ * builtins and definitions as they are now, and forgets the parsed command
+ * lines, which may too. The old arena is freed once no definition runs.
+ *
+ * @return void
+ */
+void def_recompile(void) {
+    struct arena old = defs_arena;
+    int i;
+
+    ast_generation++;
+    parsecache_invalidate();
+    memset(&defs_arena, 0, sizeof(struct arena));
+    for (i = 0; i < ndefs; i++) {
+        if (defs[i].info.name != NULL) {
+            compiling = &defs[i];
+            if (ast_parse_into(&defs_arena, defs[i].source,
+                               &defs[i].body) != AST_OK) {
+                defs[i].body = NULL;
+            }
+        }
+    }
+    compiling = NULL;
+
+    if (depth == 0) {
+        arena_free(&old);
+        return;
+    }
+    if (nretired == retired_size) {
+        retired_size = retired_size ? 2 * retired_size : 4;
+        retired = Realloc(retired, retired_size * sizeof(struct arena));
+    }
+    retired[nretired++] = old;
+}
+
+/*
+ * Checks that a body parses, printing an error if it does not.
+ */
+static bool valid_source(const char *name, const char *source) {
+    struct arena_mark mark = arena_save(&command_arena);
+    struct ast_node *body;
+    ast_result result;
+
+    result = ast_parse(source, &body);
+    arena_release(&command_arena, mark);
+    if (result == AST_INCOMPLETE) {
+        printf("%s: syntax error: unexpected end of definition\n", name);
+    }
+    return result == AST_OK;
+}
+
+/*
+ * Adds or replaces a definition, then parses the bodies again.
+ */
+static bool define(const char *name, const char *source, def_kind kind) {
+    unsigned h = hash_name(name);
+    int i;
+
+    if (!valid_source(name, source)) {
+        return false;
+    }
+
+    if ((i = find_def(name, h, kind)) >= 0) {
+        Free(defs[i].source);
+    } else {
+        for (i = 0; i < ndefs && defs[i].info.name != NULL; i++);
+        if (i == ndefs) {
+            if (ndefs == capacity) {
+                capacity = capacity ? 2 * capacity : 16;
+                defs = Realloc(defs, capacity * sizeof(struct definition));
+            }
+            ndefs++;
+        }
+        defs[i].info.name = strcpy(Malloc(strlen(name) + 1), name);
+        defs[i].info.flags = BUILTIN_RUNS_FG | BUILTIN_REDIRECTABLE |
+                             BUILTIN_RUNS_BG;
+        defs[i].kind = kind;
+        defs[i].hash = h;
+        defs[i].next = buckets[h % DEFS_BUCKETS];
+        buckets[h % DEFS_BUCKETS] = i + 1;
+        nlive++;
+    }
+    defs[i].source = strcpy(Malloc(strlen(source) + 1), source);
+    def_recompile();
+    return true;
+}
+
+/*
+ * Defines a function, replacing one of the same name.
+ *
+ * @param name the name of the function.
+ * @param source the body of the function, a compound command as typed.
+ * @return true if it was defined, false after printing an error.
+ */
+bool function_define(const char *name, const char *source) {
+    return define(name, source, DEF_FUNCTION);
+}
+
+/*
+ * Defines an alias, replacing one of the same name. The value is parsed
+ * as a script, with an alias of the same name in it left unexpanded.
+ *
+ * @param name the name of the alias.
+ * @param value the value of the alias.
+ * @return true if it was defined, false after printing an error.
+ */
+bool alias_define(const char *name, const char *value) {
+    return define(name, value, DEF_ALIAS);
+}
+
+/*
+ * Unlinks a definition from its bucket and frees it, without parsing the
+ * bodies again.
+ */
+static void unlink_def(int i) {
+    int *link = &buckets[defs[i].hash % DEFS_BUCKETS];
+
+    while (*link != i + 1) {
+        link = &defs[*link - 1].next;
+    }
+    *link = defs[i].next;
+    Free((char *) defs[i].info.name);
+    Free(defs[i].source);
+    defs[i].info.name = NULL;
+    nlive--;
+}
+
+/*
+ * Removes a definition.
+ *
+ * @param name the name.
+ * @param kind what it is.
+ * @return true if it was defined, false otherwise.
+ */
+bool def_remove(const char *name, def_kind kind) {
+    int i = find_def(name, hash_name(name), kind);
+
+    if (i < 0) {
+        return false;
+    }
+    unlink_def(i);
+    def_recompile();
+    return true;
+}
+
+/*
+ * Removes every definition of a kind.
+ *
+ * @param kind what to remove.
+ * @return void
+ */
+void def_remove_all(def_kind kind) {
+    int i;
+
+    for (i = 0; i < ndefs; i++) {
+        if (defs[i].info.name != NULL && defs[i].kind == kind) {
+            unlink_def(i);
+        }
+    }
+    def_recompile();
+}
+
+/*
+ * Finds the builtin state of the alias, or else the function, a command
+ * name stands for.
+ *
+ * @param name the command name.
+ * @return the builtin state, or BUILTIN_NONE.
+ */
+builtin_state def_lookup(const char *name) {
+    unsigned h;
+    int i;
+
+    if (nlive == 0) {
+        return BUILTIN_NONE;
+    }
+    h = hash_name(name);
+    if ((i = find_def(name, h, DEF_ALIAS)) >= 0 && &defs[i] != compiling) {
+        return (builtin_state) (DEFS_BASE + i);
+    }
+    if ((i = find_def(name, h, DEF_FUNCTION)) >= 0) {
+        return (builtin_state) (DEFS_BASE + i);
+    }
+    return BUILTIN_NONE;
+}
+
+/*
+ * Returns the registry entry of a definition.
+ *
+ * @param builtin a builtin state from def_lookup.
+ * @return the entry.
+ */
+const struct builtin_info *def_info(builtin_state builtin) {
+    return &defs[builtin - DEFS_BASE].info;
+}
+
+/*
+ * Starts running a definition: returns its body and marks it as running,
+ * so the body is not freed while it runs.
+ *
+ * @param builtin a builtin state from def_lookup.
+ * @param kind receives what it is.
+ * @return the body, which may be NULL, or NULL with kind set to -1 after
+ *         printing an error if DEFS_MAX_DEPTH definitions already run.
+ */
+struct ast_node *def_enter(builtin_state builtin, int *kind) {
+    struct definition *def = &defs[builtin - DEFS_BASE];
+
+    if (depth == DEFS_MAX_DEPTH) {
+        printf("%s: maximum nesting depth exceeded\n", def->info.name);
+        *kind = -1;
+        return NULL;
+    }
+    depth++;
+    *kind = def->kind;
+    return def->body;
+}
+
+/*
+ * Ends running a definition that def_enter started.
+ *
+ * @return void
+ */
+void def_leave(void) {
+    if (--depth > 0) {
+        return;
+    }
+    while (nretired > 0) {
+        arena_free(&retired[--nretired]);
+    }
+}
+
+/*
+ * Checks whether a definition is running.
+ *
+ * @return true if a function or alias is running.
+ */
+bool def_running(void) {
+    return depth > 0;
+}
+
+/*
+ * Orders definitions by name.
+ */
+static int compare_defs(const void *a, const void *b) {
+    return strcmp((*(struct definition * const *) a)->info.name,
+                  (*(struct definition * const *) b)->info.name);
+}
+
+/*
+ * Prints an alias as alias name='value', or all of them, sorted by name.
+ *
+ * @param name the alias, or NULL for all.
+ * @return true if the alias exists, or if name is NULL.
+ */
+bool alias_print(const char *name) {
+    struct definition **sorted;
+    int i, n = 0;
+
+    if (name != NULL) {
+        if ((i = find_def(name, hash_name(name), DEF_ALIAS)) < 0) {
+            return false;
+        }
+        printf("alias %s='%s'\n", name, defs[i].source);
+        return true;
+    }
+
+    sorted = arena_alloc(&command_arena,
+                         (nlive + 1) * sizeof(struct definition *));
+    for (i = 0; i < ndefs; i++) {
+        if (defs[i].info.name != NULL && defs[i].kind == DEF_ALIAS) {
+            sorted[n++] = &defs[i];
+        }
+    }
+    qsort(sorted, n, sizeof(struct definition *), compare_defs);
+    for (i = 0; i < n; i++) {
+        printf("alias %s='%s'\n", sorted[i]->info.name, sorted[i]->source);
+    }
+    return true;
+}
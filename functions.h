@@ -0,0 +1,147 @@
+//
+// functions.h - Shell functions and aliases
+//
+
+#ifndef TINY_LINUX_SHELL_FUNCTIONS_H
+#define TINY_LINUX_SHELL_FUNCTIONS_H
+
+#include "tsh_helper.h"
+#include "ast.h"
+#include "parsecache.h"
+
+#define DEFS_BASE       (NBUILTINS + 65536) // Builtin state of definition 0,
+                                            // above those of enable -f
+#define DEFS_BUCKETS    64      // Hash buckets of the definitions
+#define DEFS_MAX_DEPTH  1000    // Functions and aliases running at once
+
+/*
+ * Shell functions, name() { list; }, and aliases, alias name=value, are
+ * definitions kept in a hash table keyed by name. Each keeps the text it
+ * was defined with and its body parsed by ast_parse, in an arena of the
+ * definitions, so running one costs no parsing.
+ *
+ * A definition is a builtin to the parser: lookup_builtin finds aliases
+ * first and then functions, and run_builtin runs their bodies in the
+ * shell. Since a body refers to the commands it names as parsed, all the
+ * bodies are parsed again, into a fresh arena, whenever a definition is
+ * added or removed or a builtin is turned on, off, loaded or unloaded, and
+ * ast_generation changes.
+ */
+
+// The two kinds of definitions, which have separate names
+typedef enum def_kind
+{
+    DEF_FUNCTION,               // name() { list; }
+    DEF_ALIAS                   // alias name=value
+} def_kind;
+
+/*
+ * Defines a function, replacing one of the same name.
+ *
+ * @param name the name of the function.
+ * @param source the body of the function, a compound command as typed.
+ * @return true if it was defined, false after printing an error.
+ */
+bool function_define(const char *name, const char *source);
+
+/*
+ * Defines an alias, replacing one of the same name. The value is parsed
+ * as a script, with an alias of the same name in it left unexpanded.
+ *
+ * @param name the name of the alias.
+ * @param value the value of the alias.
+ * @return true if it was defined, false after printing an error.
+ */
+bool alias_define(const char *name, const char *value);
+
+/*
+ * Removes a definition.
+ *
+ * @param name the name.
+ * @param kind what it is.
+ * @return true if it was defined, false otherwise.
+ */
+bool def_remove(const char *name, def_kind kind);
+
+/*
+ * Removes every definition of a kind.
+ *
+ * @param kind what to remove.
+ * @return void
+ */
+void def_remove_all(def_kind kind);
+
+/*
+ * Parses every body again into a fresh arena, so each refers to the
+ * builtins and definitions as they are now, and forgets the parsed command
+ * lines, which may too. Called whenever what a command name stands for
+ * changes, such as by enable. The old arena is freed once no definition
+ * runs.
+ *
+ * @return void
+ */
+void def_recompile(void);
+
+/*
+ * Finds the builtin state of the alias, or else the function, a command
+ * name stands for.
+ *
+ * @param name the command name.
+ * @return the builtin state, or BUILTIN_NONE.
+ */
+builtin_state def_lookup(const char *name);
+
+/*
+ * Returns the registry entry of a definition.
+ *
+ * @param builtin a builtin state from def_lookup.
+ * @return the entry.
+ */
+const struct builtin_info *def_info(builtin_state builtin);
+
+/*
+ * Starts running a definition: returns its body and marks it as running,
+ * so the body is not freed while it runs.
+ *
+ * @param builtin a builtin state from def_lookup.
+ * @param kind receives what it is.
+ * @return the body, which may be NULL, or NULL with kind set to -1 after
+ *         printing an error if DEFS_MAX_DEPTH definitions already run.
+ */
+struct ast_node *def_enter(builtin_state builtin, int *kind);
+
+/*
+ * Ends running a definition that def_enter started.
+ *
+ * @return void
+ */
+void def_leave(void);
+
+/*
+ * Checks whether a definition is running.
+ *
+ * @return true if a function or alias is running.
+ */
+bool def_running(void);
+
+/*
+ * Prints an alias as alias name='value', or all of them, sorted by name.
+ *
+ * @param name the alias, or NULL for all.
+ * @return true if the alias exists, or if name is NULL.
+ */
+bool alias_print(const char *name);
+
+/*
+ * Runs the body of a function or alias in the shell, with the arguments
+ * as $1 to $9 for a function, and added to the last command of its body
+ * for an alias. Defined in tsh.c, which runs scripts.
+ *
+ * @param builtin a builtin state from def_lookup.
+ * @param argc the number of arguments.
+ * @param argv the arguments, argv[0] naming the definition.
+ * @return the status of the body.
+ */
+int def_run(builtin_state builtin, int argc, char **argv);
+
+#endif //TINY_LINUX_SHELL_FUNCTIONS_H
@@ -0,0 +1,314 @@
+//
+// heredoc.c - Here-documents and here-strings on sealed memfds
+//
+
+#include "heredoc.h"
+
+struct text                     // A string growing in command_arena
+{
+    char *buf;                  // The string, NUL terminated
+    size_t len;                 // Bytes used, without the NUL
+    size_t size;                // Bytes allocated
+};
+
+struct here_doc                 // A << of a line whose body is not read yet
+{
+    const char *op;             // The <<
+    const char *end;            // The byte after its delimiter
+    char *delim;                // The delimiter, without its quotes
+    bool quoted;                // The delimiter was quoted
+    bool strip_tabs;            // <<-, leading tabs are removed
+    struct text body;           // The body, encoded
+};
+
+/* Global variables */
+static const char hex_digits[] = "0123456789ABCDEF";
+static char *waiting_delim = NULL;      // Ends the body gathering stopped in
+static bool waiting_strip_tabs = false; // That body is of a <<-
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/*
+ * Makes room for n more bytes and a NUL in a growing string.
+ */
+static void text_reserve(struct text *text, size_t n) {
+    if (text->len + n >= text->size) {
+        text->buf = arena_grow(&command_arena, text->buf, text->size,
+                               2 * (text->len + n) + 1);
+        text->size = 2 * (text->len + n) + 1;
+    }
+}
+
+/*
+ * Appends bytes to a growing string.
+ */
+static void text_append(struct text *text, const char *bytes, size_t n) {
+    text_reserve(text, n);
+    memcpy(text->buf + text->len, bytes, n);
+    text->len += n;
+    text->buf[text->len] = '\0';
+}
+
+/*
+ * Appends bytes to a growing string, with those that are not printable or
+ * are in HEREDOC_SPECIAL written as %XX, so they form one plain word.
+ */
+static void text_encode(struct text *text, const char *bytes, size_t n) {
+    unsigned char c;
+    size_t i;
+
+    text_reserve(text, 3 * n);
+    for (i = 0; i < n; i++) {
+        c = bytes[i];
+        if (isgraph(c) && strchr(HEREDOC_SPECIAL, c) == NULL) {
+            text->buf[text->len++] = c;
+        } else {
+            text->buf[text->len++] = '%';
+            text->buf[text->len++] = hex_digits[c >> 4];
+            text->buf[text->len++] = hex_digits[c & 0xf];
+        }
+    }
+    text->buf[text->len] = '\0';
+}
+
+/*
+ * Reads the operator and delimiter of a here-document at p, a << that does
+ * not start a <<<.
+ *
+ * @param p the <<.
+ * @param doc receives the here-document.
+ * @return true if a delimiter follows, false otherwise.
+ */
+static bool heredoc_at(const char *p, struct here_doc *doc) {
+    const char *quote;
+    size_t len;
+
+    doc->op = p;
+    p += 2;
+    if ((doc->strip_tabs = *p == '-')) {
+        p++;
+    }
+    p += strspn(p, " \t");
+    if (*p == '\'' || *p == '"') {
+        if ((quote = strchr(p + 1, *p)) == NULL) {
+            return false;
+        }
+        doc->delim = arena_strndup(&command_arena, p + 1, quote - p - 1);
+        doc->quoted = true;
+        doc->end = quote + 1;
+    } else {
+        if ((len = strcspn(p, " \t\r\n;&|<>()")) == 0) {
+            return false;
+        }
+        doc->delim = arena_strndup(&command_arena, p, len);
+        doc->quoted = false;
+        doc->end = p + len;
+    }
+    memset(&doc->body, 0, sizeof(struct text));
+    text_reserve(&doc->body, 0);
+    return true;
+}
+
+/*
+ * Reads the body of a here-document, up to the line that is its
+ * delimiter, encoding it.
+ *
+ * @param p the first line of the body.
+ * @param doc the here-document.
+ * @return the line after the delimiter, or NULL if the script ends first.
+ */
+static const char *read_body(const char *p, struct here_doc *doc) {
+    size_t len, delim_len = strlen(doc->delim);
+
+    while (true) {
+        if (doc->strip_tabs) {
+            p += strspn(p, "\t");
+        }
+        len = strcspn(p, "\n");
+        if (len == delim_len && strncmp(p, doc->delim, len) == 0) {
+            return p[len] == '\n' ? p + len + 1 : p + len;
+        }
+        if (p[len] == '\0') {
+            waiting_delim = strcpy(Malloc(delim_len + 1), doc->delim);
+            waiting_strip_tabs = doc->strip_tabs;
+            return NULL;
+        }
+        text_encode(&doc->body, p, len + 1);
+        p += len + 1;
+    }
+}
+
+/*
+ * Moves the bodies of the here-documents of a script into the words of
+ * their <<, and drops their lines.
+ *
+ * A << is found where parseline would take it as an operator, outside
+ * quotes that start a word, and a <<< is a here-string. The bodies of the
+ * here-documents of a line follow it in order.
+ *
+ * @param script the script; lines are separated by newlines.
+ * @return the script, itself if it has no here-documents and otherwise a
+ *         copy in command_arena, or NULL if a body is not complete yet,
+ *         so more lines are needed.
+ */
+const char *heredoc_gather(const char *script) {
+    struct text out = {NULL, 0, 0};
+    struct here_doc *docs = NULL;
+    const char *p, *copied, *quote, *next;
+    bool word_start = true;
+    int i, ndocs = 0, cap = 0;
+
+    if (waiting_delim != NULL) {
+        Free(waiting_delim);
+        waiting_delim = NULL;
+    }
+    if (strstr(script, "<<") == NULL) {
+        return script;
+    }
+
+    for (p = copied = script; *p != '\0'; p++) {
+        if (word_start && (*p == '\'' || *p == '"')) {
+            if ((quote = strchr(p + 1, *p)) == NULL) {
+                break;
+            }
+            p = quote;
+            word_start = false;
+            continue;
+        }
+        if (*p == '<' && p[1] == '<' && p[2] == '<') {
+            p += 2;
+            word_start = true;
+            continue;
+        }
+        if (*p == '<' && p[1] == '<') {
+            if (ndocs == cap) {
+                docs = arena_grow(&command_arena, docs,
+                                  cap * sizeof(struct here_doc),
+                                  (2 * cap + 1) * sizeof(struct here_doc));
+                cap = 2 * cap + 1;
+            }
+            if (heredoc_at(p, &docs[ndocs])) {
+                p = docs[ndocs++].end - 1;
+                word_start = false;
+                continue;
+            }
+        }
+
+        if (*p == '\n' && ndocs > 0) {
+            for (i = 0, next = p + 1; i < ndocs; i++) {
+                if ((next = read_body(next, &docs[i])) == NULL) {
+                    return NULL;
+                }
+            }
+
+            // The line, with each << word replaced by its body
+            for (i = 0; i < ndocs; i++) {
+                text_append(&out, copied, docs[i].op - copied);
+                text_append(&out, "<<", 2);
+                if (docs[i].quoted || docs[i].body.len == 0) {
+                    text_append(&out, "'", 1);
+                }
+                text_append(&out, docs[i].body.buf, docs[i].body.len);
+                if (docs[i].quoted || docs[i].body.len == 0) {
+                    text_append(&out, "'", 1);
+                }
+                copied = docs[i].end;
+            }
+            text_append(&out, copied, p - copied);
+            if (*next != '\0') {
+                text_append(&out, "\n", 1);
+            }
+            copied = next;
+            p = next - 1;
+            ndocs = 0;
+            word_start = true;
+            continue;
+        }
+        word_start = is_blank(*p) || strchr("|<>;&(", *p) != NULL;
+    }
+
+    if (ndocs > 0) {            // The line of a << is not finished
+        return NULL;
+    }
+    text_append(&out, copied, strlen(copied));
+    return out.buf;
+}
+
+/*
+ * Checks whether a line added to a script that heredoc_gather found
+ * incomplete leaves it incomplete, because it is in the body that
+ * gathering stopped in and is not the delimiter of that body.
+ *
+ * @param line the line.
+ * @return true if the script needs more lines still.
+ */
+bool heredoc_waiting(const char *line) {
+    if (waiting_delim == NULL) {
+        return false;
+    }
+    if (waiting_strip_tabs) {
+        line += strspn(line, "\t");
+    }
+    return strcmp(line, waiting_delim) != 0;
+}
+
+/*
+ * Returns the value of a hex digit.
+ */
+static int hex_value(char c) {
+    return isdigit((unsigned char) c) ? c - '0' : c - 'A' + 10;
+}
+
+/*
+ * Restores the body of a here-document from the word heredoc_gather made.
+ *
+ * @param word the word of the <<.
+ * @return the body, in command_arena.
+ */
+char *heredoc_decode(const char *word) {
+    char *body = arena_alloc(&command_arena, strlen(word) + 1), *q = body;
+
+    for (; *word != '\0'; word++) {
+        if (*word == '%' && isxdigit((unsigned char) word[1]) &&
+            isxdigit((unsigned char) word[2])) {
+            *q++ = (char) (hex_value(word[1]) << 4 | hex_value(word[2]));
+            word += 2;
+        } else {
+            *q++ = *word;
+        }
+    }
+    *q = '\0';
+    return body;
+}
+
+/*
+ * Creates a sealed memfd holding a here-document or here-string, open for
+ * reading from its start. The seals keep its contents fixed, whichever
+ * processes share it.
+ *
+ * @param text the body, or the word of a here-string.
+ * @param newline true to add a newline after the text, for a here-string.
+ * @return the descriptor, close-on-exec, or -1 with errno set.
+ */
+int heredoc_open(const char *text, bool newline) {
+    int fd, saved_errno;
+
+    fd = syscall(SYS_memfd_create, "tsh-heredoc",
+                 MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -1;
+    }
+    if (rio_writen(fd, (void *) text, strlen(text)) >= 0 &&
+        (!newline || rio_writen(fd, "\n", 1) >= 0) &&
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE |
+                               F_SEAL_SEAL) == 0 &&
+        lseek(fd, 0, SEEK_SET) == 0) {
+        return fd;
+    }
+    saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+}
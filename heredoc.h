@@ -0,0 +1,86 @@
+//
+// heredoc.h - Here-documents and here-strings on sealed memfds
+//
+
+#ifndef TINY_LINUX_SHELL_HEREDOC_H
+#define TINY_LINUX_SHELL_HEREDOC_H
+
+#include "csapp.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+
+/* GNU extensions, spelled out since csapp.h clashes with _GNU_SOURCE */
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS     1033
+#define F_SEAL_SEAL     0x0001
+#define F_SEAL_SHRINK   0x0002
+#define F_SEAL_GROW     0x0004
+#define F_SEAL_WRITE    0x0008
+#endif
+
+/* The bytes of a body that are written %XX in its << word */
+#define HEREDOC_SPECIAL "%;&|<>()'\"$`\\*?[]{}#=~"
+
+/*
+ * Here-documents, <<word, take their bodies from the lines after the
+ * command line, up to a line that is the word; <<-word also strips the
+ * leading tabs of those lines. Here-strings, <<<word, take the word and a
+ * newline. Either is written to a sealed memfd, which becomes the input of
+ * the command, so no file is created.
+ *
+ * Since the shell parses a line without the lines after it, heredoc_gather
+ * first moves each body into the word of its <<, with the bytes that would
+ * end or quote a word written as %XX. The word is single quoted if the
+ * delimiter was quoted either way, so the body is not expanded. Bodies then
+ * live in the parse cache, in scripts and in function bodies like any other
+ * word, and heredoc_decode restores them when the command runs, before
+ * expand_words expands them.
+ *
+ * The word of a here-string is expanded unless it is single quoted, like
+ * a double-quoted argument: "$x" gives the value of x, but is not split
+ * or globbed.
+ */
+
+/*
+ * Moves the bodies of the here-documents of a script into the words of
+ * their <<, and drops their lines.
+ *
+ * @param script the script; lines are separated by newlines.
+ * @return the script, itself if it has no here-documents and otherwise a
+ *         copy in command_arena, or NULL if a body is not complete yet,
+ *         so more lines are needed.
+ */
+const char *heredoc_gather(const char *script);
+
+/*
+ * Checks whether a line added to a script that heredoc_gather found
+ * incomplete leaves it incomplete, because it is in the body that
+ * gathering stopped in and is not the delimiter of that body. Such a line
+ * can be added without gathering the script again.
+ *
+ * @param line the line.
+ * @return true if the script needs more lines still.
+ */
+bool heredoc_waiting(const char *line);
+
+/*
+ * Restores the body of a here-document from the word heredoc_gather made.
+ *
+ * @param word the word of the <<.
+ * @return the body, in command_arena.
+ */
+char *heredoc_decode(const char *word);
+
+/*
+ * Creates a sealed memfd holding a here-document or here-string, open for
+ * reading from its start.
+ *
+ * @param text the body, or the word of a here-string.
+ * @param newline true to add a newline after the text, for a here-string.
+ * @return the descriptor, close-on-exec, or -1 with errno set.
+ */
+int heredoc_open(const char *text, bool newline);
+
+#endif //TINY_LINUX_SHELL_HEREDOC_H
@@ -0,0 +1,149 @@
+//
+// linereader.c - Buffered reader of command lines of any length
+//
+
+#include "linereader.h"
+
+/*
+ * Initializes a line reader for a descriptor.
+ *
+ * If the descriptor is a datagram socket, every read returns one whole
+ * datagram and drops whatever does not fit, so the reader keeps enough
+ * free space for the largest datagram the socket can queue.
+ *
+ * @param reader the reader to initialize.
+ * @param fd the descriptor to read command lines from.
+ * @return void
+ */
+void reader_init(struct line_reader *reader, int fd) {
+    int type, rcvbuf;
+    socklen_t optlen = sizeof(type);
+
+    reader->fd = fd;
+    reader->size = READER_BUFSIZE;
+    reader->buf = Malloc(reader->size);
+    reader->start = 0;
+    reader->end = 0;
+    reader->scan = 0;
+    reader->min_read = 1;
+    reader->eof = false;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &optlen) == 0 &&
+        (type == SOCK_DGRAM || type == SOCK_SEQPACKET)) {
+        optlen = sizeof(rcvbuf);
+        if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) < 0) {
+            rcvbuf = READER_BUFSIZE;
+        }
+        reader->min_read = rcvbuf;
+    }
+}
+
+/*
+ * Makes room for at least min_read more bytes after the buffered ones,
+ * moving the unread bytes to the front of the buffer first.
+ *
+ * @param reader the reader whose buffer is prepared.
+ * @return void
+ */
+static void make_room(struct line_reader *reader) {
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start,
+                reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    // One extra byte for the NUL of an unterminated last line
+    while (reader->size - reader->end < reader->min_read + 1) {
+        reader->size *= 2;
+        reader->buf = Realloc(reader->buf, reader->size);
+    }
+}
+
+/*
+ * Reads from the descriptor once, appending to the buffered bytes.
+ * Blocks only if nothing can be read yet.
+ *
+ * @param reader the reader to fill.
+ * @return the number of bytes read, 0 at end of file.
+ */
+ssize_t reader_fill(struct line_reader *reader) {
+    ssize_t n;
+
+    make_room(reader);
+    while ((n = read(reader->fd, reader->buf + reader->end,
+                     reader->size - reader->end - 1)) < 0) {
+        if (errno != EINTR) {
+            unix_error("read error");
+        }
+    }
+    if (n == 0) {
+        reader->eof = true;
+    }
+    reader->end += n;
+    return n;
+}
+
+/*
+ * Finds the next newline among the buffered bytes, resuming the search
+ * where the previous one stopped.
+ *
+ * @param reader the reader to search.
+ * @return the newline, or NULL if no whole line is buffered.
+ */
+static char *find_newline(struct line_reader *reader) {
+    char *base = reader->buf + reader->start;
+    char *nl = memchr(base + reader->scan, '\n',
+                      reader->end - reader->start - reader->scan);
+
+    reader->scan = nl ? (size_t) (nl - base) : reader->end - reader->start;
+    return nl;
+}
+
+/*
+ * Reads the next line, of any length, without its newline.
+ *
+ * The buffer is refilled with one read() per fill, as large as the free
+ * space allows, so pipes and files are read in big chunks. A last line
+ * that is not terminated by a newline is returned whole.
+ *
+ * @param reader the reader to read from.
+ * @param len if not NULL, receives the length of the line.
+ * @return the NUL terminated line, valid until the next call, or NULL at
+ *         end of file.
+ */
+char *reader_getline(struct line_reader *reader, size_t *len) {
+    char *line, *nl;
+
+    while ((nl = find_newline(reader)) == NULL) {
+        if (reader->eof || reader_fill(reader) == 0) {
+            if (reader->start == reader->end) {
+                return NULL;
+            }
+            nl = reader->buf + reader->end;     // Unterminated last line
+            break;
+        }
+    }
+
+    line = reader->buf + reader->start;
+    *nl = '\0';
+    if (len != NULL) {
+        *len = nl - line;
+    }
+    reader->start = (nl - reader->buf) + 1;
+    if (reader->start > reader->end) {
+        reader->start = reader->end;
+    }
+    reader->scan = 0;
+    return line;
+}
+
+/*
+ * Checks whether a whole line is buffered, so reader_getline can return
+ * without reading from the descriptor.
+ *
+ * @param reader the reader to check.
+ * @return true if a line is buffered or the end of file was reached.
+ */
+bool reader_has_line(struct line_reader *reader) {
+    return reader->eof || find_newline(reader) != NULL;
+}
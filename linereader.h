@@ -0,0 +1,69 @@
+//
+// linereader.h - Buffered reader of command lines of any length
+//
+
+#ifndef TINY_LINUX_SHELL_LINEREADER_H
+#define TINY_LINUX_SHELL_LINEREADER_H
+
+#include "tsh_helper.h"
+
+#define READER_BUFSIZE  65536   // Initial size of the line buffer
+
+struct line_reader              // A buffered reader of command lines
+{
+    int fd;                     // The descriptor read from
+    char *buf;                  // Buffered input, grows to fit any line
+    size_t size;                // Number of bytes allocated for buf
+    size_t start;               // Offset of the first unread byte
+    size_t end;                 // Offset past the last buffered byte
+    size_t scan;                // Bytes from start known to hold no newline
+    size_t min_read;            // Free space needed before each read
+    bool eof;                   // True once read returned 0
+};
+
+/*
+ * Initializes a line reader for a descriptor.
+ *
+ * If the descriptor is a datagram socket, every read returns one whole
+ * datagram and drops whatever does not fit, so the reader keeps enough
+ * free space for the largest datagram the socket can queue.
+ *
+ * @param reader the reader to initialize.
+ * @param fd the descriptor to read command lines from.
+ * @return void
+ */
+void reader_init(struct line_reader *reader, int fd);
+
+/*
+ * Reads from the descriptor once, appending to the buffered bytes.
+ * Blocks only if nothing can be read yet.
+ *
+ * @param reader the reader to fill.
+ * @return the number of bytes read, 0 at end of file.
+ */
+ssize_t reader_fill(struct line_reader *reader);
+
+/*
+ * Reads the next line, of any length, without its newline.
+ *
+ * The buffer is refilled with one read() per fill, as large as the free
+ * space allows, so pipes and files are read in big chunks. A last line
+ * that is not terminated by a newline is returned whole.
+ *
+ * @param reader the reader to read from.
+ * @param len if not NULL, receives the length of the line.
+ * @return the NUL terminated line, valid until the next call, or NULL at
+ *         end of file.
+ */
+char *reader_getline(struct line_reader *reader, size_t *len);
+
+/*
+ * Checks whether a whole line is buffered, so reader_getline can return
+ * without reading from the descriptor.
+ *
+ * @param reader the reader to check.
+ * @return true if a line is buffered or the end of file was reached.
+ */
+bool reader_has_line(struct line_reader *reader);
+
+#endif //TINY_LINUX_SHELL_LINEREADER_H
@@ -0,0 +1,98 @@
+// Measures the cost of one iteration of a loop of builtins, which runs
+// from the tokens parsed with the loop, against the same builtins typed as
+// one command line per iteration, each of which is parsed as it is read.
+//
+// Usage: loopbench [-n iterations]
+//
+// Each run feeds a script to ./tsh, and the time per iteration is the time
+// of the run, less that of an empty script, over the number of iterations.
+//
+
+#include "csapp.h"
+#include <spawn.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define SCRIPT  "/tmp/loopbench.tsh"
+#define BODY    "x=$i; test $x = $i"
+
+/*
+ * Times ./tsh running the script.
+ *
+ * @return the time of the run, in microseconds.
+ */
+static double run_script(void) {
+    char *argv[] = {"./tsh", "-p", NULL};
+    posix_spawn_file_actions_t actions;
+    struct timespec t0, t1;
+    int status;
+    pid_t pid;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, SCRIPT,
+                                     O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (posix_spawn(&pid, argv[0], &actions, NULL, argv, environ) != 0) {
+        unix_error("posix_spawn error");
+    }
+    Waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    posix_spawn_file_actions_destroy(&actions);
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e3;
+}
+
+/*
+ * Writes the script, either one loop of n iterations or the body of the
+ * loop n times with i set on each line, or nothing if n is 0.
+ */
+static void write_script(int n, bool loop) {
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(SCRIPT, "w")) == NULL) {
+        unix_error(SCRIPT);
+    }
+    if (loop && n > 0) {
+        fprintf(fp, "for i in");
+        for (i = 0; i < n; i++) {
+            fprintf(fp, " %d", i);
+        }
+        fprintf(fp, "\ndo %s\ndone\n", BODY);
+    } else {
+        for (i = 0; i < n; i++) {
+            fprintf(fp, "i=%d; %s\n", i, BODY);
+        }
+    }
+    fclose(fp);
+}
+
+int main(int argc, char **argv) {
+    int n = 100000, opt;
+    double empty_us, loop_us, lines_us;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            n = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    write_script(0, false);
+    empty_us = run_script();
+    write_script(n, true);
+    loop_us = run_script() - empty_us;
+    write_script(n, false);
+    lines_us = run_script() - empty_us;
+    unlink(SCRIPT);
+
+    printf("%d iterations of: %s\n", n, BODY);
+    printf("for loop          %9.3f us per iteration\n", loop_us / n);
+    printf("command lines     %9.3f us per iteration\n", lines_us / n);
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Generates builtins_table.h, a perfect hash of the builtin names in
+// builtins.def, so the parser finds a builtin with one probe.
+//
+// Usage: mkbuiltins > builtins_table.h
+//
+
+#include "tsh_helper.h"
+
+#define MAX_SEEDS 1000000           // Seeds tried for each table size
+
+static const char *names[NBUILTINS] = {
+    [BUILTIN_NONE] = NULL,
+#define BUILTIN(id, name, function, flags) [BUILTIN_##id] = name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+static const char *ids[NBUILTINS] = {
+    [BUILTIN_NONE] = "BUILTIN_NONE",
+#define BUILTIN(id, name, function, flags) [BUILTIN_##id] = "BUILTIN_" #id,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+/*
+ * Places every name in slots with a seed.
+ *
+ * @param slots the table to fill, with nslots entries.
+ * @param nslots the number of slots, a power of two.
+ * @param seed the seed of the hash.
+ * @return true if no two names share a slot.
+ */
+static bool place_names(int *slots, uint32_t nslots, uint32_t seed) {
+    uint32_t slot;
+    int id;
+
+    memset(slots, 0, nslots * sizeof(int));
+    for (id = 1; id < NBUILTINS; id++) {
+        if (strlen(names[id]) > BUILTIN_MAXNAME) {
+            fprintf(stderr, "mkbuiltins: %s: name too long\n", names[id]);
+            exit(1);
+        }
+        slot = builtin_hash(names[id], seed) & (nslots - 1);
+        if (slots[slot] != BUILTIN_NONE) {
+            return false;
+        }
+        slots[slot] = id;
+    }
+    return true;
+}
+
+int main(void) {
+    uint32_t nslots, seed, i;
+    int *slots;
+
+    // Start with a table at least twice the number of names
+    for (nslots = 1; nslots < 2 * NBUILTINS; nslots *= 2);
+
+    for (;; nslots *= 2) {
+        slots = Malloc(nslots * sizeof(int));
+        for (seed = 1; seed <= MAX_SEEDS; seed++) {
+            if (place_names(slots, nslots, seed)) {
+                break;
+            }
+        }
+        if (seed <= MAX_SEEDS) {
+            break;
+        }
+        Free(slots);
+    }
+
+    printf("// Generated from builtins.def by mkbuiltins, do not edit.\n\n");
+    printf("#define BUILTIN_HASH_SEED %uu\n", seed);
+    printf("#define BUILTIN_HASH_SLOTS %u\n\n", nslots);
+    printf("static const builtin_state builtin_slots[BUILTIN_HASH_SLOTS] =\n{\n");
+    for (i = 0; i < nslots; i++) {
+        printf("    %s,\n", ids[slots[i]]);
+    }
+    printf("};\n");
+    Free(slots);
+    return 0;
+}
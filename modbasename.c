@@ -0,0 +1,65 @@
+// A sample loadable builtin: basename, as in coreutils without options.
+//
+// Built as modbasename.so, it is loaded into the shell with
+//
+//     enable -f ./modbasename.so basename
+//
+// Built with -DSTANDALONE, it is the same utility as a program, which
+// modbench compares the builtin with.
+//
+
+#include "tsh_builtin.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Prints the last component of a path, without a suffix if one is given.
+ *
+ * basename path [suffix]
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @param io the descriptors to use.
+ * @return 1 on a usage error, 0 otherwise.
+ */
+static int basename_run(int argc, char **argv, const struct tsh_builtin_io *io) {
+    const char *path, *base;
+    size_t len, suffix_len;
+
+    if (argc < 2 || argc > 3) {
+        dprintf(io->err, "%s: usage: %s path [suffix]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    // Trailing slashes do not count, but a path of slashes is /
+    path = argv[1];
+    len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    for (base = path + len; base > path && base[-1] != '/'; base--);
+    if (base < path + len) {
+        len -= base - path;
+    } else {
+        base = path;
+    }
+
+    if (argc == 3 && (suffix_len = strlen(argv[2])) < len &&
+        strncmp(base + len - suffix_len, argv[2], suffix_len) == 0) {
+        len -= suffix_len;
+    }
+    dprintf(io->out, "%.*s\n", (int) len, base);
+    return 0;
+}
+
+struct tsh_builtin basename_builtin = {
+    TSH_BUILTIN_ABI, "basename", basename_run, TSH_BUILTIN_SUBSHELL
+};
+
+#ifdef STANDALONE
+int main(int argc, char **argv) {
+    struct tsh_builtin_io io = {0, 1, 2};
+
+    return basename_run(argc, argv, &io);
+}
+#endif
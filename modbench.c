@@ -0,0 +1,84 @@
+// Measures the latency of a utility loaded into the shell with enable -f
+// against the same utility started by the shell as a job.
+//
+// Usage: modbench [-n commands]
+//
+// Both runs feed a script of commands to ./tsh, and the time per command
+// is the time of the run over the number of commands.
+//
+
+#include "csapp.h"
+#include <spawn.h>
+#include <time.h>
+
+#define SCRIPT  "/tmp/modbench.tsh"
+#define COMMAND "/usr/lib/x86_64-linux-gnu/libexample.so.1 .1"
+
+/*
+ * Writes a script of n commands, after a first line, and times ./tsh
+ * running it.
+ *
+ * @param first the first line of the script, or NULL.
+ * @param command the command to repeat.
+ * @param n the number of commands.
+ * @return the time per command, in microseconds.
+ */
+static double run_script(const char *first, const char *command, int n) {
+    char *argv[] = {"./tsh", "-p", NULL};
+    posix_spawn_file_actions_t actions;
+    struct timespec t0, t1;
+    int i, status;
+    FILE *fp;
+    pid_t pid;
+
+    if ((fp = fopen(SCRIPT, "w")) == NULL) {
+        unix_error(SCRIPT);
+    }
+    if (first != NULL) {
+        fprintf(fp, "%s\n", first);
+    }
+    for (i = 0; i < n; i++) {
+        fprintf(fp, "%s %s\n", command, COMMAND);
+    }
+    fclose(fp);
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, SCRIPT,
+                                     O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (posix_spawn(&pid, argv[0], &actions, NULL, argv, environ) != 0) {
+        unix_error("posix_spawn error");
+    }
+    Waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    posix_spawn_file_actions_destroy(&actions);
+    unlink(SCRIPT);
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e3 / n;
+}
+
+int main(int argc, char **argv) {
+    int n = 5000, opt;
+    double loaded_us, job_us;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            n = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n commands]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    loaded_us = run_script("enable -f ./modbasename.so basename",
+                           "basename", n);
+    job_us = run_script(NULL, "./modbasename", n);
+    printf("%d commands\n", n);
+    printf("enable -f builtin %9.2f us per command\n", loaded_us);
+    printf("job               %9.2f us per command\n", job_us);
+    printf("speedup           %9.0fx\n", job_us / loaded_us);
+    return 0;
+}
@@ -0,0 +1,183 @@
+//
+// modules.c - Builtins loaded from shared objects with enable -f
+//
+
+#include "modules.h"
+
+struct loaded_builtin               // A builtin loaded from a shared object
+{
+    struct builtin_info info;       // Name and flags, NULL name if unloaded
+    char *path;                     // The shared object it came from
+    void *handle;                   // The handle from dlopen
+    tsh_builtin_fn run;             // The function that runs it
+};
+
+static struct loaded_builtin *loaded = NULL;   // Indexed by state - NBUILTINS
+static int nloaded = 0;                         // Entries used in loaded
+static int capacity = 0;                        // Entries allocated in loaded
+
+/*
+ * Finds the entry of a loaded builtin.
+ *
+ * @param name the name.
+ * @return the index of the entry, or -1.
+ */
+static int find_loaded(const char *name) {
+    int i;
+
+    for (i = 0; i < nloaded; i++) {
+        if (loaded[i].info.name != NULL &&
+            strcmp(loaded[i].info.name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Loads a builtin from a shared object, see tsh_builtin.h.
+ *
+ * @param path the shared object; without a slash, it is searched for as
+ *        dlopen does.
+ * @param name the name of the builtin, whose struct tsh_builtin is
+ *        exported as <name>_builtin.
+ * @return the builtin state of the builtin, or BUILTIN_NONE if it could
+ *         not be loaded, after printing why.
+ */
+builtin_state module_load(const char *path, const char *name) {
+    struct tsh_builtin *builtin;
+    char symbol[BUILTIN_MAXNAME + sizeof("_builtin")];
+    void *handle;
+    int i;
+
+    if (strlen(name) > BUILTIN_MAXNAME || strchr(name, '/') != NULL) {
+        printf("enable: %s: invalid builtin name\n", name);
+        return BUILTIN_NONE;
+    }
+    if (lookup_builtin(name) != BUILTIN_NONE && find_loaded(name) < 0) {
+        printf("enable: %s: is already a shell builtin\n", name);
+        return BUILTIN_NONE;
+    }
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        printf("enable: %s\n", dlerror());
+        return BUILTIN_NONE;
+    }
+    sprintf(symbol, "%s_builtin", name);
+    if ((builtin = dlsym(handle, symbol)) == NULL) {
+        printf("enable: %s: cannot find %s in shared object\n", path, symbol);
+        dlclose(handle);
+        return BUILTIN_NONE;
+    }
+    if (builtin->abi != TSH_BUILTIN_ABI || builtin->run == NULL) {
+        printf("enable: %s: builtin ABI %d, the shell needs %d\n",
+               path, builtin->abi, TSH_BUILTIN_ABI);
+        dlclose(handle);
+        return BUILTIN_NONE;
+    }
+
+    // Loading a builtin again replaces it
+    module_unload(name);
+    for (i = 0; i < nloaded && loaded[i].info.name != NULL; i++);
+    if (i == nloaded) {
+        if (nloaded == capacity) {
+            capacity = capacity ? 2 * capacity : 8;
+            loaded = Realloc(loaded, capacity * sizeof(struct loaded_builtin));
+        }
+        nloaded++;
+    }
+
+    loaded[i].info.name = strcpy(Malloc(strlen(name) + 1), name);
+    loaded[i].info.flags = BUILTIN_RUNS_FG | BUILTIN_REDIRECTABLE;
+    if (builtin->flags & TSH_BUILTIN_SUBSHELL) {
+        loaded[i].info.flags |= BUILTIN_RUNS_BG;
+    }
+    loaded[i].path = strcpy(Malloc(strlen(path) + 1), path);
+    loaded[i].handle = handle;
+    loaded[i].run = builtin->run;
+    return (builtin_state) (NBUILTINS + i);
+}
+
+/*
+ * Unloads a builtin loaded by module_load, closing its shared object.
+ *
+ * @param name the name of the builtin.
+ * @return true if it was loaded, false otherwise.
+ */
+bool module_unload(const char *name) {
+    int i = find_loaded(name);
+
+    if (i < 0) {
+        return false;
+    }
+    dlclose(loaded[i].handle);
+    Free((char *) loaded[i].info.name);
+    Free(loaded[i].path);
+    loaded[i].info.name = NULL;
+    loaded[i].run = NULL;
+    return true;
+}
+
+/*
+ * Finds a loaded builtin by name.
+ *
+ * @param name the name.
+ * @return its builtin state, or BUILTIN_NONE.
+ */
+builtin_state module_lookup(const char *name) {
+    int i;
+
+    if (nloaded == 0) {
+        return BUILTIN_NONE;
+    }
+    i = find_loaded(name);
+    return i < 0 ? BUILTIN_NONE : (builtin_state) (NBUILTINS + i);
+}
+
+/*
+ * Returns the registry entry of a loaded builtin.
+ *
+ * @param builtin a builtin state from module_load.
+ * @return the entry.
+ */
+const struct builtin_info *module_info(builtin_state builtin) {
+    return &loaded[builtin - NBUILTINS].info;
+}
+
+/*
+ * Runs a loaded builtin on the shell's standard descriptors.
+ *
+ * @param builtin a builtin state from module_load.
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return the exit status of the builtin, or 127 if it was unloaded.
+ */
+int module_run(builtin_state builtin, int argc, char **argv) {
+    struct tsh_builtin_io io = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    struct loaded_builtin *entry = &loaded[builtin - NBUILTINS];
+
+    // A command parsed before enable -d may still name the builtin
+    if (entry->info.name == NULL) {
+        printf("%s: not found\n", argv[0]);
+        return 127;
+    }
+
+    // The module writes to the descriptors, after what the shell buffered
+    fflush(stdout);
+    return entry->run(argc, argv, &io);
+}
+
+/*
+ * Prints an enable -f command for each loaded builtin.
+ *
+ * @param fd the descriptor to print to.
+ */
+void module_list(int fd) {
+    int i;
+
+    for (i = 0; i < nloaded; i++) {
+        if (loaded[i].info.name != NULL) {
+            dprintf(fd, "enable -f %s %s\n", loaded[i].path,
+                    loaded[i].info.name);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+//
+// modules.h - Builtins loaded from shared objects with enable -f
+//
+
+#ifndef TINY_LINUX_SHELL_MODULES_H
+#define TINY_LINUX_SHELL_MODULES_H
+
+#include "tsh_helper.h"
+#include "tsh_builtin.h"
+#include <dlfcn.h>
+
+/*
+ * Loadable builtins are registered after the builtins of builtins.def,
+ * with the builtin states from NBUILTINS on, so the parser, the parse
+ * cache and eval treat them like any other builtin. Their names are
+ * looked up only when a name is not one of the builtins of builtins.def.
+ */
+
+/*
+ * Loads a builtin from a shared object, see tsh_builtin.h.
+ *
+ * @param path the shared object; without a slash, it is searched for as
+ *        dlopen does.
+ * @param name the name of the builtin, whose struct tsh_builtin is
+ *        exported as <name>_builtin.
+ * @return the builtin state of the builtin, or BUILTIN_NONE if it could
+ *         not be loaded, after printing why.
+ */
+builtin_state module_load(const char *path, const char *name);
+
+/*
+ * Unloads a builtin loaded by module_load, closing its shared object.
+ *
+ * @param name the name of the builtin.
+ * @return true if it was loaded, false otherwise.
+ */
+bool module_unload(const char *name);
+
+/*
+ * Finds a loaded builtin by name.
+ *
+ * @param name the name.
+ * @return its builtin state, or BUILTIN_NONE.
+ */
+builtin_state module_lookup(const char *name);
+
+/*
+ * Returns the registry entry of a loaded builtin.
+ *
+ * @param builtin a builtin state from module_load.
+ * @return the entry.
+ */
+const struct builtin_info *module_info(builtin_state builtin);
+
+/*
+ * Runs a loaded builtin on the shell's standard descriptors.
+ *
+ * @param builtin a builtin state from module_load.
+ * @param argc the number of arguments.
+ * @param argv the arguments.
+ * @return the exit status of the builtin, or 127 if it was unloaded.
+ */
+int module_run(builtin_state builtin, int argc, char **argv);
+
+/*
+ * Prints an enable -f command for each loaded builtin.
+ *
+ * @param fd the descriptor to print to.
+ */
+void module_list(int fd);
+
+#endif //TINY_LINUX_SHELL_MODULES_H
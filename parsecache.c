@@ -0,0 +1,311 @@
+//
+// parsecache.c - LRU cache of parsed command lines
+//
+
+#include "parsecache.h"
+
+/*
+ * The parsed form of a command line. Pointers of the tokens are stored as
+ * offsets, so the form can be copied anywhere: argv entries and redirection
+ * files as offsets into the text plus one, with 0 standing for NULL, and
+ * the argv and redirections of a stage as indexes.
+ */
+struct parsed_form
+{
+    parseline_return result;    // PARSELINE_FG or PARSELINE_BG
+    builtin_state builtin;      // The builtin of the first stage
+    int argc;                   // Arguments of the first stage
+    int nstages;                // Number of stages
+    size_t nargs;               // Entries of argv, with the NULLs
+    size_t nredirs;             // Redirections of all stages
+    size_t text_len;            // Bytes of text, without the last NUL
+    size_t *argv;               // Offsets of the arguments
+    struct cmd_stage *stages;   // Stages, with indexes for pointers
+    struct redirection *redirs; // Redirections, with offsets for files
+    char *text;                 // The tokenized text
+};
+
+struct parse_entry              // A cached command line
+{
+    uint64_t hash;              // Hash of the line
+    char *line;                 // The raw line, to rule out collisions
+    size_t len;                 // Length of the line
+    size_t bytes;               // Bytes held for the entry
+    struct parsed_form *form;   // The parsed form
+    struct parse_entry *chain;  // Next entry of the hash bucket
+    struct parse_entry *newer;  // Next more recently used entry
+    struct parse_entry *older;  // Next less recently used entry
+};
+
+static struct parse_entry *buckets[PARSECACHE_ENTRIES]; // Hash table
+static struct parse_entry *newest = NULL;   // Most recently used entry
+static struct parse_entry *oldest = NULL;   // Least recently used entry
+static int nentries = 0;                    // Number of cached lines
+static size_t nbytes = 0;                   // Bytes held by the cache
+static unsigned long hits = 0;              // Lines found in the cache
+static unsigned long misses = 0;            // Lines parsed by parseline
+
+/*
+ * Hashes a command line 8 bytes at a time.
+ */
+static uint64_t hash_line(const char *line, size_t len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len, word;
+
+    for (; len >= 8; line += 8, len -= 8) {
+        memcpy(&word, line, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    word = 0;
+    memcpy(&word, line, len);
+    h = (h ^ word) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+/*
+ * Unlinks an entry from the LRU list.
+ */
+static void lru_unlink(struct parse_entry *entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        oldest = entry->newer;
+    }
+}
+
+/*
+ * Links an entry at the most recently used end of the LRU list.
+ */
+static void lru_push(struct parse_entry *entry) {
+    entry->newer = NULL;
+    entry->older = newest;
+    if (newest != NULL) {
+        newest->newer = entry;
+    } else {
+        oldest = entry;
+    }
+    newest = entry;
+}
+
+/*
+ * Removes an entry from the cache and frees it.
+ */
+static void evict(struct parse_entry *entry) {
+    struct parse_entry **link = &buckets[entry->hash % PARSECACHE_ENTRIES];
+
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+    lru_unlink(entry);
+    nentries--;
+    nbytes -= entry->bytes;
+    Free(entry->form);
+    Free(entry->line);
+    Free(entry);
+}
+
+/*
+ * Copies parsed tokens into one block of memory, with offsets in place of
+ * pointers.
+ *
+ * @param token the tokens returned by parseline.
+ * @param result the result returned by parseline.
+ * @param text_len the length of the command line.
+ * @param bytes receives the size of the block.
+ * @return the parsed form.
+ */
+static struct parsed_form *make_form(struct cmdline_tokens *token,
+                                     parseline_return result, size_t text_len,
+                                     size_t *bytes) {
+    struct parsed_form *form;
+    struct cmd_stage *stage;
+    size_t nargs = 0, nredirs = 0, i, j, a = 0, r = 0;
+    char **words, *p;
+
+    for (i = 0; i < token->nstages; i++) {
+        nargs += token->stages[i].nassigns + token->stages[i].argc + 1;
+        nredirs += token->stages[i].nredirs;
+    }
+    *bytes = sizeof(struct parsed_form) + nargs * sizeof(size_t) +
+             token->nstages * sizeof(struct cmd_stage) +
+             nredirs * sizeof(struct redirection) + text_len + 1;
+    form = Malloc(*bytes);
+    form->argv = (size_t *) (form + 1);
+    form->stages = (struct cmd_stage *) (form->argv + nargs);
+    form->redirs = (struct redirection *) (form->stages + token->nstages);
+    form->text = (char *) (form->redirs + nredirs);
+
+    form->result = result;
+    form->builtin = token->builtin;
+    form->argc = token->argc;
+    form->nstages = token->nstages;
+    form->nargs = nargs;
+    form->nredirs = nredirs;
+    form->text_len = text_len;
+    memcpy(form->text, token->text, text_len);
+    form->text[text_len] = '\0';
+
+    for (i = 0; i < token->nstages; i++) {
+        stage = &form->stages[i];
+        *stage = token->stages[i];
+        stage->argv = (char **) (uintptr_t) (a + stage->nassigns);
+        stage->redirs = (struct redirection *) (uintptr_t) r;
+        words = token->stages[i].argv - stage->nassigns;
+        for (j = 0; j <= stage->nassigns + stage->argc; j++, a++) {
+            p = words[j];
+            form->argv[a] = p ? (p - token->text) + 1 : 0;
+        }
+        for (j = 0; j < token->stages[i].nredirs; j++, r++) {
+            form->redirs[r] = token->stages[i].redirs[j];
+            p = form->redirs[r].file;
+            form->redirs[r].file = (char *) (uintptr_t) (p ? (p - token->text) + 1 : 0);
+        }
+    }
+    return form;
+}
+
+/*
+ * Copies a parsed form into command_arena, turning its offsets back into
+ * pointers.
+ *
+ * @param form the parsed form.
+ * @param token the tokens to fill in.
+ * @return the result of parseline for the form.
+ */
+static parseline_return load_form(const struct parsed_form *form,
+                                  struct cmdline_tokens *token) {
+    struct redirection *redirs;
+    uintptr_t offset;
+    size_t i, j;
+
+    token->text = arena_strndup(&command_arena, form->text, form->text_len);
+    token->argv = arena_alloc(&command_arena, form->nargs * sizeof(char *));
+    token->stages = arena_alloc(&command_arena,
+                                form->nstages * sizeof(struct cmd_stage));
+    redirs = arena_alloc(&command_arena,
+                         form->nredirs * sizeof(struct redirection));
+    token->argc = form->argc;
+    token->nstages = form->nstages;
+    token->builtin = form->builtin;
+
+    for (i = 0; i < form->nargs; i++) {
+        token->argv[i] = form->argv[i] ? token->text + form->argv[i] - 1 : NULL;
+    }
+    for (i = 0; i < form->nredirs; i++) {
+        redirs[i] = form->redirs[i];
+        offset = (uintptr_t) redirs[i].file;
+        redirs[i].file = offset ? token->text + offset - 1 : NULL;
+    }
+    for (i = 0; i < form->nstages; i++) {
+        token->stages[i] = form->stages[i];
+        j = (uintptr_t) form->stages[i].argv;
+        token->stages[i].argv = &token->argv[j];
+        j = (uintptr_t) form->stages[i].redirs;
+        token->stages[i].redirs = &redirs[j];
+    }
+    return form->result;
+}
+
+/*
+ * Parses a command line like parseline, through a cache of the parsed
+ * forms of recent command lines.
+ *
+ * The cache maps a hash of the raw command line to an immutable, position
+ * independent copy of its tokens: the text, the argv layout, the stages
+ * and their redirections, the builtin and the FG/BG result. A hit copies
+ * that form into command_arena and relocates its pointers, without
+ * tokenizing the line again. Lines that fail to parse are not cached, so
+ * their error messages are printed every time.
+ *
+ * The least recently used lines are evicted once the cache holds more than
+ * PARSECACHE_ENTRIES lines or PARSECACHE_BYTES bytes.
+ *
+ * @param cmdline the command line.
+ * @param token the tokens to fill in, as parseline does.
+ * @return the result of parseline for the line.
+ */
+parseline_return parseline_cached(const char *cmdline,
+                                  struct cmdline_tokens *token) {
+    size_t len = strlen(cmdline);
+    uint64_t h = hash_line(cmdline, len);
+    struct parse_entry *entry;
+    parseline_return result;
+
+    for (entry = buckets[h % PARSECACHE_ENTRIES]; entry; entry = entry->chain) {
+        if (entry->hash == h && entry->len == len &&
+            memcmp(entry->line, cmdline, len) == 0) {
+            hits++;
+            lru_unlink(entry);
+            lru_push(entry);
+            return load_form(entry->form, token);
+        }
+    }
+
+    misses++;
+    result = parseline(cmdline, token);
+    if (result != PARSELINE_FG && result != PARSELINE_BG) {
+        return result;
+    }
+
+    entry = Malloc(sizeof(struct parse_entry));
+    entry->hash = h;
+    entry->len = len;
+    entry->line = Malloc(len + 1);
+    memcpy(entry->line, cmdline, len + 1);
+    entry->form = make_form(token, result, len, &entry->bytes);
+    entry->bytes += sizeof(struct parse_entry) + len + 1;
+    if (entry->bytes > PARSECACHE_BYTES) {
+        Free(entry->form);
+        Free(entry->line);
+        Free(entry);
+        return result;
+    }
+
+    while (nentries == PARSECACHE_ENTRIES ||
+           nbytes + entry->bytes > PARSECACHE_BYTES) {
+        evict(oldest);
+    }
+    entry->chain = buckets[h % PARSECACHE_ENTRIES];
+    buckets[h % PARSECACHE_ENTRIES] = entry;
+    lru_push(entry);
+    nentries++;
+    nbytes += entry->bytes;
+    return result;
+}
+
+/*
+ * Prints the hit and miss counters of the parse cache, and the number of
+ * lines and bytes it holds.
+ *
+ * @param fd the descriptor to print to.
+ * @return void
+ */
+void parsecache_stats(int fd) {
+    dprintf(fd, "hits\tmisses\tlines\tbytes\n%lu\t%lu\t%d\t%zu\n",
+            hits, misses, nentries, nbytes);
+}
+
+/*
+ * Forgets all cached command lines and resets the counters.
+ */
+void parsecache_clear(void) {
+    parsecache_invalidate();
+    hits = 0;
+    misses = 0;
+}
+
+/*
+ * Forgets all cached command lines, keeping the counters, after a change
+ * to what the lines would parse to.
+ */
+void parsecache_invalidate(void) {
+    while (oldest != NULL) {
+        evict(oldest);
+    }
+}
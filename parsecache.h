@@ -0,0 +1,54 @@
+//
+// parsecache.h - LRU cache of parsed command lines
+//
+
+#ifndef TINY_LINUX_SHELL_PARSECACHE_H
+#define TINY_LINUX_SHELL_PARSECACHE_H
+
+#include "tsh_helper.h"
+
+#define PARSECACHE_ENTRIES  1024        // Max command lines remembered
+#define PARSECACHE_BYTES    (4 << 20)   // Max bytes of parsed forms held
+
+/*
+ * Parses a command line like parseline, through a cache of the parsed
+ * forms of recent command lines.
+ *
+ * The cache maps a hash of the raw command line to an immutable, position
+ * independent copy of its tokens: the text, the argv layout, the stages
+ * and their redirections, the builtin and the FG/BG result. A hit copies
+ * that form into command_arena and relocates its pointers, without
+ * tokenizing the line again. Lines that fail to parse are not cached, so
+ * their error messages are printed every time.
+ *
+ * The least recently used lines are evicted once the cache holds more than
+ * PARSECACHE_ENTRIES lines or PARSECACHE_BYTES bytes.
+ *
+ * @param cmdline the command line.
+ * @param token the tokens to fill in, as parseline does.
+ * @return the result of parseline for the line.
+ */
+parseline_return parseline_cached(const char *cmdline,
+                                  struct cmdline_tokens *token);
+
+/*
+ * Prints the hit and miss counters of the parse cache, and the number of
+ * lines and bytes it holds.
+ *
+ * @param fd the descriptor to print to.
+ * @return void
+ */
+void parsecache_stats(int fd);
+
+/*
+ * Forgets all cached command lines and resets the counters.
+ */
+void parsecache_clear(void);
+
+/*
+ * Forgets all cached command lines, keeping the counters, after a change
+ * to what the lines would parse to.
+ */
+void parsecache_invalidate(void);
+
+#endif //TINY_LINUX_SHELL_PARSECACHE_H
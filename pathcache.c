@@ -0,0 +1,422 @@
+//
+// pathcache.c - Command lookup through PATH, cached and kept valid by inotify
+//
+
+#include "pathcache.h"
+#include <sys/inotify.h>
+
+#define INITBUCKETS 64      // Initial number of hash buckets
+
+/* Directory events that can change the outcome of a lookup */
+#define DIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                    IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct path_entry {
+    char *name;                 // Command name
+    char *path;                 // Resolved path, NULL for a failed lookup
+    int fd;                     // O_PATH descriptor of path, or -1
+    int dir;                    // Index of the PATH directory it was found in
+    unsigned long hits;         // Number of times the entry was used
+    struct path_entry *next;    // Next entry in the same bucket
+};
+
+struct path_dir {
+    char *name;                 // Directory from PATH
+    int wd;                     // Inotify watch descriptor, or -1
+};
+
+/* Global variables */
+static struct path_entry **buckets = NULL;  // Hash table of lookups
+static int nbuckets = 0;                    // Number of buckets, a power of two
+static int nentries = 0;                    // Number of remembered lookups
+static int nfds = 0;                        // Number of O_PATH descriptors held
+static char *path_var = NULL;               // PATH the cache was built for
+static struct path_dir *dirs = NULL;        // Directories of path_var
+static int ndirs = 0;                       // Number of directories
+static int inotify_fd = -1;                 // Watches the directories
+
+/*
+ * Hashes a command name with FNV-1a.
+ *
+ * @param name the command name.
+ * @return the hash value.
+ */
+static unsigned hash_name(const char *name) {
+    unsigned h = 2166136261u;
+    while (*name) {
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Frees an entry, closing its O_PATH descriptor.
+ *
+ * @param entry the entry to free.
+ */
+static void free_entry(struct path_entry *entry) {
+    if (entry->fd >= 0) {
+        close(entry->fd);
+        nfds--;
+    }
+    Free(entry->name);
+    Free(entry->path);
+    Free(entry);
+    nentries--;
+}
+
+/*
+ * Drops the entries whose outcome a change in PATH directory dir can
+ * affect: failed lookups, and lookups resolved to dir or a later one.
+ * A negative dir drops every entry.
+ *
+ * @param dir the index of the directory that changed.
+ */
+static void drop_entries(int dir) {
+    int i;
+    for (i = 0; i < nbuckets; i++) {
+        struct path_entry **link = &buckets[i];
+        while (*link != NULL) {
+            struct path_entry *entry = *link;
+            if (dir < 0 || entry->path == NULL || entry->dir >= dir) {
+                *link = entry->next;
+                free_entry(entry);
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+/*
+ * Sets up the inotify watch of a PATH directory. A directory that does not
+ * exist gets none, and is tried again each time the cache is validated.
+ *
+ * @param i the index of the directory.
+ */
+static void watch_dir(int i) {
+    dirs[i].wd = inotify_add_watch(inotify_fd, dirs[i].name,
+                                   DIR_EVENTS | IN_ONLYDIR);
+}
+
+/*
+ * Splits PATH into its directories and sets up an inotify watch on each.
+ * An empty directory in PATH stands for the current directory.
+ *
+ * @param path the value of PATH.
+ */
+static void load_dirs(const char *path) {
+    const char *start = path;
+    int i;
+
+    for (i = 0; i < ndirs; i++) {
+        if (dirs[i].wd >= 0) {
+            inotify_rm_watch(inotify_fd, dirs[i].wd);
+        }
+        Free(dirs[i].name);
+    }
+    Free(dirs);
+    Free(path_var);
+
+    path_var = strdup(path);
+    ndirs = 1;
+    for (i = 0; path[i]; i++) {
+        ndirs += path[i] == ':';
+    }
+    dirs = Malloc(ndirs * sizeof(struct path_dir));
+
+    if (inotify_fd < 0) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+
+    for (i = 0; i < ndirs; i++) {
+        size_t len = strcspn(start, ":");
+        if (len == 0) {
+            dirs[i].name = strdup(".");
+        } else {
+            dirs[i].name = strndup(start, len);
+        }
+        dirs[i].wd = -1;
+        if (inotify_fd >= 0) {
+            watch_dir(i);
+        }
+        start += len + 1;
+    }
+}
+
+/*
+ * Brings the cache up to date: drops everything if PATH changed, and
+ * drops the entries affected by the directory changes inotify reported.
+ * When inotify is not available, nothing is remembered across lookups.
+ *
+ * A directory that was deleted or moved away loses its watch. So does a
+ * directory that did not exist to begin with. Such a directory is watched
+ * again as soon as it exists, and the entries it affects are then dropped,
+ * so a command installed in it is found.
+ */
+static void validate_cache(void) {
+    const char *path = getenv("PATH");
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    int i;
+
+    if (path == NULL) {
+        path = "/bin:/usr/bin";
+    }
+    if (buckets == NULL) {
+        nbuckets = INITBUCKETS;
+        buckets = Calloc(nbuckets, sizeof(struct path_entry *));
+    }
+
+    if (path_var == NULL || strcmp(path, path_var) != 0) {
+        drop_entries(-1);
+        load_dirs(path);
+        return;
+    }
+
+    if (inotify_fd < 0) {
+        drop_entries(-1);
+        return;
+    }
+
+    while ((len = read(inotify_fd, events, sizeof(events))) > 0) {
+        char *p = events;
+        while (p < events + len) {
+            struct inotify_event *event = (struct inotify_event *) p;
+            if (event->mask & IN_Q_OVERFLOW) {
+                drop_entries(-1);
+            }
+            if (event->mask & IN_MOVE_SELF) {
+                // The watch follows the directory, not its name
+                inotify_rm_watch(inotify_fd, event->wd);
+            }
+            for (i = ndirs - 1; i >= 0; i--) {
+                if (dirs[i].wd != event->wd) {
+                    continue;
+                }
+                if (event->mask & (IN_IGNORED | IN_MOVE_SELF)) {
+                    dirs[i].wd = -1;
+                }
+                drop_entries(i);
+            }
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    for (i = 0; i < ndirs; i++) {
+        if (dirs[i].wd < 0) {
+            watch_dir(i);
+            if (dirs[i].wd >= 0) {
+                drop_entries(i);
+            }
+        }
+    }
+}
+
+/*
+ * Doubles the number of buckets once the table is fuller than one entry
+ * per bucket on average.
+ */
+static void grow_buckets(void) {
+    struct path_entry **old = buckets;
+    int old_nbuckets = nbuckets;
+    int i;
+
+    nbuckets *= 2;
+    buckets = Calloc(nbuckets, sizeof(struct path_entry *));
+    for (i = 0; i < old_nbuckets; i++) {
+        while (old[i] != NULL) {
+            struct path_entry *entry = old[i];
+            unsigned b = hash_name(entry->name) & (nbuckets - 1);
+            old[i] = entry->next;
+            entry->next = buckets[b];
+            buckets[b] = entry;
+        }
+    }
+    Free(old);
+}
+
+/*
+ * Searches the PATH directories for an executable regular file.
+ *
+ * @param entry the entry to fill in; its name is the command name.
+ */
+static void search_path(struct path_entry *entry) {
+    struct stat st;
+    char *candidate;
+    int i;
+
+    for (i = 0; i < ndirs; i++) {
+        candidate = Malloc(strlen(dirs[i].name) + strlen(entry->name) + 2);
+        sprintf(candidate, "%s/%s", dirs[i].name, entry->name);
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(candidate, X_OK) == 0) {
+            entry->path = candidate;
+            entry->dir = i;
+            if (nfds < MAXPATHFDS &&
+                (entry->fd = open(candidate, O_PATH | O_CLOEXEC)) >= 0) {
+                nfds++;
+            }
+            return;
+        }
+        Free(candidate);
+    }
+}
+
+/*
+ * Finds the entry for a command name, looking it up if necessary. The
+ * cache must have been validated first; entries are only dropped when it
+ * is validated again.
+ *
+ * @param name the command name.
+ * @return the entry.
+ */
+static struct path_entry *lookup(const char *name) {
+    struct path_entry *entry;
+    unsigned b;
+
+    b = hash_name(name) & (nbuckets - 1);
+    for (entry = buckets[b]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+
+    entry = Malloc(sizeof(struct path_entry));
+    entry->name = strdup(name);
+    entry->path = NULL;
+    entry->fd = -1;
+    entry->dir = -1;
+    entry->hits = 0;
+    search_path(entry);
+
+    if (++nentries > nbuckets) {
+        grow_buckets();
+        b = hash_name(name) & (nbuckets - 1);
+    }
+    entry->next = buckets[b];
+    buckets[b] = entry;
+    return entry;
+}
+
+/*
+ * Resolves a command name to the path of an executable by searching the
+ * directories in PATH.
+ *
+ * Both successful and failed lookups are remembered in a hash table, so a
+ * repeated command costs no stat() calls. The cache is dropped when PATH
+ * changes, and entries that a change to one of the PATH directories could
+ * affect are dropped when inotify reports that change.
+ *
+ * Names that contain a slash are returned unchanged.
+ *
+ * @param name the command name, i.e. argv[0].
+ * @param fd if not NULL, receives an O_PATH descriptor of the executable
+ *           suitable for execveat(), or -1 if none is held.
+ * @return the path of the executable, or NULL if it was not found.
+ */
+const char *resolve_command(const char *name, int *fd) {
+    struct path_entry *entry;
+
+    if (fd != NULL) {
+        *fd = -1;
+    }
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+
+    validate_cache();
+    entry = lookup(name);
+    entry->hits++;
+    if (fd != NULL) {
+        *fd = entry->fd;
+    }
+    return entry->path;
+}
+
+/*
+ * Looks up each name in PATH and remembers the result.
+ *
+ * @param names a NULL terminated list of command names.
+ * @return the number of names that were not found.
+ */
+int pathcache_fill(char **names) {
+    int missing = 0;
+
+    validate_cache();
+    for (; *names != NULL; names++) {
+        if (strchr(*names, '/') == NULL && lookup(*names)->path == NULL) {
+            missing++;
+        }
+    }
+    return missing;
+}
+
+/*
+ * Resolves the command names of a pipeline as resolve_command does, with
+ * the cache validated once for all of them.
+ *
+ * @param names the command names, NULL for a command not to look up.
+ * @param n the number of names.
+ * @param paths receives the path of each executable, NULL if it was not
+ *              found or not looked up. Valid until the next lookup.
+ * @param fds receives an O_PATH descriptor of each executable, or -1.
+ * @return the number of names that were not found.
+ */
+int resolve_commands(char **names, int n, const char **paths, int *fds) {
+    struct path_entry *entry;
+    int i, missing = 0;
+
+    validate_cache();
+    for (i = 0; i < n; i++) {
+        paths[i] = names[i];
+        fds[i] = -1;
+        if (names[i] == NULL || strchr(names[i], '/') != NULL) {
+            continue;
+        }
+        entry = lookup(names[i]);
+        entry->hits++;
+        paths[i] = entry->path;
+        fds[i] = entry->fd;
+        missing += entry->path == NULL;
+    }
+    return missing;
+}
+
+/*
+ * Forgets all remembered lookups.
+ */
+void pathcache_clear(void) {
+    drop_entries(-1);
+}
+
+/*
+ * Prints the remembered lookups, with the number of times each one was
+ * used, to a file descriptor.
+ *
+ * @param output_fd the file descriptor to write to.
+ */
+void pathcache_list(int output_fd) {
+    int i;
+
+    if (buckets != NULL) {
+        validate_cache();
+    }
+    if (nentries == 0) {
+        dprintf(output_fd, "hash: hash table empty\n");
+        return;
+    }
+
+    dprintf(output_fd, "hits\tcommand\n");
+    for (i = 0; i < nbuckets; i++) {
+        struct path_entry *entry;
+        for (entry = buckets[i]; entry != NULL; entry = entry->next) {
+            if (entry->path != NULL) {
+                dprintf(output_fd, "%4lu\t%s\n", entry->hits, entry->path);
+            } else {
+                dprintf(output_fd, "%4lu\t%s (not found)\n",
+                        entry->hits, entry->name);
+            }
+        }
+    }
+}
@@ -0,0 +1,72 @@
+//
+// pathcache.h - Command lookup through PATH, cached and kept valid by inotify
+//
+
+#ifndef TINY_LINUX_SHELL_PATHCACHE_H
+#define TINY_LINUX_SHELL_PATHCACHE_H
+
+#include "tsh_helper.h"
+
+#define MAXPATHFDS  256     // Max O_PATH descriptors held by the cache
+
+/* GNU extensions, spelled out since csapp.h clashes with _GNU_SOURCE */
+#ifndef O_PATH
+#define O_PATH          __O_PATH
+#endif
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH   0x1000
+#endif
+
+/*
+ * Resolves a command name to the path of an executable by searching the
+ * directories in PATH.
+ *
+ * Both successful and failed lookups are remembered in a hash table, so a
+ * repeated command costs no stat() calls. The cache is dropped when PATH
+ * changes, and entries that a change to one of the PATH directories could
+ * affect are dropped when inotify reports that change.
+ *
+ * Names that contain a slash are returned unchanged.
+ *
+ * @param name the command name, i.e. argv[0].
+ * @param fd if not NULL, receives an O_PATH descriptor of the executable
+ *           suitable for execveat(), or -1 if none is held.
+ * @return the path of the executable, or NULL if it was not found.
+ */
+const char *resolve_command(const char *name, int *fd);
+
+/*
+ * Looks up each name in PATH and remembers the result.
+ *
+ * @param names a NULL terminated list of command names.
+ * @return the number of names that were not found.
+ */
+int pathcache_fill(char **names);
+
+/*
+ * Resolves the command names of a pipeline as resolve_command does, with
+ * the cache validated once for all of them.
+ *
+ * @param names the command names, NULL for a command not to look up.
+ * @param n the number of names.
+ * @param paths receives the path of each executable, NULL if it was not
+ *              found or not looked up. Valid until the next lookup.
+ * @param fds receives an O_PATH descriptor of each executable, or -1.
+ * @return the number of names that were not found.
+ */
+int resolve_commands(char **names, int n, const char **paths, int *fds);
+
+/*
+ * Forgets all remembered lookups.
+ */
+void pathcache_clear(void);
+
+/*
+ * Prints the remembered lookups, with the number of times each one was
+ * used, to a file descriptor.
+ *
+ * @param output_fd the file descriptor to write to.
+ */
+void pathcache_list(int output_fd);
+
+#endif //TINY_LINUX_SHELL_PATHCACHE_H
@@ -0,0 +1,153 @@
+// Measures the throughput of parseline with each tokenizer implementation,
+// after checking that they all produce the same tokens.
+//
+// Usage: scanbench [-n rounds] [file...]
+//
+// Without files, a generated script with multi-kilobyte lines is used.
+//
+
+#include "tsh_helper.h"
+#include <time.h>
+
+#define GEN_LINES   2000    // Lines of the generated script
+#define GEN_ARGS    400     // Arguments per generated line
+
+static const char *impl_names[] = {"auto", "scalar", "sse2", "avx2"};
+
+/*
+ * Appends a file, or the generated script if path is NULL, to a buffer of
+ * newline separated command lines.
+ */
+static void load(char **buf, size_t *len, const char *path) {
+    char arg[64];
+    FILE *fp;
+    size_t n;
+    int i, j;
+
+    if (path != NULL) {
+        if ((fp = fopen(path, "r")) == NULL) {
+            unix_error((char *) path);
+        }
+        fseek(fp, 0, SEEK_END);
+        n = ftell(fp);
+        rewind(fp);
+        *buf = Realloc(*buf, *len + n + 1);
+        *len += fread(*buf + *len, 1, n, fp);
+        fclose(fp);
+        return;
+    }
+
+    for (i = 0; i < GEN_LINES; i++) {
+        for (j = 0; j < GEN_ARGS; j++) {
+            switch (j % 8) {
+                case 0:
+                    n = sprintf(arg, "/usr/bin/process-%d ", i);
+                    break;
+                case 3:
+                    n = sprintf(arg, "\"quoted argument %d\" ", j);
+                    break;
+                case 5:
+                    n = sprintf(arg, "--option=value-%d\t", j);
+                    break;
+                case 7:
+                    n = sprintf(arg, j % 64 == 7 ? "| /bin/cat " : "2>>log.%d ", j);
+                    break;
+                default:
+                    n = sprintf(arg, "argument%d ", j);
+                    break;
+            }
+            *buf = Realloc(*buf, *len + n + 1);
+            memcpy(*buf + *len, arg, n);
+            *len += n;
+        }
+        *buf = Realloc(*buf, *len + 3);
+        memcpy(*buf + *len, "&\n", 2);
+        *len += 2;
+    }
+}
+
+/*
+ * Parses every line and folds the tokens into a checksum, so different
+ * tokenizations give different sums.
+ */
+static unsigned long parse_all(char *lines, size_t len) {
+    struct cmdline_tokens token;
+    unsigned long sum = 0;
+    char *line, *end, *nl;
+    int i, r;
+
+    for (line = lines, end = lines + len; line < end; line = nl + 1) {
+        nl = memchr(line, '\n', end - line);
+        if (nl == NULL) {
+            nl = end;
+        }
+        *nl = '\0';
+        r = parseline(line, &token);
+        sum = sum * 31 + r;
+        if (r == PARSELINE_FG || r == PARSELINE_BG) {
+            sum = sum * 31 + token.nstages;
+            for (i = 0; token.argv[i] != NULL || i < token.argc; i++) {
+                sum = sum * 31 + (token.argv[i] ? strlen(token.argv[i]) : 0);
+                sum = sum * 31 + (token.argv[i] ? (unsigned char) *token.argv[i] : 0);
+            }
+        }
+        *nl = '\n';
+        arena_reset(&command_arena);
+    }
+    return sum;
+}
+
+int main(int argc, char **argv) {
+    char *lines = NULL;
+    size_t len = 0;
+    int rounds = 20, opt, i, r;
+    unsigned long sum, expected = 0;
+    struct timespec t0, t1;
+    double secs;
+    scan_impl impl, got;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            rounds = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n rounds] [file...]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind == argc) {
+        load(&lines, &len, NULL);
+    }
+    for (i = optind; i < argc; i++) {
+        load(&lines, &len, argv[i]);
+    }
+
+    // Parse errors in the input would flood the output
+    if (freopen("/dev/null", "w", stderr) == NULL) {
+        unix_error("freopen error");
+    }
+
+    printf("%.1f MB in %d rounds\n", len / 1e6, rounds);
+    for (impl = SCAN_SCALAR; impl <= SCAN_AVX2; impl++) {
+        if ((got = scanner_init(impl)) != impl) {
+            printf("%-7s unsupported\n", impl_names[impl]);
+            continue;
+        }
+
+        sum = parse_all(lines, len);
+        if (impl == SCAN_SCALAR) {
+            expected = sum;
+        } else if (sum != expected) {
+            printf("%-7s MISMATCH with scalar tokens\n", impl_names[impl]);
+            exit(1);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (r = 0; r < rounds; r++) {
+            parse_all(lines, len);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("%-7s %8.1f MB/s\n", impl_names[impl], len * rounds / secs / 1e6);
+    }
+    return 0;
+}
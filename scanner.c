@@ -0,0 +1,224 @@
+//
+// scanner.c - Character class bitmaps of command lines, for the tokenizer
+//
+
+#include "scanner.h"
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD               // SSE2 is part of x86-64
+#endif
+
+/* Classes of the bytes, as stored in class_table */
+#define CLASS_BLANK     0x01    // Also a word end
+#define CLASS_PIPE      0x02    // Also a word end
+#define CLASS_QUOTE     0x04
+#define CLASS_REDIR     0x08
+
+static const uint8_t class_table[256] = {
+    [' '] = CLASS_BLANK, ['\t'] = CLASS_BLANK,
+    ['\r'] = CLASS_BLANK, ['\n'] = CLASS_BLANK,
+    ['|'] = CLASS_PIPE,
+    ['\''] = CLASS_QUOTE, ['"'] = CLASS_QUOTE,
+    ['<'] = CLASS_REDIR, ['>'] = CLASS_REDIR,
+};
+
+/*
+ * Classifies bytes [from, len) one at a time, into bitmaps that are zero
+ * from word from / 64 on. Also classifies the tail of the line for the
+ * vector implementations.
+ */
+static void classify_scalar(struct scan_map *map, const char *text,
+                            size_t from, size_t len) {
+    uint64_t bit;
+    size_t i;
+    uint8_t c;
+
+    for (i = from; i < len; i++) {
+        if ((c = class_table[(uint8_t) text[i]]) == 0) {
+            continue;
+        }
+        bit = 1ULL << (i & 63);
+        if (c & (CLASS_BLANK | CLASS_PIPE)) {
+            map->word_ends[i >> 6] |= bit;
+        }
+        if (c & CLASS_BLANK) {
+            map->blanks[i >> 6] |= bit;
+        }
+        if (c & CLASS_QUOTE) {
+            map->quotes[i >> 6] |= bit;
+        }
+        map->npipes += (c == CLASS_PIPE);
+        map->nredirs += (c == CLASS_REDIR);
+    }
+}
+
+/*
+ * Stores the classes of one 64 byte block, from the masks of its bytes.
+ */
+static inline __attribute__((always_inline))
+void store_block(struct scan_map *map, size_t w, uint64_t blank,
+                 uint64_t pipe, uint64_t quote, uint64_t redir) {
+    map->blanks[w] = blank;
+    map->word_ends[w] = blank | pipe;
+    map->quotes[w] = quote;
+    // Operators are rare, and x86-64 only has popcnt as an extension
+    if (pipe != 0) {
+        map->npipes += __builtin_popcountll(pipe);
+    }
+    if (redir != 0) {
+        map->nredirs += __builtin_popcountll(redir);
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * Classifies whole 64 byte blocks 16 bytes at a time, and returns the
+ * number of bytes classified.
+ */
+static size_t classify_sse2(struct scan_map *map, const char *text,
+                            size_t len) {
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r'), nl = _mm_set1_epi8('\n');
+    const __m128i bar = _mm_set1_epi8('|');
+    const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+    const __m128i sq = _mm_set1_epi8('\''), dq = _mm_set1_epi8('"');
+    uint64_t blank, pipe, quote, redir;
+    size_t i;
+    int k;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        blank = pipe = quote = redir = 0;
+        for (k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (text + i + 16 * k));
+            __m128i b = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, nl)));
+            __m128i q = _mm_or_si128(_mm_cmpeq_epi8(v, sq), _mm_cmpeq_epi8(v, dq));
+            __m128i r = _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt));
+
+            blank |= (uint64_t) (uint16_t) _mm_movemask_epi8(b) << (16 * k);
+            pipe |= (uint64_t) (uint16_t)
+                    _mm_movemask_epi8(_mm_cmpeq_epi8(v, bar)) << (16 * k);
+            quote |= (uint64_t) (uint16_t) _mm_movemask_epi8(q) << (16 * k);
+            redir |= (uint64_t) (uint16_t) _mm_movemask_epi8(r) << (16 * k);
+        }
+        store_block(map, i >> 6, blank, pipe, quote, redir);
+    }
+    return i;
+}
+
+/*
+ * Classifies whole 64 byte blocks 32 bytes at a time, and returns the
+ * number of bytes classified. Only called if the CPU supports AVX2.
+ */
+__attribute__((target("avx2,popcnt")))
+static size_t classify_avx2(struct scan_map *map, const char *text,
+                            size_t len) {
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r'), nl = _mm256_set1_epi8('\n');
+    const __m256i bar = _mm256_set1_epi8('|');
+    const __m256i lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>');
+    const __m256i sq = _mm256_set1_epi8('\''), dq = _mm256_set1_epi8('"');
+    uint64_t blank, pipe, quote, redir;
+    size_t i;
+    int k;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        blank = pipe = quote = redir = 0;
+        for (k = 0; k < 2; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (text + i + 32 * k));
+            __m256i b = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                    _mm256_cmpeq_epi8(v, tab)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                                    _mm256_cmpeq_epi8(v, nl)));
+            __m256i q = _mm256_or_si256(_mm256_cmpeq_epi8(v, sq),
+                                        _mm256_cmpeq_epi8(v, dq));
+            __m256i r = _mm256_or_si256(_mm256_cmpeq_epi8(v, lt),
+                                        _mm256_cmpeq_epi8(v, gt));
+
+            blank |= (uint64_t) (uint32_t) _mm256_movemask_epi8(b) << (32 * k);
+            pipe |= (uint64_t) (uint32_t)
+                    _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, bar)) << (32 * k);
+            quote |= (uint64_t) (uint32_t) _mm256_movemask_epi8(q) << (32 * k);
+            redir |= (uint64_t) (uint32_t) _mm256_movemask_epi8(r) << (32 * k);
+        }
+        store_block(map, i >> 6, blank, pipe, quote, redir);
+    }
+    return i;
+}
+
+#endif
+
+static scan_impl current_impl = SCAN_SCALAR;   // Selected by scanner_init
+
+/*
+ * Selects the implementation of the classification pass. Until this is
+ * called, the scalar one is used.
+ *
+ * @param impl the implementation to use; SCAN_AUTO picks AVX2 or SSE2 if
+ *             the CPU has them. Falls back to the scalar one if the CPU
+ *             or the compiler lacks the one requested.
+ * @return the implementation selected.
+ */
+scan_impl scanner_init(scan_impl impl) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (impl == SCAN_AUTO) {
+        impl = __builtin_cpu_supports("avx2") ? SCAN_AVX2 : SCAN_SSE2;
+    } else if (impl == SCAN_AVX2 && !__builtin_cpu_supports("avx2")) {
+        impl = SCAN_SCALAR;
+    }
+#else
+    impl = SCAN_SCALAR;
+#endif
+    current_impl = impl;
+    return impl;
+}
+
+/*
+ * Returns the number of words of storage scan_classify needs for a line
+ * of len bytes.
+ */
+size_t scan_storage(size_t len) {
+    return 3 * (len / 64 + 1);
+}
+
+/*
+ * Classifies every byte of a command line in one pass.
+ *
+ * @param map the map to fill in.
+ * @param text the bytes to classify.
+ * @param len the number of bytes.
+ * @param storage scan_storage(len) words for the bitmaps.
+ * @return void
+ */
+void scan_classify(struct scan_map *map, const char *text, size_t len,
+                   uint64_t *storage) {
+    size_t done = 0, w;
+
+    map->len = len;
+    map->nwords = len / 64 + 1;
+    map->blanks = storage;
+    map->word_ends = storage + map->nwords;
+    map->quotes = storage + 2 * map->nwords;
+    map->npipes = 0;
+    map->nredirs = 0;
+
+#ifdef HAVE_X86_SIMD
+    if (current_impl == SCAN_AVX2) {
+        done = classify_avx2(map, text, len);
+    } else if (current_impl == SCAN_SSE2) {
+        done = classify_sse2(map, text, len);
+    }
+#endif
+
+    // The vector passes store whole words; the rest is or'ed into zeroes
+    for (w = done >> 6; w < map->nwords; w++) {
+        map->blanks[w] = map->word_ends[w] = map->quotes[w] = 0;
+    }
+    classify_scalar(map, text, done, len);
+}
@@ -0,0 +1,100 @@
+//
+// scanner.h - Character class bitmaps of command lines, for the tokenizer
+//
+
+#ifndef TINY_LINUX_SHELL_SCANNER_H
+#define TINY_LINUX_SHELL_SCANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Implementations of the classification pass
+typedef enum scan_impl
+{
+    SCAN_AUTO,                  // The fastest one the CPU supports
+    SCAN_SCALAR,                // One byte at a time, through a table
+    SCAN_SSE2,                  // 16 bytes at a time
+    SCAN_AVX2                   // 32 bytes at a time
+} scan_impl;
+
+/*
+ * The classes of every byte of a command line, as bitmaps with bit i of
+ * word i / 64 standing for byte i. Once a line has been classified,
+ * finding the end of a token is a few bit operations per 64 bytes instead
+ * of a strspn/strcspn call per token.
+ */
+struct scan_map
+{
+    size_t len;                 // Number of bytes classified
+    size_t nwords;              // Number of words in each bitmap
+    uint64_t *blanks;           // ' ', '\t', '\r' and '\n'
+    uint64_t *word_ends;        // The blanks and '|'
+    uint64_t *quotes;           // '\'' and '"'
+    size_t npipes;              // Number of '|' bytes
+    size_t nredirs;             // Number of '<' and '>' bytes
+};
+
+/*
+ * Selects the implementation of the classification pass. Until this is
+ * called, the scalar one is used.
+ *
+ * @param impl the implementation to use; SCAN_AUTO picks AVX2 or SSE2 if
+ *             the CPU has them. Falls back to the scalar one if the CPU
+ *             or the compiler lacks the one requested.
+ * @return the implementation selected.
+ */
+scan_impl scanner_init(scan_impl impl);
+
+/*
+ * Returns the number of words of storage scan_classify needs for a line
+ * of len bytes.
+ */
+size_t scan_storage(size_t len);
+
+/*
+ * Classifies every byte of a command line in one pass.
+ *
+ * @param map the map to fill in.
+ * @param text the bytes to classify.
+ * @param len the number of bytes.
+ * @param storage scan_storage(len) words for the bitmaps.
+ * @return void
+ */
+void scan_classify(struct scan_map *map, const char *text, size_t len,
+                   uint64_t *storage);
+
+/*
+ * Finds the first set bit at or after pos in a bitmap of a scan_map,
+ * or the first clear bit if invert is true.
+ *
+ * @param map a classified line.
+ * @param bits one of the bitmaps of map.
+ * @param pos the offset to start at.
+ * @param invert true to look for a byte not in the bitmap.
+ * @return the offset of the byte found, or map->len if there is none.
+ */
+static inline size_t scan_find(const struct scan_map *map,
+                               const uint64_t *bits, size_t pos, int invert)
+{
+    uint64_t flip = invert ? ~0ULL : 0;
+    size_t w = pos >> 6;
+    uint64_t word;
+
+    if (pos >= map->len)
+    {
+        return map->len;
+    }
+    word = (bits[w] ^ flip) & (~0ULL << (pos & 63));
+    while (word == 0)
+    {
+        if (++w == map->nwords)
+        {
+            return map->len;
+        }
+        word = bits[w] ^ flip;
+    }
+    pos = (w << 6) + __builtin_ctzll(word);
+    return pos < map->len ? pos : map->len;
+}
+
+#endif //TINY_LINUX_SHELL_SCANNER_H
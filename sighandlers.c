@@ -5,44 +5,161 @@
 #include "sighandlers.h"
 
 /*
- * Catches SIGCHLD signals from both foreground and background processes
- * launched by the shell.
+ * Updates the job of a child process that changed state.
  *
- * Upon receipt of a SIGCHLD signal the handler reaps all child processes
- * that have finished. or were terminated or stopped by a signal.
+ * If the child process was stopped, its job is marked as stopped, and a
+ * message is printed in the shell to notify the user. The other processes
+ * of a pipeline get the same signal, so the message is only printed once.
  *
- * If the child process was stopped, its state in the job list is updated,
- * and a message is printed in the shell to notify the user.
+ * If the child process terminated, its wait status is recorded with its
+ * job. Once every process of the job terminated, the job is deleted from
+ * the job list, and if the last process of the pipeline was terminated by
+ * a signal, a message is printed in the shell to notify the user.
  *
- * If the child process was terminated by a signal it is deleted from the
- * job list, and a message is printed in the shell to notify the user.
+ * The status of a foreground job that stopped or finished becomes $?: the
+ * exit status of the last process of the pipeline, or 128 plus the signal
+ * that stopped or terminated it, or 127 if the last command could not be
+ * started.
  *
- * If the child process exited normally, it is deleted from the job list
- * but no notification message is printed.
+ * @param pid the process id of the child.
+ * @param wstatus the wait status of the child.
  */
-void sigchld_handler(int sig) {
-    Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
+static void update_job(pid_t pid, int wstatus) {
+    struct job_t *job = getjobpid(&job_list, pid);
+    int last;
+
+    if (job == NULL) {
+        return;
+    }
+
+    if (WIFSTOPPED(wstatus)) {          // If child stopped by a signal
+        if (job->state == FG) {
+            last_status = 128 + WSTOPSIG(wstatus);
+        }
+        if (job->state != ST) {
+            setjobstate(&job_list, job, ST);
+            printMsg(job->jid, job->pid, wstatus);
+        }
+        return;
+    }
+
+    unwatch_proc(getjobproc(&job_list, pid));
+    if (!reapjobproc(&job_list, pid, wstatus)) {
+        return;                         // Other stages are still running
+    }
+
+    last = joblaststatus(&job_list, job);
+    if (job->state == FG) {
+        last_status = wait_status_code(last);
+    }
+    if (WIFSIGNALED(last)) {            // If the last stage terminated by a signal
+        printMsg(job->jid, job->pid, last);
+    }
+    deletejob(&job_list, pid);
+}
 
+/*
+ * Reaps all child processes that have finished, or were terminated or
+ * stopped by a signal, and updates the job list accordingly.
+ *
+ * Expects the job control signals to be blocked.
+ */
+void reap_children(void) {
     int wstatus;
     pid_t pid;
 
     while ((pid = waitpid(WAIT_ANY, &wstatus, WUNTRACED | WNOHANG)) > 0) {
+        update_job(pid, wstatus);
+    }
+}
 
-        struct job_t *job = getjobpid(job_list, pid);
-
-        if (WIFSIGNALED(wstatus)) {         // If child terminated by a signal
-            int sig = WTERMSIG(wstatus);
-            printMsg(job->jid, job->pid, sig);
-            deletejob(job_list, pid);
-        } else if (WIFEXITED(wstatus)) {    // If child exited normally by returning from main or calling exit()
-            deletejob(job_list, pid);
-        } else if (WIFSTOPPED(wstatus)) {   // If child stopped by a signal
-            int sig = WSTOPSIG(wstatus);
-            job->state = ST;
-            printMsg(job->jid, job->pid, sig);
+/*
+ * Reaps the processes of one job through their pidfds, if they have
+ * finished or were terminated or stopped by a signal, and updates the
+ * job list.
+ *
+ * Expects the job control signals to be blocked.
+ *
+ * @param job the job to reap.
+ */
+void reap_job(struct job_t *job) {
+    siginfo_t info;
+    struct job_proc *procs;
+    int i, nprocs, jid = job->jid;
+
+    if (jobpidfd(&job_list, job) < 0) {
+        reap_children();
+        return;
+    }
+
+    procs = jobprocs(&job_list, job, &nprocs);
+    for (i = 0; i < nprocs && getjobjid(&job_list, jid) == job; i++) {
+        if (procs[i].status >= 0 || procs[i].pidfd < 0) {
+            continue;
+        }
+        info.si_pid = 0;
+        if (waitid(P_PIDFD, procs[i].pidfd, &info,
+                   WEXITED | WSTOPPED | WNOHANG) < 0 || info.si_pid == 0) {
+            continue;
+        }
+        switch (info.si_code) {
+            case CLD_EXITED:
+                update_job(info.si_pid, W_EXITCODE(info.si_status, 0));
+                break;
+            case CLD_KILLED:
+            case CLD_DUMPED:
+                update_job(info.si_pid, W_EXITCODE(0, info.si_status));
+                break;
+            case CLD_STOPPED:
+                update_job(info.si_pid, W_STOPCODE(info.si_status));
+                break;
         }
     }
+}
+
+/*
+ * Returns the pidfd of a process of a job that was not reaped yet,
+ * or -1 if there is none.
+ */
+static int live_pidfd(struct job_t *job) {
+    struct job_proc *procs;
+    int i, nprocs;
 
+    procs = jobprocs(&job_list, job, &nprocs);
+    for (i = 0; i < nprocs; i++) {
+        if (procs[i].status < 0 && procs[i].pidfd >= 0) {
+            return procs[i].pidfd;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Forwards a signal to the process group of the current foreground job.
+ *
+ * If there is no current foreground job, no action is taken. A SIGINT
+ * also sets interrupted, so the loop it arrived in stops.
+ *
+ * Expects the job control signals to be blocked.
+ */
+void forward_to_fg(int sig) {
+    struct job_t *job = getjobpid(&job_list, fgpid(&job_list));
+
+    if (sig == SIGINT) {
+        interrupted = true;     // Stops a loop of builtins, which has no job
+    }
+    if (job != NULL) {
+        signal_job(job, sig);
+    }
+}
+
+/*
+ * Catches SIGCHLD signals from both foreground and background processes
+ * launched by the shell, and reaps the children that changed state.
+ */
+void sigchld_handler(int sig) {
+    Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
+    reap_children();
     Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
     return;
 }
@@ -55,11 +172,7 @@ void sigchld_handler(int sig) {
  */
 void sigtstp_handler(int sig) {
     Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
-
-    pid_t fg_pid = fgpid(job_list);
-    if (fg_pid > 0) {
-        Kill(-fg_pid, sig);
-    }
+    forward_to_fg(sig);
     Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
     return;
 }
@@ -72,11 +185,121 @@ void sigtstp_handler(int sig) {
  */
 void sigint_handler(int sig) {
     Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
-
-    pid_t fg_pid = fgpid(job_list);
-    if (fg_pid > 0) {
-        Kill(-fg_pid, sig);
-    }
+    forward_to_fg(sig);
     Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
     return;
 }
+
+/*
+ * Reads the job control signals queued on signal_fd and handles them
+ * synchronously, the way the signal handlers would.
+ *
+ * Blocks until at least one signal is queued.
+ */
+void dispatch_signals(void) {
+    struct signalfd_siginfo info[16];
+    ssize_t n;
+    int i;
+
+    while ((n = read(signal_fd, info, sizeof(info))) < 0) {
+        if (errno != EINTR) {
+            unix_error("signalfd read error");
+        }
+    }
+
+    for (i = 0; i < n / (ssize_t) sizeof(info[0]); i++) {
+        if (info[i].ssi_signo == SIGCHLD) {
+            reap_children();
+        } else {
+            forward_to_fg(info[i].ssi_signo);
+        }
+    }
+}
+
+/*
+ * Checks whether a SIGINT arrived since the command line started, for
+ * loops whose bodies never wait for a job and so never see the signal.
+ *
+ * In event loop mode the job control signals queued on signal_fd are
+ * handled first, if there are any.
+ *
+ * @return true if the command line was interrupted.
+ */
+bool script_interrupted(void) {
+    sigset_t pending;
+
+    if (event_loop && !interrupted) {
+        sigpending(&pending);
+        if (sigismember(&pending, SIGINT) || sigismember(&pending, SIGCHLD) ||
+            sigismember(&pending, SIGTSTP)) {
+            dispatch_signals();
+        }
+    }
+    return interrupted;
+}
+
+/*
+ * Suspends the shell until the job control signals or a pidfd of a job
+ * report that some child may have changed state, and handles them.
+ *
+ * @param job the job whose pidfd to poll in event loop mode.
+ * @param old_mask the mask to install while waiting for a signal.
+ */
+static void wait_for_change(struct job_t *job, const sigset_t *old_mask) {
+    struct pollfd fds[2];
+
+    if (!event_loop) {
+        Sigsuspend(old_mask);
+        return;
+    }
+
+    fds[0].fd = signal_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = live_pidfd(job);
+    fds[1].events = POLLIN;
+    if (poll(fds, fds[1].fd >= 0 ? 2 : 1, -1) < 0) {
+        if (errno != EINTR) {
+            unix_error("poll error");
+        }
+        return;
+    }
+    if (fds[1].fd >= 0 && fds[1].revents) {
+        reap_job(job);
+    }
+    if (fds[0].revents) {
+        dispatch_signals();
+    }
+}
+
+/*
+ * Suspends the shell until there is no foreground job.
+ *
+ * In event loop mode the job control signals stay blocked and are read
+ * from signal_fd instead of being delivered to the handlers, and the
+ * shell also polls a pidfd of the foreground job, reaping just that
+ * job as soon as one of its processes exits.
+ *
+ * @param old_mask the mask to install while waiting for a signal.
+ */
+void wait_for_fg(const sigset_t *old_mask) {
+    struct job_t *job;
+
+    while ((job = getjobpid(&job_list, fgpid(&job_list))) != NULL) {
+        wait_for_change(job, old_mask);
+    }
+}
+
+/*
+ * Suspends the shell until a job is done or stopped, the same way
+ * wait_for_fg waits for the foreground job.
+ *
+ * @param jid the job ID of the job.
+ * @param old_mask the mask to install while waiting for a signal.
+ */
+void wait_for_job(int jid, const sigset_t *old_mask) {
+    struct job_t *job;
+
+    while ((job = getjobjid(&job_list, jid)) != NULL && job->state != ST) {
+        wait_for_change(job, old_mask);
+    }
+}
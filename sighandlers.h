@@ -9,22 +9,48 @@
 
 #include "tsh_helper.h"
 #include "utilities.h"
+#include <sys/signalfd.h>
+#include <poll.h>
 
 /*
- * Catches SIGCHLD signals from both foreground and background processes
- * launched by the shell.
+ * Reaps all child processes that have finished, or were terminated or
+ * stopped by a signal, and updates the job list accordingly.
+ *
+ * If a child process was stopped, its job is marked as stopped, and a
+ * message is printed in the shell to notify the user.
+ *
+ * Once every process of a job terminated, the job is deleted from the job
+ * list. If the last process of the pipeline was terminated by a signal,
+ * a message is printed in the shell to notify the user.
+ *
+ * Expects the job control signals to be blocked.
+ */
+void reap_children(void);
+
+/*
+ * Reaps the processes of one job through their pidfds, if they have
+ * finished or were terminated or stopped by a signal, and updates the
+ * job list.
  *
- * Upon receipt of a SIGCHLD signal the handler reaps all child processes
- * that have finished. or were terminated or stopped by a signal.
+ * Expects the job control signals to be blocked.
  *
- * If the child process was stopped, its state in the job list is updated,
- * and a message is printed in the shell to notify the user.
+ * @param job the job to reap.
+ */
+void reap_job(struct job_t *job);
+
+/*
+ * Forwards a signal to the process group of the current foreground job.
  *
- * If the child process was terminated by a signal it is deleted from the
- * job list, and a message is printed in the shell to notify the user.
+ * If there is no current foreground job, no action is taken. A SIGINT
+ * also sets interrupted, so the loop it arrived in stops.
  *
- * If the child process exited normally, it is deleted from the job list
- * but no notification message is printed.
+ * Expects the job control signals to be blocked.
+ */
+void forward_to_fg(int sig);
+
+/*
+ * Catches SIGCHLD signals from both foreground and background processes
+ * launched by the shell, and reaps the children that changed state.
  */
 void sigchld_handler(int sig);
 
@@ -44,4 +70,44 @@ void sigtstp_handler(int sig);
  */
 void sigint_handler(int sig);
 
+/*
+ * Reads the job control signals queued on signal_fd and handles them
+ * synchronously, the way the signal handlers would.
+ *
+ * Blocks until at least one signal is queued.
+ */
+void dispatch_signals(void);
+
+/*
+ * Checks whether a SIGINT arrived since the command line started, for
+ * loops whose bodies never wait for a job and so never see the signal.
+ *
+ * In event loop mode the job control signals queued on signal_fd are
+ * handled first, if there are any.
+ *
+ * @return true if the command line was interrupted.
+ */
+bool script_interrupted(void);
+
+/*
+ * Suspends the shell until there is no foreground job.
+ *
+ * In event loop mode the job control signals stay blocked and are read
+ * from signal_fd instead of being delivered to the handlers, and the
+ * shell also polls a pidfd of the foreground job, reaping just that
+ * job as soon as one of its processes exits.
+ *
+ * @param old_mask the mask to install while waiting for a signal.
+ */
+void wait_for_fg(const sigset_t *old_mask);
+
+/*
+ * Suspends the shell until a job is done or stopped, the same way
+ * wait_for_fg waits for the foreground job.
+ *
+ * @param jid the job ID of the job.
+ * @param old_mask the mask to install while waiting for a signal.
+ */
+void wait_for_job(int jid, const sigset_t *old_mask);
+
 #endif //TINY_LINUX_SHELL_SIGHANDLERS_H
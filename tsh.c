@@ -19,11 +19,29 @@
  * The shell also provides various built-in commands that support
  * job control:
  *
- * - quit     : terminates the shell.
- * - jobs     : Lists the running and stopped background jobs.
- * - bg <job> : Change a stopped job into a running foreground job.
- * - fg <job> : Change a stopped job or running background job
- *              into a running foreground job.
+ * - quit       : terminates the shell.
+ * - jobs       : Lists the running and stopped background jobs.
+ * - bg <job>   : Change a stopped job into a running foreground job.
+ * - fg <job>   : Change a stopped job or running background job
+ *                into a running foreground job.
+ * - wait       : Waits for the background jobs, or the jobs named.
+ * - kill       : Sends a signal, SIGTERM by default, to jobs or PIDs.
+ *
+ * and others that do not:
+ *
+ * - hash       : Lists, clears (-r) or fills the command path cache.
+ * - parsecache : Shows or clears (-r) the cache of parsed command lines.
+ * - enable     : Lists, turns on or off (-n), loads (-f) or unloads (-d)
+ *                builtins.
+ * - set        : Lists or sets shell variables.
+ * - export     : Lists, exports or sets and exports variables.
+ * - unset      : Removes variables, or functions (-f).
+ * - alias      : Lists or defines aliases; unalias removes them.
+ * - chunk      : Runs a command over an argument list too long for one
+ *                exec, in chunks.
+ * - break, continue and return : Leave a loop or a function.
+ * - echo, printf, true, false, test, [ and cat : Run in the shell, in
+ *                place of the programs of the same names.
  *
  * The shell also supports the notion of I/O redirection which
  * allows users to redirect stdin and stdout to disk files.
@@ -40,12 +58,57 @@
  * JIDs should be denoted on the command line by the prefix ‘%’.
  *
  * For example, “%5” denotes JID 5, and “5” denotes PID 5.
+ *
+ * When started with -e, the shell runs an event loop instead of relying
+ * on asynchronous signal handlers: SIGCHLD, SIGINT and SIGTSTP stay
+ * blocked and are read from a signalfd, which is multiplexed with stdin
+ * by epoll. The job list is then only ever updated synchronously, and
+ * background jobs are reported while the shell waits for input. The pidfd
+ * of every job is watched by the same epoll instance, so a job that exits
+ * is reaped directly through its pidfd.
+ *
+ * Commands without a slash are looked up in PATH through a cache that
+ * remembers every lookup; see the hash builtin.
+ *
+ * The for, while, until, if and case commands are parsed once into a tree
+ * of parsed pipelines, see ast.h, so a loop does not parse its body again
+ * on every iteration. Functions, name() { list; }, and aliases keep their
+ * bodies parsed the same way, and run in the shell as builtins do, see
+ * functions.h. A compound command may be redirected, as a builtin is, and
+ * piped, in which case each command of the pipeline runs in a subshell.
+ *
+ * Here-documents, <<word, and here-strings, <<<word, are read from a
+ * sealed memfd, see heredoc.h, so they never touch the file system.
+ *
+ * A command substitution, $(command), is read from a pipe while its job
+ * runs, or from memory for a command the shell runs itself, and becomes
+ * arguments of the command line it is in.
+ *
+ * A process substitution, <(command) or >(command), runs the command
+ * connected to a pipe whose other end the command line gets as a
+ * /dev/fd path. Its process is a member of the job of the command line,
+ * so ctrl-c and ctrl-z reach it, and the job is done once it exits too.
+ *
+ * Jobs are started with posix_spawn, which never copies the shell's address
+ * space. The -f option switches back to fork and execve, which is the path
+ * the fork() perturbation of the test build applies to.
  */
 
 #include "tsh_helper.h"
 #include "utilities.h"
 #include "sighandlers.h"
 #include "builtins.h"
+#include "pathcache.h"
+#include "linereader.h"
+#include "parsecache.h"
+#include "cmdlist.h"
+#include "expand.h"
+#include "vars.h"
+#include "ast.h"
+#include "functions.h"
+#include <sys/epoll.h>
+#include <spawn.h>
+#include <linux/memfd.h>
 
 /*
  * If DEBUG is defined, enable contracts and printing on dbg_printf.
@@ -66,7 +129,70 @@
 
 /* Function prototypes */
 void eval(const char *cmdline);
+void eval_pipeline(const char *cmdline);
+void exec_pipeline(const char *cmdline, struct cmdline_tokens *token,
+                   parseline_return parse_result, char **extra_args);
+void run_and_or(struct list_cmd *cmds, int ncmds, bool allow_bg);
+void run_list_job(struct list_cmd *cmds, int ncmds);
+pid_t fork_subshell_job(const char *cmdline);
+void exec_script(struct ast_node *list);
+void exec_and_or(struct ast_node *first, struct ast_node *last, bool allow_bg);
+void exec_node(struct ast_node *node, bool background);
+void assign_vars(struct cmd_stage *stage, parseline_return parse_result);
 void run(const char *cmdline, struct cmdline_tokens *token, parseline_return parse_result);
+int event_loop_main(bool emit_prompt);
+pid_t fork_job(struct cmd_stage *stage, const struct redir_plan *plan,
+               const char *path, int path_fd,
+               pid_t pgid, int read_fd, int write_fd);
+pid_t spawn_job(struct cmd_stage *stage, const struct redir_plan *plan,
+                const char *path, pid_t pgid, int read_fd, int write_fd);
+
+/* Epoll data of the event sources other than the pidfds of jobs */
+#define EVENT_STDIN     0           // Jobs use their PID as epoll data
+#define EVENT_SIGNALS   ((uint64_t) -1)
+
+/* The lines of a compound command that is not complete yet, or NULL */
+static char *pending_script = NULL;
+static size_t pending_len = 0;          // Bytes of pending_script used
+static size_t pending_size = 0;         // Bytes allocated for it
+
+/* The prompt for the continuation lines of a compound command */
+#define PENDING_PROMPT  "> "
+
+/* The operators of a list, spaced out, for the command lines of jobs */
+static const char *const list_op_text[] = {"", " ; ", " &", " && ", " || "};
+
+/* The bytes each read of the output of a command substitution asks for */
+#define CAPTURE_READ    65536
+
+/* The bytes of the /dev/fd path of a descriptor, with the NUL */
+#define FD_PATH_LEN     (sizeof("/dev/fd/") + 10)
+
+struct capture                  // The output of a command substitution
+{
+    int read_fd;                // The read end of its pipe
+    int write_fd;               // The write end, -1 once a job has it
+    char *buf;                  // The output so far, in command_arena
+    size_t len;                 // Bytes of output in buf
+    size_t size;                // Bytes allocated for buf
+};
+
+/* The substitution whose pipe run() gives the last command, or NULL */
+static struct capture *capture = NULL;
+
+struct helpers                  // The process substitutions of a pipeline
+{
+    const char *cmdline;        // The pipeline, which names their job
+    pid_t pgid;                 // Their job, 0 if none or once run() took it
+    pid_t *pids;                // Their processes
+    int *fds;                   // The shell's ends of their pipes, or -1
+    int n;                      // Entries used in pids and fds
+    int size;                   // Entries allocated in pids and fds
+    bool failed;                // A substitution could not be started
+};
+
+/* The process substitutions of the pipeline being expanded and run */
+static struct helpers helpers;
 
 /*
  *  Creates the job control mask and registers the signal handlers, then
@@ -78,15 +204,17 @@ int main(int argc, char **argv) {
     job_control_mask = create_mask(3, SIGINT, SIGCHLD, SIGTSTP);
 
     char c;
-    char cmdline[MAXLINE_TSH];  // Cmdline for fgets
+    char *cmdline;              // Cmdline, without its newline
+    struct line_reader reader;  // Reads the command lines from stdin
     bool emit_prompt = true;    // Emit prompt (default)
 
     // Redirect stderr to stdout (so that driver will get all output
     // on the pipe connected to stdout)
     Dup2(STDOUT_FILENO, STDERR_FILENO);
+    redir_init();
 
     // Parse the command line
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpef")) != EOF) {
         switch (c) {
             case 'h':                   // Prints help message
                 usage();
@@ -97,6 +225,12 @@ int main(int argc, char **argv) {
             case 'p':                   // Disables prompt printing
                 emit_prompt = false;
                 break;
+            case 'e':                   // Runs the signalfd/epoll event loop
+                event_loop = true;
+                break;
+            case 'f':                   // Launches jobs with fork and execve
+                fork_launch = true;
+                break;
             default:
                 usage();
         }
@@ -113,20 +247,116 @@ int main(int argc, char **argv) {
     Signal(SIGQUIT, sigquit_handler);
 
     // Initialize the job list
-    initjobs(job_list);
+    initjobs(&job_list);
+
+    // The environment becomes the exported shell variables
+    vars_init(environ);
+
+    // Use the widest vector instructions the CPU has to tokenize
+    scanner_init(SCAN_AUTO);
+
+    if (event_loop) {
+        return event_loop_main(emit_prompt);
+    }
 
     // Execute the shell's read/eval loop
+    reader_init(&reader, STDIN_FILENO);
     while (true) {
         if (emit_prompt) {
-            printf("%s", prompt);
+            printf("%s", pending_script != NULL ? PENDING_PROMPT : prompt);
+            fflush(stdout);
+        }
+
+        if ((cmdline = reader_getline(&reader, NULL)) == NULL) {
+            // End of file (ctrl-d)
+            printf("\n");
             fflush(stdout);
+            fflush(stderr);
+            return 0;
         }
 
-        if ((fgets(cmdline, MAXLINE_TSH, stdin) == NULL) && ferror(stdin)) {
-            app_error("fgets error");
+        // Evaluate the command line, then free everything it allocated
+        eval(cmdline);
+        arena_reset(&command_arena);
+
+        fflush(stdout);
+    }
+
+    return -1; // control never reaches here
+}
+
+/*
+ * Runs the shell's read/eval loop on an epoll instance that watches
+ * stdin and a signalfd for the job control signals.
+ *
+ * The job control signals stay blocked for the lifetime of the shell, so
+ * the job list is only updated from this loop and from wait_for_fg.
+ * Signals that arrive while the shell waits for input are handled right
+ * away, so background job notifications are not delayed until the next
+ * command line.
+ *
+ * @param emit_prompt if true, the prompt is printed before each command.
+ * @return the exit status code of the shell.
+ */
+int event_loop_main(bool emit_prompt) {
+    struct epoll_event event, events[16];
+    struct job_t *job;
+    char *cmdline;
+    bool stdin_pollable = true;
+    struct line_reader reader;
+    int n, i;
+
+    Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
+    if ((signal_fd = signalfd(-1, &job_control_mask, SFD_CLOEXEC)) < 0) {
+        unix_error("signalfd error");
+    }
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        unix_error("epoll_create1 error");
+    }
+
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_SIGNALS;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event) < 0) {
+        unix_error("epoll_ctl error");
+    }
+    event.data.u64 = EVENT_STDIN;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) < 0) {
+        if (errno != EPERM) {
+            unix_error("epoll_ctl error");
+        }
+        stdin_pollable = false;     // Regular files are always readable
+    }
+
+    reader_init(&reader, STDIN_FILENO);
+
+    while (true) {
+        if (emit_prompt) {
+            printf("%s", pending_script != NULL ? PENDING_PROMPT : prompt);
+            fflush(stdout);
         }
 
-        if (feof(stdin)) {
+        // Handle signals until a line can be read without blocking
+        bool stdin_ready = reader_has_line(&reader) || !stdin_pollable;
+        do {
+            n = epoll_wait(epoll_fd, events, 16, stdin_ready ? 0 : -1);
+            if (n < 0 && errno != EINTR) {
+                unix_error("epoll_wait error");
+            }
+            for (i = 0; i < n; i++) {
+                if (events[i].data.u64 == EVENT_SIGNALS) {
+                    dispatch_signals();
+                } else if (events[i].data.u64 == EVENT_STDIN) {
+                    // Take what is there; a partial line waits for more
+                    reader_fill(&reader);
+                    stdin_ready = reader_has_line(&reader);
+                } else if ((job = getjobpid(&job_list, events[i].data.u64))) {
+                    reap_job(job);      // The pidfd of a job is readable
+                }
+            }
+            fflush(stdout);
+        } while (!stdin_ready);
+
+        if ((cmdline = reader_getline(&reader, NULL)) == NULL) {
             // End of file (ctrl-d)
             printf("\n");
             fflush(stdout);
@@ -134,16 +364,31 @@ int main(int argc, char **argv) {
             return 0;
         }
 
-        // Remove the trailing newline
-        cmdline[strlen(cmdline) - 1] = '\0';
-
-        // Evaluate the command line
+        // Evaluate the command line, then free everything it allocated
         eval(cmdline);
+        arena_reset(&command_arena);
 
         fflush(stdout);
     }
+}
 
-    return -1; // control never reaches here
+/*
+ * Adds a line to the lines of the command that is not complete yet,
+ * growing them in place, so a long here-document is not copied on every
+ * line.
+ */
+static void add_pending(const char *line) {
+    size_t len = strlen(line);
+
+    if (pending_len + len + 2 > pending_size) {
+        pending_size = 2 * (pending_len + len + 2);
+        pending_script = Realloc(pending_script, pending_size);
+    }
+    if (pending_len > 0) {
+        pending_script[pending_len++] = '\n';
+    }
+    memcpy(pending_script + pending_len, line, len + 1);
+    pending_len += len;
 }
 
 /*
@@ -151,60 +396,1282 @@ int main(int argc, char **argv) {
  * built-in command, or creates an appropriate foreground
  * or background job.
  *
+ * The line may be a list of pipelines joined by ;, &, && and ||, which
+ * run in order. The pipeline after && runs only if the one before it
+ * succeeded, and after || only if it failed; pipelines that are skipped
+ * are not parsed or forked. A pipeline, or an and-or list of them, that
+ * ends with & runs as one background job.
+ *
+ * A line with a for, while, until, if or case command is parsed as a
+ * script instead, see exec_script. If the line ends inside such a command,
+ * or before the body of a here-document ends, it is kept, and the lines
+ * after it are added to it until it is complete.
+ *
  * @param cmdline the command line as entered in the shell.
  * @return void.
  */
 void eval(const char *cmdline) {
-    parseline_return parse_result;
+    struct list_cmd *cmds;
+    struct ast_node *script;
+    int ncmds, first, last;
+    const char *line;
+
+    interrupted = false;
+    if (pending_script != NULL) {
+        add_pending(cmdline);
+
+        // A line that cannot end the body of a here-document only adds to it
+        if (heredoc_waiting(cmdline)) {
+            return;
+        }
+        cmdline = arena_strndup(&command_arena, pending_script, pending_len);
+        Free(pending_script);
+        pending_script = NULL;
+        pending_len = pending_size = 0;
+    }
+
+    // The bodies of here-documents go into the words of their <<
+    if ((line = heredoc_gather(cmdline)) == NULL) {
+        add_pending(cmdline);
+        return;
+    }
+
+    if (ast_wanted(line)) {
+        switch (ast_parse(line, &script)) {
+            case AST_INCOMPLETE:
+                add_pending(cmdline);
+                return;
+            case AST_ERROR:
+                last_status = 2;
+                return;
+            case AST_OK:
+                exec_script(script);
+                return;
+        }
+    }
+
+    if ((ncmds = split_list(line, &cmds)) < 0) {
+        last_status = 2;
+        return;
+    }
+
+    // A plain command keeps the line as typed, which names its job
+    if (ncmds == 1 && cmds[0].op == LIST_END) {
+        eval_pipeline(line);
+        return;
+    }
+
+    for (first = 0; first < ncmds; first = last + 1) {
+        for (last = first; cmds[last].op == LIST_AND ||
+                           cmds[last].op == LIST_OR; last++);
+        if (cmds[last].op == LIST_BG && last > first) {
+            run_list_job(&cmds[first], last - first + 1);
+        } else {
+            run_and_or(&cmds[first], last - first + 1, true);
+        }
+    }
+}
+
+/*
+ * Runs the pipelines of an and-or list in order, skipping those that the
+ * status of the pipeline before them rules out.
+ *
+ * @param cmds the pipelines; the operators after all but the last are
+ *        && or ||.
+ * @param ncmds the number of pipelines.
+ * @param allow_bg true to run the last pipeline in the background if & ends
+ *        it, false to run it in the foreground.
+ * @return void
+ */
+void run_and_or(struct list_cmd *cmds, int ncmds, bool allow_bg) {
+    char *text;
+    int i;
+
+    for (i = 0; i < ncmds; i++) {
+        if (i > 0 && (cmds[i - 1].op == LIST_AND) != (last_status == 0)) {
+            continue;
+        }
+        text = cmds[i].text;
+        if (allow_bg && cmds[i].op == LIST_BG) {
+            text = arena_alloc(&command_arena, strlen(cmds[i].text) + 3);
+            sprintf(text, "%s &", cmds[i].text);
+        }
+        eval_pipeline(text);
+    }
+}
+
+/*
+ * Runs an and-or list ending with & as one background job: a child of the
+ * shell, in its own process group, that runs the pipelines of the list in
+ * the foreground of that group and exits with the status of the list.
+ *
+ * @param cmds the pipelines of the list.
+ * @param ncmds the number of pipelines.
+ * @return void
+ */
+void run_list_job(struct list_cmd *cmds, int ncmds) {
+    size_t len = 0;
+    char *cmdline;
+    int i;
+
+    // The command line of the job, with the operators spaced out
+    for (i = 0; i < ncmds; i++) {
+        len += strlen(cmds[i].text) + strlen(list_op_text[cmds[i].op]);
+    }
+    cmdline = arena_alloc(&command_arena, len + 1);
+    for (i = 0, len = 0; i < ncmds; i++) {
+        len += sprintf(cmdline + len, "%s%s", cmds[i].text,
+                       list_op_text[cmds[i].op]);
+    }
+
+    if (fork_subshell_job(cmdline) == 0) {
+        run_and_or(cmds, ncmds, false);
+        fflush(stdout);
+        _exit(last_status);
+    }
+}
+
+/*
+ * Forks the subshell of a background job that the shell runs commands in
+ * itself: a child of the shell, in its own process group, that runs the
+ * commands of the job in the foreground of that group, and exits with
+ * their status. The shell adds the job, prints its notification and sets
+ * $? to 0.
+ *
+ * @param cmdline the command line of the job.
+ * @return 0 in the child, and the process id of the child in the shell.
+ */
+pid_t fork_subshell_job(const char *cmdline) {
+    pid_t pid;
+
+    block_job_signals(NULL);
+    fflush(stdout);
+    if ((pid = Fork()) == 0) {
+        Setpgid(0, 0);
+        subshell = true;
+        event_loop = false;
+        capture = NULL;
+        restore_signal_defaults(3, SIGINT, SIGTSTP, SIGCHLD);
+        Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+        return 0;
+    }
+
+    setpgid(pid, pid);
+    addjob(&job_list, pid, BG, cmdline);
+    watch_job(getjobpid(&job_list, pid));
+    printf("[%d] (%d) %s\n", pid2jid(&job_list, pid), pid, cmdline);
+    unblock_job_signals();
+    last_status = 0;
+    return pid;
+}
+
+/* The last command of the alias that runs, and the arguments it takes */
+static struct ast_node *alias_node = NULL;
+static char **alias_args = NULL;
+
+/*
+ * Checks whether the rest of a list is skipped, after a break, continue
+ * or return, or once the command line was interrupted.
+ */
+static bool script_stopped(void) {
+    return loop_breaks > 0 || loop_continues > 0 || returning || interrupted;
+}
+
+/*
+ * Runs a script parsed by ast_parse: the and-or lists of its list in
+ * order, as eval runs those of a command line. An and-or list ending with
+ * & that has more than one command, or a compound command, runs as one
+ * background job in a subshell; a pipeline is a background job itself.
+ *
+ * The list stops early after a break, continue or return, and once the
+ * command line was interrupted.
+ *
+ * @param list the first node of the list.
+ * @return void
+ */
+void exec_script(struct ast_node *list) {
+    struct ast_node *first, *last, *node;
+    size_t len = 0;
+    char *cmdline;
+
+    for (first = list; first != NULL; first = last->next) {
+        for (last = first; last->op == LIST_AND || last->op == LIST_OR;
+             last = last->next);
+
+        if (last->op != LIST_BG || (last == first &&
+                                    (first->type == NODE_PIPELINE ||
+                                     first->type == NODE_PIPE))) {
+            exec_and_or(first, last, true);
+        } else {
+            for (node = first; node != last->next; node = node->next) {
+                len += strlen(node->text) + strlen(list_op_text[node->op]);
+            }
+            cmdline = arena_alloc(&command_arena, len + 1);
+            for (node = first, len = 0; node != last->next; node = node->next) {
+                len += sprintf(cmdline + len, "%s%s", node->text,
+                               list_op_text[node->op]);
+            }
+            if (fork_subshell_job(cmdline) == 0) {
+                exec_and_or(first, last, false);
+                fflush(stdout);
+                _exit(last_status);
+            }
+        }
+
+        if (script_stopped()) {
+            break;
+        }
+    }
+}
+
+/*
+ * Runs the commands of an and-or list of a script in order, skipping
+ * those that the status of the command before them rules out.
+ *
+ * @param first the first command of the list.
+ * @param last the last command; the operators before it are && or ||.
+ * @param allow_bg true to run the last command in the background if &
+ *        ends it, false to run it in the foreground.
+ * @return void
+ */
+void exec_and_or(struct ast_node *first, struct ast_node *last, bool allow_bg) {
+    struct ast_node *node, *prev = NULL;
+
+    for (node = first; prev != last; prev = node, node = node->next) {
+        if (prev != NULL && (prev->op == LIST_AND) != (last_status == 0)) {
+            continue;
+        }
+        exec_node(node, allow_bg && node->op == LIST_BG);
+        if (script_stopped()) {
+            return;
+        }
+    }
+}
+
+/*
+ * Decides whether a loop ends after its test or body ran: after a break,
+ * a continue of an outer loop, a return, or an interrupt, including a command that
+ * SIGINT terminated. Takes one loop off a pending break or continue.
+ *
+ * @return true if the loop ends.
+ */
+static bool loop_done(void) {
+    if (returning) {
+        return true;
+    }
+    if (loop_breaks > 0) {
+        loop_breaks--;
+        return true;
+    }
+    if (loop_continues > 0 && --loop_continues > 0) {
+        return true;
+    }
+    return script_interrupted() || last_status == 128 + SIGINT;
+}
+
+/*
+ * Runs a for loop: its words are expanded once, then the variable is set
+ * to each in turn and the body is run. Whatever an iteration allocates
+ * is freed before the next one. An interrupted loop has status 130.
+ *
+ * @param node the loop.
+ * @return void
+ */
+static void exec_for(struct ast_node *node) {
+    struct cmdline_tokens token;
+    struct arena_mark mark;
+    char **words, *assign;
+    int i, status = 0;
+
+    ast_load_tokens(&node->tokens, &token);
+    expand_words(&token);
+    words = token.stages[0].argv;     // for name in word...
+
+    loop_depth++;
+    for (i = 3; i < token.stages[0].argc; i++) {
+        mark = arena_save(&command_arena);
+        assign = arena_alloc(&command_arena,
+                             strlen(words[1]) + strlen(words[i]) + 2);
+        sprintf(assign, "%s=%s", words[1], words[i]);
+        var_set(assign, false);
+
+        exec_script(node->body);
+        status = last_status;
+        arena_release(&command_arena, mark);
+        if (loop_done()) {
+            break;
+        }
+    }
+    loop_depth--;
+    last_status = interrupted ? 128 + SIGINT : status;
+}
+
+/*
+ * Runs a while or until loop: the body runs as long as the test succeeds,
+ * or fails for until. Whatever an iteration allocates is freed before the
+ * next one. An interrupted loop has status 130.
+ *
+ * @param node the loop.
+ * @return void
+ */
+static void exec_loop(struct ast_node *node) {
+    struct arena_mark mark;
+    int status = 0;
+
+    loop_depth++;
+    while (true) {
+        mark = arena_save(&command_arena);
+        exec_script(node->cond);
+        if (loop_done() || (last_status == 0) != (node->type == NODE_WHILE)) {
+            arena_release(&command_arena, mark);
+            break;
+        }
+
+        exec_script(node->body);
+        status = last_status;
+        arena_release(&command_arena, mark);
+        if (loop_done()) {
+            break;
+        }
+    }
+    loop_depth--;
+    last_status = interrupted ? 128 + SIGINT : status;
+}
+
+/*
+ * Runs a case command: the body of the first item with a pattern that
+ * matches the word. Quoted patterns match literally.
+ *
+ * @param node the case command.
+ * @return void
+ */
+static void exec_case(struct ast_node *node) {
+    const char *word = node->quote == '\'' ? node->word
+                                           : expand_parameters(node->word);
+    const char *pattern;
+    struct case_item *item;
+    int i;
+
+    for (item = node->items; item != NULL; item = item->next) {
+        for (i = 0; i < item->npatterns; i++) {
+            pattern = item->patterns[i];
+            if (item->quotes[i] != '\'') {
+                pattern = expand_parameters(pattern);
+            }
+            if (item->quotes[i] != 0 ? strcmp(pattern, word) == 0
+                                     : fnmatch(pattern, word, 0) == 0) {
+                last_status = 0;
+                exec_script(item->body);
+                return;
+            }
+        }
+    }
+    last_status = 0;
+}
+
+/*
+ * Runs a pipeline with a compound command in it, a NODE_PIPE, as one job:
+ * each of its commands runs in a subshell of its own, a child of the
+ * shell in the process group of the job, connected to the next one by a
+ * pipe, as run() connects the commands of a pipeline.
+ *
+ * If a pipe cannot be made, an error is printed, the commands already
+ * started are killed and reaped, and $? is set to 1. Otherwise $? is the
+ * status of the last command, or 0 for a background job.
+ *
+ * @param node the pipeline.
+ * @param background true to run it in the background.
+ * @return void
+ */
+static void exec_pipe(struct ast_node *node, bool background) {
+    struct ast_node *stage;
+    int i, nstages = 0, nrun, pipe_fds[2], read_fd = -1, write_fd, status;
+    pid_t pid, pgid = 0, *pids;
+    struct job_t *job;
+    sigset_t old_mask;
+    char *text = node->text;
+
+    for (stage = node->body; stage != NULL; stage = stage->next) {
+        nstages++;
+    }
+    pids = arena_alloc(&command_arena, nstages * sizeof(pid_t));
+    if (background) {   // The job is listed with its &
+        text = arena_alloc(&command_arena, strlen(node->text) + 3);
+        sprintf(text, "%s &", node->text);
+    }
+    if (subshell) {
+        pgid = getpgrp();
+    }
+
+    block_job_signals(&old_mask);
+    for (i = 0, stage = node->body; stage != NULL; i++, stage = stage->next) {
+        write_fd = -1;
+        if (stage->next != NULL) {
+            if (syscall(SYS_pipe2, pipe_fds, O_CLOEXEC) < 0) {
+                // Out of descriptors, the pipeline fails rather than the shell
+                fprintf(stderr, "pipe error: %s\n", strerror(errno));
+                break;
+            }
+            write_fd = pipe_fds[1];
+        }
+
+        fflush(stdout);
+        if ((pid = Fork()) == 0) {
+            Setpgid(0, pgid);
+            subshell = true;
+            event_loop = false;
+            capture = NULL;
+            restore_signal_defaults(3, SIGINT, SIGTSTP, SIGCHLD);
+            Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+
+            // Its builtins never exec, so it keeps no other pipe end
+            if (read_fd >= 0) {
+                Dup2(read_fd, STDIN_FILENO);
+                close(read_fd);
+            }
+            if (write_fd >= 0) {
+                Dup2(write_fd, STDOUT_FILENO);
+                close(write_fd);
+                close(pipe_fds[0]);
+            }
+            exec_node(stage, false);
+            fflush(stdout);
+            _exit(last_status);
+        }
+        setpgid(pid, pgid ? pgid : pid);
+
+        if (read_fd >= 0) {
+            close(read_fd);
+        }
+        if (write_fd >= 0) {
+            close(write_fd);
+        }
+        read_fd = stage->next != NULL ? pipe_fds[0] : -1;
+
+        pids[i] = pid;
+        if (subshell) {
+            continue;
+        }
+        if (pgid == 0) {
+            pgid = pid;
+            addjob(&job_list, pid, background ? BG : FG, text);
+        } else {
+            addjobproc(&job_list, getjobpid(&job_list, pgid), pid);
+        }
+    }
+
+    // The commands after a pipe that could not be made are not started
+    nrun = i;
+    if (nrun < nstages && read_fd >= 0) {
+        close(read_fd);
+    }
+
+    if (subshell) {
+        for (i = 0; i < nrun && nrun < nstages; i++) {
+            kill(pids[i], SIGKILL);
+        }
+        for (i = 0; i < nrun; i++) {
+            last_status = waitpid(pids[i], &status, 0) > 0
+                          ? wait_status_code(status) : 127;
+        }
+        if (nrun < nstages) {
+            last_status = 1;
+        }
+        unblock_job_signals();
+        return;
+    }
+
+    if (nrun == 0) {
+        last_status = 1;
+        unblock_job_signals();
+        return;
+    }
+    watch_job(job = getjobpid(&job_list, pgid));
+    if (nrun < nstages) {
+        // Kill the commands already started and reap them
+        signal_job(job, SIGKILL);
+        setjobstate(&job_list, job, FG);
+        wait_for_fg(&old_mask);
+        last_status = 1;
+    } else if (background) {
+        printf("[%d] (%d) %s\n", pid2jid(&job_list, pgid), pgid, text);
+        last_status = 0;
+    } else {
+        wait_for_fg(&old_mask);
+    }
+    unblock_job_signals();
+}
+
+/*
+ * Runs one command of a script, with no redirections of its own.
+ *
+ * @param node the command.
+ * @param background true to run a pipeline in the background.
+ * @return void
+ */
+static void exec_command(struct ast_node *node, bool background) {
+    struct cmdline_tokens token;
+    char *text;
+
+    switch (node->type) {
+        case NODE_PIPELINE:
+            text = node->text;
+            if (background) {   // The job is listed with its &
+                text = arena_alloc(&command_arena, strlen(node->text) + 3);
+                sprintf(text, "%s &", node->text);
+            }
+            // Checked before each command, as the one before may enable,
+            // disable, load, unload or define what it names
+            if (node->generation != ast_generation) {
+                exec_pipeline(text, &token, parseline_cached(text, &token),
+                              node == alias_node ? alias_args : NULL);
+                break;
+            }
+            ast_load_tokens(&node->tokens, &token);
+            exec_pipeline(text, &token,
+                          background ? parseline_background(&token)
+                                     : PARSELINE_FG,
+                          node == alias_node ? alias_args : NULL);
+            break;
+        case NODE_FOR:
+            exec_for(node);
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            exec_loop(node);
+            break;
+        case NODE_IF:
+            exec_script(node->cond);
+            if (script_stopped()) {
+                break;
+            }
+            if (last_status == 0) {
+                exec_script(node->body);
+            } else if (node->else_part != NULL) {
+                exec_script(node->else_part);
+            } else {
+                last_status = 0;
+            }
+            break;
+        case NODE_CASE:
+            exec_case(node);
+            break;
+        case NODE_GROUP:
+            exec_script(node->body);
+            break;
+        case NODE_FUNCTION:
+            last_status = function_define(node->word, node->body->text) ? 0 : 1;
+            break;
+        case NODE_PIPE:
+            exec_pipe(node, background);
+            break;
+    }
+}
+
+
+static void finish_helpers(void);
+
+/*
+ * Runs one command of a script.
+ *
+ * A pipeline runs from the tokens parsed with the script, so only its
+ * words are expanded each time it runs, unless ast_generation changed
+ * since it was parsed, when it is parsed again from its text. A pipeline
+ * in the background runs from the same tokens, with its builtin moved to
+ * a subshell if it has one.
+ *
+ * The redirections after a compound command are expanded and applied to
+ * the shell itself, as those of a builtin are, for as long as it runs. If
+ * one fails, the command does not run and $? is set to 1.
+ *
+ * @param node the command.
+ * @param background true to run a pipeline in the background.
+ * @return void
+ */
+void exec_node(struct ast_node *node, bool background) {
+    struct helpers saved = helpers;
+    struct cmdline_tokens token;
+    struct redir_plan plan;
+    int fd_mark;
+
+    if (node->redirs == NULL) {
+        exec_command(node, background);
+        return;
+    }
+
+    // Their process substitutions are waited for once the command ran
+    memset(&helpers, 0, sizeof(struct helpers));
+    helpers.cmdline = node->text;
+    ast_load_tokens(node->redirs, &token);
+    expand_words(&token);
+    if (helpers.failed || !plan_redirections(&token.stages[0], &plan) ||
+        (fd_mark = redirect_shell(&plan)) < 0) {
+        last_status = 1;
+    } else {
+        exec_command(node, background);
+        restore_fds(fd_mark);
+    }
+    finish_helpers();
+    helpers = saved;
+}
+
+/*
+ * Runs the body of a function or alias in the shell, with the arguments
+ * as $1 to $9 for a function, and added to the last command of its body
+ * for an alias, if that is a pipeline. A break or continue in a function
+ * does not reach the loops around the call.
+ *
+ * @param builtin a builtin state from def_lookup.
+ * @param argc the number of arguments.
+ * @param argv the arguments, argv[0] naming the definition.
+ * @return the status of the body.
+ */
+int def_run(builtin_state builtin, int argc, char **argv) {
+    struct ast_node *body, *saved_node = alias_node;
+    char **saved_args = alias_args, **saved_argv = script_argv;
+    int kind, saved_argc = script_argc, saved_depth = loop_depth;
+
+    if ((body = def_enter(builtin, &kind)) == NULL && kind < 0) {
+        return 1;
+    }
+
+    last_status = 0;
+    if (kind == DEF_ALIAS) {
+        for (alias_node = body; alias_node != NULL && alias_node->next != NULL;
+             alias_node = alias_node->next);
+        alias_args = argv + 1;
+        exec_script(body);
+    } else {
+        script_argc = argc - 1;
+        script_argv = argv + 1;
+        loop_depth = 0;
+        exec_script(body);
+        loop_depth = saved_depth;
+        loop_breaks = 0;
+        loop_continues = 0;
+        returning = false;
+        script_argc = saved_argc;
+        script_argv = saved_argv;
+    }
+    alias_node = saved_node;
+    alias_args = saved_args;
+
+    def_leave();
+    return last_status;
+}
+
+/*
+ * Parses one pipeline and executes it, as a built-in command or as a
+ * foreground or background job, setting $? to its status.
+ *
+ * @param cmdline the pipeline.
+ * @return void.
+ */
+void eval_pipeline(const char *cmdline) {
     struct cmdline_tokens token;
 
-    // Parse command line
-    parse_result = parseline(cmdline, &token);
+    exec_pipeline(cmdline, &token, parseline_cached(cmdline, &token), NULL);
+}
+
+/*
+ * Adds arguments, already expanded, to the last command of a pipeline.
+ *
+ * @param token the tokens of the pipeline.
+ * @param extra_args the arguments, NULL terminated.
+ * @return void
+ */
+static void add_arguments(struct cmdline_tokens *token, char **extra_args) {
+    struct cmd_stage *stage = &token->stages[token->nstages - 1];
+    int n, nwords = stage->nassigns + stage->argc;
+    char **words;
+
+    for (n = 0; extra_args[n] != NULL; n++);
+    words = arena_alloc(&command_arena, (nwords + n + 1) * sizeof(char *));
+    memcpy(words, stage->argv - stage->nassigns, nwords * sizeof(char *));
+    memcpy(words + nwords, extra_args, (n + 1) * sizeof(char *));
+    stage->argv = words + stage->nassigns;
+    stage->argc += n;
+    token->argc = token->stages[0].argc;
+}
+
+/*
+ * Starts the command of a process substitution of the pipeline being
+ * expanded, in a subshell whose standard output, for <(command), or
+ * standard input, for >(command), is one end of a pipe. The shell keeps
+ * the other end, above REDIR_MIN_FD and open across exec, until the jobs
+ * of the pipeline are started.
+ *
+ * The subshells of a pipeline form one background job, which run() makes
+ * the job of the pipeline, so they are signalled and reaped with it. In
+ * the subshell of a background list they join its process group instead.
+ *
+ * @param cmdline the command, the text between <( or >( and ).
+ * @param output true for >(command), which reads what is written to the
+ *        path, false for <(command), whose output is read from it.
+ * @return the /dev/fd path of the shell's end, in command_arena, or "" after
+ *         printing an error if no pipe could be made, which fails the
+ *         pipeline.
+ */
+char *process_subst(const char *cmdline, bool output) {
+    int fds[2], fd, i;
+    pid_t pid, pgid;
+    char *path;
+
+    if (helpers.n == helpers.size) {
+        helpers.pids = arena_grow(&command_arena, helpers.pids,
+                                  helpers.size * sizeof(pid_t),
+                                  (2 * helpers.size + 2) * sizeof(pid_t));
+        helpers.fds = arena_grow(&command_arena, helpers.fds,
+                                 helpers.size * sizeof(int),
+                                 (2 * helpers.size + 2) * sizeof(int));
+        helpers.size = 2 * helpers.size + 2;
+    }
+
+    // Out of descriptors, the pipeline fails rather than the shell
+    if (helpers.failed) {
+        return "";
+    }
+    fds[0] = fds[1] = -1;
+    if (syscall(SYS_pipe2, fds, O_CLOEXEC) < 0 ||
+        (fd = fcntl(fds[output ? 1 : 0], F_DUPFD, REDIR_MIN_FD)) < 0) {
+        fprintf(stderr, "%s: %s\n", fds[0] < 0 ? "pipe error" : "fcntl error",
+                strerror(errno));
+        if (fds[0] >= 0) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        helpers.failed = true;
+        return "";
+    }
+    close(fds[output ? 1 : 0]);
+
+    block_job_signals(NULL);
+    if (!subshell && helpers.pgid != 0 &&
+        getjobpid(&job_list, helpers.pgid) == NULL) {
+        helpers.pgid = 0;       // The job is done already, start another
+    }
+    pgid = subshell ? getpgrp() : helpers.pgid;
+    fflush(stdout);
+    if ((pid = Fork()) == 0) {
+        Setpgid(0, pgid);
+        subshell = true;
+        event_loop = false;
+        capture = NULL;
+        for (i = 0; i < helpers.n; i++) {
+            if (helpers.fds[i] >= 0) {
+                close(helpers.fds[i]);
+            }
+        }
+        restore_signal_defaults(3, SIGINT, SIGTSTP, SIGCHLD);
+        Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+        Dup2(fds[output ? 0 : 1], output ? STDIN_FILENO : STDOUT_FILENO);
+        close(fds[output ? 0 : 1]);
+        close(fd);
+        eval(cmdline);
+        fflush(stdout);
+        _exit(last_status);
+    }
+    setpgid(pid, pgid ? pgid : pid);
+    close(fds[output ? 0 : 1]);
+
+    helpers.pids[helpers.n] = pid;
+    helpers.fds[helpers.n++] = fd;
+    if (!subshell && helpers.pgid == 0) {
+        helpers.pgid = pid;
+        addjob(&job_list, pid, BG, helpers.cmdline);
+    } else if (!subshell) {
+        addjobproc(&job_list, getjobpid(&job_list, helpers.pgid), pid);
+    }
+    unblock_job_signals();
+
+    path = arena_alloc(&command_arena, FD_PATH_LEN);
+    sprintf(path, "/dev/fd/%d", fd);
+    return path;
+}
+
+/*
+ * Closes the ends of the pipes of the process substitutions the shell
+ * still has, so their commands see the end of their input.
+ */
+static void close_helpers(void) {
+    int i;
+
+    for (i = 0; i < helpers.n; i++) {
+        if (helpers.fds[i] >= 0) {
+            close(helpers.fds[i]);
+            helpers.fds[i] = -1;
+        }
+    }
+}
+
+/*
+ * Waits for the process substitutions of a pipeline once it ran, if run()
+ * did not make their job the job of the pipeline, as for a builtin or a
+ * pipeline none of whose commands started. Their job is waited for as a
+ * foreground job then, and $? is left as the pipeline set it.
+ */
+static void finish_helpers(void) {
+    int i, status, saved_status = last_status;
+    struct job_t *job;
+    sigset_t old_mask;
+
+    close_helpers();
+    if (subshell) {
+        for (i = 0; i < helpers.n; i++) {
+            waitpid(helpers.pids[i], &status, 0);
+        }
+    } else if (helpers.pgid != 0) {
+        block_job_signals(&old_mask);
+        if ((job = getjobpid(&job_list, helpers.pgid)) != NULL) {
+            setjobstate(&job_list, job, FG);
+            wait_for_fg(&old_mask);
+        }
+        unblock_job_signals();
+    }
+    last_status = saved_status;
+}
+
+/*
+ * Expands the words of a parsed pipeline and executes it, as a built-in
+ * command or as a foreground or background job, setting $? to its status.
+ *
+ * @param cmdline the pipeline, which names its job.
+ * @param token the tokens parsed from the pipeline.
+ * @param parse_result the parse result returned from the parseline call.
+ * @param extra_args arguments added to its last command after expansion,
+ *        those of an alias, or NULL.
+ * @return void.
+ */
+void exec_pipeline(const char *cmdline, struct cmdline_tokens *token,
+                   parseline_return parse_result, char **extra_args) {
+    struct helpers saved = helpers;
+    struct redir_plan plan;
+    int fd_mark = -1;
 
     switch (parse_result) {
         case PARSELINE_EMPTY:
+            return;
         case PARSELINE_ERROR:
+            last_status = 2;
             return;
         case PARSELINE_BG:
         case PARSELINE_FG:
-            // I/O Redirection for built-in commands.
-            if (token.builtin != BUILTIN_NONE) {
-                if (token.infile) {
-                    redirect_io(STDIN_FILENO, token.infile);
-                }
-                if (token.outfile) {
-                    redirect_io(STDOUT_FILENO, token.outfile);
-                }
+            // A pipeline run by a substitution has substitutions of its own
+            memset(&helpers, 0, sizeof(struct helpers));
+            helpers.cmdline = cmdline;
+            expand_words(token);
+            if (extra_args != NULL) {
+                add_arguments(token, extra_args);
             }
 
-            switch (token.builtin) {
-                case BUILTIN_QUIT:
-                    quit();
-                case BUILTIN_FG:
-                    fg(&token);
-                    break;
-                case BUILTIN_BG:
-                    bg(&token);
-                    break;
-                case BUILTIN_JOBS:
-                    jobs();
-                    break;
-                case BUILTIN_NONE:
-                    run(cmdline, &token, parse_result);
-                    break;
-            }
+            // I/O Redirection for built-in commands. A process
+            // substitution that could not be started fails the pipeline.
+            if (helpers.failed ||
+                (token->builtin != BUILTIN_NONE &&
+                 (!plan_redirections(&token->stages[0], &plan) ||
+                  (fd_mark = redirect_shell(&plan)) < 0))) {
+                last_status = 1;
+            } else if (token->nstages == 1 && token->argc == 0) {
+                assign_vars(&token->stages[0], parse_result);
+            } else if (token->builtin == BUILTIN_NONE) {
+                run(cmdline, token, parse_result);
+            } else {
+                last_status = run_builtin(token->builtin, token->argc,
+                                          token->stages[0].argv);
 
-            // Reset standard I/O for the shell
-            if (token.builtin != BUILTIN_NONE) {
-                set_std_io();
+                // Reset standard I/O for the shell
+                restore_fds(fd_mark);
             }
+
+            finish_helpers();
+            helpers = saved;
             break;
     }
     return;
 }
 
 /*
- * Forks and executes a child process based on the parsed command line.
+ * Reads the pipe of a command substitution to its end, while its job runs,
+ * with reads of at least CAPTURE_READ bytes into a buffer that doubles as
+ * it fills. The job control signals are handled meanwhile, from signal_fd
+ * in event loop mode and by the handlers otherwise, so ctrl-c reaches the
+ * job. Reading stops early if the job is stopped.
+ *
+ * @param cap the substitution.
+ * @param pgid the process group of its job, or 0 in a subshell.
+ * @param old_mask the mask to install while reading.
+ */
+static void read_capture(struct capture *cap, pid_t pgid,
+                         const sigset_t *old_mask) {
+    struct pollfd fds[2];
+    struct job_t *job;
+    bool stopped;
+    sigset_t mask;
+    ssize_t n;
+
+    fds[0].fd = cap->read_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = signal_fd;
+    fds[1].events = POLLIN;
+    if (!event_loop) {
+        Sigprocmask(SIG_SETMASK, old_mask, &mask);
+    }
+
+    while (true) {
+        if (cap->size - cap->len < CAPTURE_READ) {
+            cap->buf = arena_grow(&command_arena, cap->buf, cap->size,
+                                  2 * cap->size + CAPTURE_READ);
+            cap->size = 2 * cap->size + CAPTURE_READ;
+        }
+        if (poll(fds, event_loop ? 2 : 1, -1) < 0) {
+            if (errno != EINTR) {
+                unix_error("poll error");
+            }
+        } else {
+            if (event_loop && fds[1].revents) {
+                dispatch_signals();
+            }
+            if (fds[0].revents) {
+                if ((n = read(cap->read_fd, cap->buf + cap->len,
+                              cap->size - cap->len)) <= 0) {
+                    break;
+                }
+                cap->len += n;
+                continue;
+            }
+        }
+        if (pgid == 0) {
+            continue;
+        }
+        if (!event_loop) {
+            Sigprocmask(SIG_BLOCK, &job_control_mask, NULL);
+        }
+        stopped = (job = getjobpid(&job_list, pgid)) != NULL &&
+                  job->state == ST;
+        if (!event_loop) {
+            Sigprocmask(SIG_SETMASK, old_mask, NULL);
+        }
+        if (stopped) {
+            break;
+        }
+    }
+
+    if (!event_loop) {
+        Sigprocmask(SIG_SETMASK, &mask, NULL);
+    }
+}
+
+/*
+ * Runs a command substitution that is a command the shell runs itself, a
+ * builtin, function or alias, with standard output on a memfd for as long
+ * as it runs. The output is then read back from the memfd in one read, so
+ * it takes no fork and no pipe.
+ *
+ * @param cmdline the command.
+ * @param token the tokens parsed from it.
+ * @param len receives the length of the output.
+ * @return the output, in command_arena.
+ */
+static char *capture_builtin(const char *cmdline, struct cmdline_tokens *token,
+                             size_t *len) {
+    struct capture *saved = capture;
+    int mark = fd_stack_mark(), fd;
+    struct stat st;
+    ssize_t n;
+    char *buf;
+
+    fflush(stdout);
+    if ((fd = syscall(SYS_memfd_create, "tsh-subst", MFD_CLOEXEC)) < 0 ||
+        !save_fd(STDOUT_FILENO)) {
+        fprintf(stderr, "$(%s): %s\n", cmdline, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        last_status = 1;
+        *len = 0;
+        return "";
+    }
+    dup2(fd, STDOUT_FILENO);
+
+    // Pipelines run by a function write to the memfd as well
+    capture = NULL;
+    exec_pipeline(cmdline, token, PARSELINE_FG, NULL);
+    capture = saved;
+    restore_fds(mark);
+
+    fstat(fd, &st);
+    buf = arena_alloc(&command_arena, st.st_size + 1);
+    n = pread(fd, buf, st.st_size, 0);
+    *len = n > 0 ? n : 0;
+    close(fd);
+    return buf;
+}
+
+/*
+ * Runs the command of a command substitution and returns its output, less
+ * the newlines at its end.
+ *
+ * A command the shell runs itself writes straight to memory, see
+ * capture_builtin. A pipeline runs through run() as a foreground job whose
+ * last command writes to a pipe, and any other command line, a list or a
+ * compound command, in a subshell job that writes to the pipe. The shell
+ * reads the pipe into a buffer in command_arena while the job runs, and
+ * then waits for the job, which sets $?.
+ *
+ * @param cmdline the command, the text between $( and ).
+ * @param len receives the length of the output.
+ * @return the output, in command_arena.
+ */
+char *capture_output(const char *cmdline, size_t *len) {
+    struct capture cap, *saved = capture;
+    struct cmdline_tokens token;
+    parseline_return result = PARSELINE_BG;
+    struct list_cmd *cmds;
+    sigset_t old_mask;
+    pid_t pid, pgid;
+    int fds[2], status;
+    char *buf;
+
+    if (!ast_wanted(cmdline) && split_list(cmdline, &cmds) == 1 &&
+        cmds[0].op == LIST_END) {
+        result = parseline_cached(cmdline, &token);
+    }
+
+    if (result == PARSELINE_EMPTY || result == PARSELINE_ERROR) {
+        last_status = result == PARSELINE_EMPTY ? 0 : 2;
+        *len = 0;
+        return "";
+    }
+    if (result == PARSELINE_FG && token.builtin != BUILTIN_NONE) {
+        buf = capture_builtin(cmdline, &token, len);
+    } else {
+        if (syscall(SYS_pipe2, fds, O_CLOEXEC) < 0) {
+            fprintf(stderr, "pipe error: %s\n", strerror(errno));
+            last_status = 1;
+            *len = 0;
+            return "";
+        }
+        cap.read_fd = fds[0];
+        cap.write_fd = fds[1];
+        cap.len = 0;
+        cap.size = CAPTURE_READ;
+        cap.buf = arena_alloc(&command_arena, cap.size);
+
+        if (result == PARSELINE_FG) {
+            capture = &cap;
+            exec_pipeline(cmdline, &token, result, NULL);
+            capture = saved;
+        } else {
+            pgid = subshell ? getpgrp() : 0;
+            block_job_signals(&old_mask);
+            fflush(stdout);
+            if ((pid = Fork()) == 0) {
+                Setpgid(0, pgid);
+                subshell = true;
+                event_loop = false;
+                capture = NULL;
+                restore_signal_defaults(3, SIGINT, SIGTSTP, SIGCHLD);
+                Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+                Dup2(cap.write_fd, STDOUT_FILENO);
+                eval(cmdline);
+                fflush(stdout);
+                _exit(last_status);
+            }
+            setpgid(pid, pgid ? pgid : pid);
+            close(cap.write_fd);
+            cap.write_fd = -1;
+            if (subshell) {
+                read_capture(&cap, 0, &old_mask);
+                last_status = waitpid(pid, &status, 0) > 0
+                              ? wait_status_code(status) : 127;
+            } else {
+                addjob(&job_list, pid, FG, cmdline);
+                watch_job(getjobpid(&job_list, pid));
+                read_capture(&cap, pid, &old_mask);
+                wait_for_fg(&old_mask);
+            }
+            unblock_job_signals();
+        }
+
+        if (cap.write_fd >= 0) {    // No job was started
+            close(cap.write_fd);
+        }
+        close(cap.read_fd);
+        buf = cap.buf;
+        *len = cap.len;
+    }
+
+    while (*len > 0 && buf[*len - 1] == '\n') {
+        (*len)--;
+    }
+    return buf;
+}
+
+/*
+ * Sets the shell variables a command of assignments only names, keeping
+ * the exported ones exported. In the background such a command runs in
+ * a subshell of its own, so it changes nothing.
+ *
+ * @param stage the command, with no arguments.
+ * @param parse_result the parse result returned from the parseline call.
+ * @return void
+ */
+void assign_vars(struct cmd_stage *stage, parseline_return parse_result) {
+    int i;
+
+    if (parse_result == PARSELINE_FG) {
+        for (i = -stage->nassigns; i < 0; i++) {
+            var_set(stage->argv[i], false);
+        }
+    }
+    last_status = 0;
+}
+
+/*
+ * Creates a child process for a command of a job with fork and executes
+ * the command in it.
+ *
+ * This is the launch path used with -f, and for builtins that run in a
+ * subshell, which the child runs itself instead of executing a program.
+ * Since it calls fork(), the -Wl,--wrap,fork perturbation from fork.c
+ * applies to it.
+ *
+ * @param stage the command of the pipeline to execute.
+ * @param plan the resolved redirections of the command.
+ * @param path the resolved path of the command, NULL for a builtin.
+ * @param path_fd an O_PATH descriptor of the command, or -1.
+ * @param pgid the process group to join, or 0 to lead a new one.
+ * @param read_fd the pipe to read standard input from, or -1.
+ * @param write_fd the pipe to write standard output to, or -1.
+ * @return the process id of the child.
+ */
+pid_t fork_job(struct cmd_stage *stage, const struct redir_plan *plan,
+               const char *path, int path_fd,
+               pid_t pgid, int read_fd, int write_fd) {
+    char **envp;            // Environment of the command
+
+    fflush(stdout);         // A builtin child must not repeat buffered output
+    pid_t pid = Fork();
+    if (pid == 0) {         // Child process
+        Setpgid(0, pgid);   // Place child process in the job's process group.
+
+        // Connect the pipes, which are closed on exec
+        if (read_fd >= 0) {
+            Dup2(read_fd, STDIN_FILENO);
+        }
+        if (write_fd >= 0) {
+            Dup2(write_fd, STDOUT_FILENO);
+        }
+
+        // Redirect I/O, the files were already opened by the shell
+        if (!apply_redirections(plan)) {
+            unix_error("dup2 error");
+        }
+
+        Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+        restore_signal_defaults(3, SIGINT, SIGTSTP, SIGCHLD);
+        if (stage->builtin != BUILTIN_NONE) {
+            // The child is a subshell, which waits for its own commands
+            subshell = true;
+            event_loop = false;
+            capture = NULL;
+            int status = run_builtin(stage->builtin, stage->argc, stage->argv);
+            fflush(stdout);
+            _exit(status);
+        }
+        envp = vars_command_env(stage->argv - stage->nassigns,
+                                stage->nassigns);
+        if (path_fd >= 0) {
+            syscall(SYS_execveat, path_fd, "", stage->argv, envp,
+                    AT_EMPTY_PATH);
+        }
+        Execve(path, stage->argv, envp);
+    }
+
+    // Also set the group here, so it is in place before the shell signals it
+    setpgid(pid, pgid ? pgid : pid);
+    return pid;
+}
+
+/*
+ * Creates a child process for a command of a job with posix_spawn.
+ *
+ * The process group, the signal defaults, the signal mask, the pipes and
+ * the steps of the redirection plan are applied as spawn attributes and
+ * file actions, so the shell's address space is never copied. glibc
+ * starts the child with CLONE_VFORK and reports a failed exec back before
+ * posix_spawn returns, so the error is printed by the shell itself and no
+ * process is added to the job.
+ *
+ * @param stage the command of the pipeline to execute.
+ * @param plan the resolved redirections of the command.
+ * @param path the resolved path of the command.
+ * @param pgid the process group to join, or 0 to lead a new one.
+ * @param read_fd the pipe to read standard input from, or -1.
+ * @param write_fd the pipe to write standard output to, or -1.
+ * @return the process id of the child, or 0 if it could not be started.
+ */
+pid_t spawn_job(struct cmd_stage *stage, const struct redir_plan *plan,
+                const char *path, pid_t pgid, int read_fd, int write_fd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask, defaults;
+    pid_t pid;
+    int i, err;
+
+    posix_spawn_file_actions_init(&actions);
+    if (read_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, read_fd, STDIN_FILENO);
+    }
+    if (write_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, write_fd, STDOUT_FILENO);
+    }
+    for (i = 0; i < plan->nactions; i++) {
+        // dup2 onto the same descriptor clears its close-on-exec flag
+        if (plan->actions[i].src < 0) {
+            posix_spawn_file_actions_addclose(&actions, plan->actions[i].dst);
+        } else {
+            posix_spawn_file_actions_adddup2(&actions, plan->actions[i].src,
+                                             plan->actions[i].dst);
+        }
+    }
+
+    // The child runs with the shell's mask minus the job control signals
+    Sigprocmask(SIG_BLOCK, NULL, &mask);
+    sigdelset(&mask, SIGINT);
+    sigdelset(&mask, SIGTSTP);
+    sigdelset(&mask, SIGCHLD);
+    defaults = create_mask(3, SIGINT, SIGTSTP, SIGCHLD);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                                    POSIX_SPAWN_SETSIGDEF |
+                                    POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setsigmask(&attr, &mask);
+
+    err = posix_spawn(&pid, path, &actions, &attr, stage->argv,
+                      vars_command_env(stage->argv - stage->nassigns,
+                                       stage->nassigns));
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", stage->argv[0], strerror(err));
+        return 0;
+    }
+    return pid;
+}
+
+/*
+ * Creates a job for the parsed pipeline, with a child process for each of
+ * its commands, and executes the commands in them.
+ *
+ * The commands are connected by pipes and placed in one process group,
+ * led by the first command that started. A command that cannot be started
+ * is left out, and its neighbours see the end of their pipe.
  *
  * Suspends the shell, if job created is a foreground job, until the foreground job
  * is stopped, terminated or exits.
@@ -214,6 +1681,24 @@ void eval(const char *cmdline) {
  *
  * Handles I/O redirection for created jobs if necessary.
  *
+ * In the subshell of a background list the commands join the subshell's
+ * process group instead of a job, and are waited for directly.
+ *
+ * For a command substitution the last command writes to its pipe, which
+ * the shell reads to the end before it waits for the job.
+ *
+ * The job of the process substitutions of the pipeline, if it is not done
+ * yet, becomes the job of the pipeline, whose commands join its process
+ * group. The shell closes its ends of their pipes once the commands are
+ * started.
+ *
+ * If a pipe cannot be made, as when the shell is out of descriptors, an
+ * error is printed, the commands already started are killed and reaped,
+ * and $? is set to 1.
+ *
+ * Sets $? to the status of the last command of a foreground pipeline, or
+ * to 0 for a background job.
+ *
  * @param cmdline the command line entered in the shell.
  * @param token the tokens parsed from the command line.
  * @parse_result the parse result returned from the parseline call.
@@ -221,40 +1706,185 @@ void eval(const char *cmdline) {
  *
  */
 void run(const char *cmdline, struct cmdline_tokens *token, parseline_return parse_result) {
+    struct cmd_stage *stage;
+    struct redir_plan *plans;
+    const char **paths;
+    char **names;
+    int i, nrun, *path_fds, pipe_fds[2], read_fd = -1, write_fd, status;
+    pid_t pid, pgid = 0, *pids = NULL;
+    struct job_t *job;
+    bool started = false;
+
+    // Bring environ, and with it PATH, up to date with the variables
+    vars_environ();
+
+    // Look every command up first, so a pipeline that cannot run starts
+    // nothing; the paths stay valid as nothing is looked up until launch
+    names = arena_alloc(&command_arena, token->nstages * sizeof(char *));
+    paths = arena_alloc(&command_arena, token->nstages * sizeof(char *));
+    path_fds = arena_alloc(&command_arena, token->nstages * sizeof(int));
+    for (i = 0; i < token->nstages; i++) {
+        names[i] = token->stages[i].builtin == BUILTIN_NONE &&
+                   token->stages[i].argc > 0
+                   ? token->stages[i].argv[0] : NULL;
+    }
+    if (resolve_commands(names, token->nstages, paths, path_fds) > 0) {
+        for (i = 0; paths[i] != NULL || names[i] == NULL; i++);
+        fprintf(stderr, "%s: command not found\n", names[i]);
+        last_status = 127;
+        return;
+    }
+
+    // Open every redirection first too, so the children only call dup2
+    plans = arena_alloc(&command_arena,
+                        token->nstages * sizeof(struct redir_plan));
+    for (i = 0; i < token->nstages; i++) {
+        if (!plan_redirections(&token->stages[i], &plans[i])) {
+            while (--i >= 0) {
+                close_redirections(&plans[i]);
+            }
+            last_status = 1;
+            return;
+        }
+    }
+
+    if (subshell) {
+        pgid = getpgrp();
+        pids = arena_alloc(&command_arena, token->nstages * sizeof(pid_t));
+    }
+
     sigset_t old_mask;       // Mask with SIGINT, SIGTSTP and SIGCHLD Unblocked
-    Sigprocmask(SIG_BLOCK, &job_control_mask, &old_mask);
+    block_job_signals(&old_mask);
 
-    pid_t pid = Fork();
-    if (pid == 0) {         // Child process
-        Setpgid(0, 0);      // Place child process in a new process group.
+    if (!subshell && helpers.pgid != 0 &&
+        getjobpid(&job_list, helpers.pgid) != NULL) {
+        pgid = helpers.pgid;    // Join the process substitutions
+    }
 
-        // Redirect input
-        if (token->infile) {
-            redirect_io(STDIN_FILENO, token->infile);
+    for (i = 0; i < token->nstages; i++) {
+        stage = &token->stages[i];
+        write_fd = -1;
+        if (i < token->nstages - 1) {
+            if (syscall(SYS_pipe2, pipe_fds, O_CLOEXEC) < 0) {
+                // Out of descriptors, the pipeline fails rather than the shell
+                fprintf(stderr, "pipe error: %s\n", strerror(errno));
+                break;
+            }
+            write_fd = pipe_fds[1];
+        } else if (capture != NULL) {   // The output of a $(...)
+            write_fd = capture->write_fd;
+            capture->write_fd = -1;
         }
 
-        // Redirect output
-        if (token->outfile) {
-            redirect_io(STDOUT_FILENO, token->outfile);
+        if (stage->argc == 0) {  // All its words expanded to nothing
+            pid = 0;
+        } else if (stage->builtin != BUILTIN_NONE) {
+            pid = fork_job(stage, &plans[i], NULL, -1,
+                           pgid, read_fd, write_fd);
+        } else {
+            pid = fork_launch
+                  ? fork_job(stage, &plans[i], paths[i], path_fds[i],
+                             pgid, read_fd, write_fd)
+                  : spawn_job(stage, &plans[i], paths[i],
+                              pgid, read_fd, write_fd);
         }
+        close_redirections(&plans[i]);
 
-        Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
-        restore_signal_defaults(3, SIGINT, SIGTSTP, SIGCHLD);
-        Execve(token->argv[0], token->argv, environ);
-
-    } else {                // Parent process
-
-        if (parse_result == PARSELINE_BG) {
-            addjob(job_list, pid, BG, cmdline);
-            int jid = pid2jid(job_list, pid);
-            printf("[%d] (%d) %s\n", jid, pid, cmdline);
-        } else if (parse_result == PARSELINE_FG) {
-            addjob(job_list, pid, FG, cmdline);
-            while (fgpid(job_list)) {   // While there is a foreground job
-                Sigsuspend(&old_mask);
+        // The shell keeps no pipe ends; the next command reads this pipe
+        if (read_fd >= 0) {
+            close(read_fd);
+        }
+        if (write_fd >= 0) {
+            close(write_fd);
+        }
+        read_fd = i < token->nstages - 1 ? pipe_fds[0] : -1;
+
+        if (subshell) {
+            pids[i] = pid;
+            continue;
+        }
+        if (pid == 0) {          // The command could not be started
+            if (i == token->nstages - 1 && pgid != 0 &&
+                (job = getjobpid(&job_list, pgid)) != NULL) {
+                // $? is its status, not that of the command before it
+                failjobproc(&job_list, job,
+                            W_EXITCODE(stage->argc == 0 ? 0 : 127, 0));
             }
+            continue;
+        }
+        if (pgid == 0) {
+            pgid = pid;
+            addjob(&job_list, pid, parse_result == PARSELINE_BG ? BG : FG,
+                   cmdline);
+        } else {
+            addjobproc(&job_list, getjobpid(&job_list, pgid), pid);
         }
+        started = true;
+    }
+    close_helpers();
 
-        Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+    // The commands after a pipe that could not be made are not started
+    nrun = i;
+    if (nrun < token->nstages) {
+        if (read_fd >= 0) {
+            close(read_fd);
+        }
+        for (i = nrun; i < token->nstages; i++) {
+            close_redirections(&plans[i]);
+        }
     }
+
+    if (subshell) {
+        for (i = 0; i < nrun && nrun < token->nstages; i++) {
+            if (pids[i] != 0) {
+                kill(pids[i], SIGKILL);
+            }
+        }
+        if (capture != NULL && nrun == token->nstages) {
+            read_capture(capture, 0, &old_mask);
+        }
+        for (i = 0; i < nrun; i++) {
+            if (pids[i] != 0 && waitpid(pids[i], &status, 0) > 0) {
+                last_status = wait_status_code(status);
+            } else {
+                last_status = 127;
+            }
+        }
+        if (nrun < token->nstages) {
+            last_status = 1;
+        }
+        unblock_job_signals();
+        return;
+    }
+
+    if (!started) {          // No command of the job could be started
+        last_status = nrun < token->nstages ? 1 : 127;
+        unblock_job_signals();
+        return;
+    }
+
+    if (pgid == helpers.pgid) {     // Their job is the pipeline's now
+        setjobstate(&job_list, getjobpid(&job_list, pgid),
+                    parse_result == PARSELINE_BG ? BG : FG);
+        helpers.pgid = 0;
+    }
+    watch_job(job = getjobpid(&job_list, pgid));
+    if (nrun < token->nstages) {
+        // Kill the commands already started and reap them
+        signal_job(job, SIGKILL);
+        setjobstate(&job_list, job, FG);
+        wait_for_fg(&old_mask);
+        last_status = 1;
+    } else if (parse_result == PARSELINE_BG) {
+        int jid = pid2jid(&job_list, pgid);
+        printf("[%d] (%d) %s\n", jid, pgid, cmdline);
+        last_status = 0;
+    } else if (parse_result == PARSELINE_FG) {
+        if (capture != NULL) {
+            read_capture(capture, pgid, &old_mask);
+        }
+        wait_for_fg(&old_mask);
+    }
+
+    unblock_job_signals();
 }
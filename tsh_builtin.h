@@ -0,0 +1,60 @@
+// The ABI of loadable builtins. A module is a shared object that exports,
+// for each builtin it provides, a struct tsh_builtin named <name>_builtin:
+//
+//     #include "tsh_builtin.h"
+//
+//     static int hello(int argc, char **argv, const struct tsh_builtin_io *io)
+//     {
+//         dprintf(io->out, "hello\n");
+//         return 0;
+//     }
+//
+//     struct tsh_builtin hello_builtin = {
+//         TSH_BUILTIN_ABI, "hello", hello, TSH_BUILTIN_SUBSHELL
+//     };
+//
+// and is loaded into the shell with enable -f module.so hello. This header
+// is meant to be included by modules alone, so it depends on nothing from
+// the shell.
+//
+
+#ifndef TINY_LINUX_SHELL_TSH_BUILTIN_H
+#define TINY_LINUX_SHELL_TSH_BUILTIN_H
+
+#define TSH_BUILTIN_ABI 1           // Version of this ABI
+
+// Flags of a loadable builtin
+#define TSH_BUILTIN_SUBSHELL 1      // May run in a forked subshell
+
+/*
+ * The descriptors a builtin reads from and writes to. Redirections of the
+ * command are already applied to them by the shell, and they stay open
+ * after the builtin returns, so it must not close them.
+ */
+struct tsh_builtin_io
+{
+    int in;                         // Standard input
+    int out;                        // Standard output
+    int err;                        // Standard error
+};
+
+/*
+ * Runs a loadable builtin in the shell process.
+ *
+ * @param argc the number of arguments.
+ * @param argv the arguments, NULL terminated, argv[0] naming the builtin.
+ * @param io the descriptors to use.
+ * @return the exit status of the builtin.
+ */
+typedef int (*tsh_builtin_fn)(int argc, char **argv,
+                              const struct tsh_builtin_io *io);
+
+struct tsh_builtin                  // Exported as <name>_builtin
+{
+    int abi;                        // TSH_BUILTIN_ABI
+    const char *name;               // The name it is typed as
+    tsh_builtin_fn run;             // The function that runs it
+    int flags;                      // TSH_BUILTIN_ flags
+};
+
+#endif //TINY_LINUX_SHELL_TSH_BUILTIN_H
@@ -3,38 +3,200 @@
  */
 
 #include "tsh_helper.h"
+#include "modules.h"
+#include "functions.h"
 
 /* Global variables */
 extern char **environ;          // Defined in libc
 char prompt[] = "tsh> ";        // Command line prompt (do not change)
 bool verbose = false;           // If true, prints additional output
 bool check_block = true;        // If true, check that signals are blocked
-int nextjid = 1;                // Next job ID to allocate
 char sbuf[MAXLINE_TSH];         // For composing sprintf messages
 
 // Parsing states, used for parseline
 typedef enum parse_state
 {
     ST_NORMAL,
-    ST_INFILE,
-    ST_OUTFILE
+    ST_REDIR
 } parse_state;
 
 
-struct job_t job_list[MAXJOBS]; // The job list
+struct job_list_t job_list;     // The job list
 
+/* The registry of builtins, indexed by builtin_state */
+const struct builtin_info builtin_info[NBUILTINS] =
+{
+    [BUILTIN_NONE] = {NULL, 0},
+#define BUILTIN(id, name, function, flags) [BUILTIN_##id] = {name, flags},
+#include "builtins.def"
+#undef BUILTIN
+};
+
+bool builtin_disabled[NBUILTINS];   /* Turned off by enable -n */
+
+/* builtin_slots and its seed, generated from builtins.def by mkbuiltins */
+#include "builtins_table.h"
+
+
+/*
+ * reserve_args - Make room for n entries in token->argv, doubling it in
+ * place at the top of command_arena
+ */
+static void reserve_args(struct cmdline_tokens *token, size_t n,
+                         size_t *argv_cap)
+{
+    if (n > *argv_cap)
+    {
+        token->argv = arena_grow(&command_arena, token->argv,
+                                 *argv_cap * sizeof(char *),
+                                 2 * *argv_cap * sizeof(char *));
+        *argv_cap *= 2;
+    }
+}
+
+/*
+ * lookup_builtin - Find the builtin a command names, with one probe of the
+ * perfect hash generated by mkbuiltins. /bin/name and /usr/bin/name find
+ * the builtins that replace those programs. Other names are looked up
+ * among the builtins loaded by enable -f. Aliases and functions come
+ * before all of them.
+ */
+builtin_state lookup_builtin(const char *name)
+{
+    builtin_state id;
+    int flags = 0;
+
+    if ((id = def_lookup(name)) != BUILTIN_NONE)
+    {
+        return id;
+    }
+    if (name[0] == '/')
+    {
+        if (strncmp(name, "/bin/", 5) == 0)
+        {
+            name += 5;
+        }
+        else if (strncmp(name, "/usr/bin/", 9) == 0)
+        {
+            name += 9;
+        }
+        else
+        {
+            return BUILTIN_NONE;
+        }
+        flags = BUILTIN_REPLACES_PATH;
+    }
+
+    id = builtin_slots[builtin_hash(name, BUILTIN_HASH_SEED) &
+                       (BUILTIN_HASH_SLOTS - 1)];
+    if (id != BUILTIN_NONE && !builtin_disabled[id] &&
+        (builtin_info[id].flags & flags) == flags &&
+        strcmp(builtin_info[id].name, name) == 0)
+    {
+        return id;
+    }
+    return flags == 0 ? module_lookup(name) : BUILTIN_NONE;
+}
+
+/*
+ * builtin_entry - Return the registry entry of a builtin, from builtins.def,
+ * loaded by enable -f, or an alias or function
+ */
+const struct builtin_info *builtin_entry(builtin_state id)
+{
+    if (id >= DEFS_BASE)
+    {
+        return def_info(id);
+    }
+    return id < NBUILTINS ? &builtin_info[id] : module_info(id);
+}
+
+/*
+ * word_quote - Return the quote a word was enclosed in, or 0. parseline
+ * leaves the opening quote in the text, right before the word; the byte
+ * before an unquoted word is a blank, an operator or a NUL it wrote.
+ */
+char word_quote(const struct cmdline_tokens *token, const char *word)
+{
+    if (word > token->text && (word[-1] == '\'' || word[-1] == '"'))
+    {
+        return word[-1];
+    }
+    return 0;
+}
+
+/*
+ * subst_end - Return the byte after the ) that closes the command
+ * substitution a $( starts at p, or the process substitution a <( or >(
+ * starts, or NULL if it is not closed. Parentheses nest, and quoted text
+ * inside is skipped.
+ */
+const char *subst_end(const char *p)
+{
+    const char *quote;
+    int depth = 0;
+
+    for (p++; *p != '\0'; p++)
+    {
+        if (*p == '\'' || *p == '"')
+        {
+            if ((quote = strchr(p + 1, *p)) == NULL)
+            {
+                return NULL;
+            }
+            p = quote;
+        }
+        else if (*p == '(')
+        {
+            depth++;
+        }
+        else if (*p == ')' && --depth == 0)
+        {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * assignment_word - Return true if a word of parsed tokens is an unquoted
+ * name=value assignment
+ */
+static bool assignment_word(const struct cmdline_tokens *token,
+                            const char *word)
+{
+    const char *eq = strchr(word, '=');
+
+    return eq != NULL && word_quote(token, word) == 0 &&
+           var_valid_name(word, eq - word);
+}
 
 /* 
  * parseline - Parse the command line and build the argv array.
  * 
  *   cmdline:  The command line, in the form:
  *
- *                command [arguments...] [< infile] [> oufile] [&]
+ *                [name=value...] command [arguments...] [redirection...]
+ *                    [| command [arguments...] [redirection...]]... [&]
+ *
+ *             where the assignments in front of a command are kept before
+ *             its argv, and a lone stage may consist of assignments only,
+ *             and where a redirection is one of [n]<file, [n]>file, [n]>>file,
+ *             [n]<>file, [n]>&m, [n]<&m, [n]>&-, [n]<<word, whose word
+ *             heredoc_gather made from the body, or [n]<<<word.
+ *             Redirections are recorded in order with their stage, and
+ *             applied in that order.
  *
  *   token:    Pointer to a cmdline_tokens structure. The elements of this
  *             structure will be populated with the parsed tokens. Characters 
  *             enclosed in single or double quotes are treated as a single
- *             argument. 
+ *             argument, and so is a $(...) command substitution within an
+ *             unquoted argument, or a <(...) or >(...) process substitution
+ *             that starts one, whatever it contains. Each command of a
+ *             pipeline becomes one stage, and token->argc is the number of
+ *             arguments of the first stage. The text, argv, stages and
+ *             redirections are allocated from command_arena in one pass
+ *             over the line; argv grows in place at the top of the arena.
  *
  * Returns:
  *   PARSELINE_EMPTY:        if the command line is empty
@@ -46,10 +208,24 @@ struct job_t job_list[MAXJOBS]; // The job list
 parseline_return parseline(const char *cmdline, 
                            struct cmdline_tokens *token) 
 {
-    const char delims[] = " \t\r\n";    // argument delimiters (white-space)
+    const char word_ends[] = " \t\r\n|"; // characters that end an unquoted arg
     char *buf;                          // ptr that traverses command line
     char *next;                         // ptr to the end of the current arg
     char *endbuf;                       // ptr to end of cmdline string
+    struct cmd_stage *stage;            // the stage being parsed
+    int nargs;                          // entries used in token->argv
+    bool pipe_next;                     // the current arg ended with a '|'
+    char *op;                           // ptr to a redirection operator
+    const char *subst;                  // ptr past a $(...) in an arg
+    struct redirection *redir;          // the redirection being parsed
+    struct redirection *redirs;         // redirections of all stages
+    size_t len;                         // length of cmdline
+    size_t argv_cap;                    // entries allocated in token->argv
+    int max_stages, max_redirs;         // upper bounds from the operators
+    struct scan_map map;                // classes of the bytes of the line
+    size_t pos;                         // offset of a byte in the line
+    int i;
+    int flags;                          // where a builtin may run
 
     parse_state parsing_state;          // indicates if the next token is the
                                         // input or output file
@@ -60,15 +236,36 @@ parseline_return parseline(const char *cmdline,
         return PARSELINE_EMPTY;
     }
 
-    strncpy(token->text, cmdline, MAXLINE_TSH);
+    len = strlen(cmdline);
+    token->text = arena_strndup(&command_arena, cmdline, len);
 
     buf = token->text;
-    endbuf = token->text + strlen(token->text);
+    endbuf = token->text + len;
+
+    /* Classify every byte once; the scans below then look up bitmaps */
+    scan_classify(&map, token->text, len,
+                  arena_alloc(&command_arena,
+                              scan_storage(len) * sizeof(uint64_t)));
+
+    /* Every stage and redirection needs an operator character, which
+       bounds their number; argv is sized as it grows */
+    max_stages = 1 + map.npipes;
+    max_redirs = map.nredirs;
+    token->stages = arena_alloc(&command_arena,
+                                max_stages * sizeof(struct cmd_stage));
+    redirs = arena_alloc(&command_arena,
+                         max_redirs * sizeof(struct redirection));
+    argv_cap = 16;
+    token->argv = arena_alloc(&command_arena, argv_cap * sizeof(char *));
 
     // initialize default values
-    token->argc = 0;
-    token->infile = NULL;
-    token->outfile = NULL;
+    nargs = 0;
+    token->nstages = 1;
+    stage = &token->stages[0];
+    stage->argc = 0;
+    stage->nredirs = 0;
+    stage->redirs = redirs;
+    redir = NULL;
 
     /* Build the argv list */
     parsing_state = ST_NORMAL;
@@ -76,70 +273,170 @@ parseline_return parseline(const char *cmdline,
     while (buf < endbuf)
     {
         /* Skip the white-spaces */
-        buf += strspn(buf, delims);
+        buf = token->text + scan_find(&map, map.blanks, buf - token->text, true);
         if (buf >= endbuf) break;
 
-        /* Check for I/O redirection specifiers */
-        if (*buf == '<')
+        /* Check for I/O redirection specifiers, with an optional
+           descriptor number in front of the operator */
+        op = buf;
+        while (isdigit((unsigned char) *op))
         {
-            if (token->infile) // infile already exists
+            op++;
+        }
+        if ((*op == '<' || *op == '>') && (op > buf || op[1] != '('))
+        {
+            if (parsing_state != ST_NORMAL)
             {
-                fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+                fprintf(stderr, "Error: must provide file name for redirection\n");
                 return PARSELINE_ERROR;
             }
-            parsing_state = ST_INFILE;
-            buf++;
-            continue;
-        }
-
-        else if (*buf == '>')
-        {
-            if (token->outfile) // outfile already exists
+            if (op - buf > 4)
             {
                 fprintf(stderr, "Error: Ambiguous I/O redirection\n");
                 return PARSELINE_ERROR;
             }
-            parsing_state = ST_OUTFILE;
-            buf++;
+            redir = &stage->redirs[stage->nredirs++];
+            redir->fd = (op > buf) ? atoi(buf) : (*op == '<' ? 0 : 1);
+            redir->file = NULL;
+            redir->dup_fd = -1;
+
+            if (op[0] == '>' && op[1] == '>')
+            {
+                redir->type = REDIR_APPEND;
+                op += 2;
+            }
+            else if (op[0] == '<' && op[1] == '<' && op[2] == '<')
+            {
+                redir->type = REDIR_HERESTRING;
+                op += 3;
+            }
+            else if (op[0] == '<' && op[1] == '<')
+            {
+                redir->type = REDIR_HEREDOC;
+                op += 2;
+            }
+            else if (op[0] == '<' && op[1] == '>')
+            {
+                redir->type = REDIR_RDWR;
+                op += 2;
+            }
+            else
+            {
+                redir->type = (*op == '<') ? REDIR_IN : REDIR_OUT;
+                op++;
+            }
+
+            if (*op == '&' && (redir->type == REDIR_IN ||
+                               redir->type == REDIR_OUT))
+            {
+                /* Descriptor duplication, the target follows directly */
+                redir->type = REDIR_DUP;
+                op++;
+                if (*op == '-')
+                {
+                    op++;
+                }
+                else if (isdigit((unsigned char) *op) &&
+                         strspn(op, "0123456789") <= 4)
+                {
+                    redir->dup_fd = atoi(op);
+                    op += strspn(op, "0123456789");
+                }
+                else
+                {
+                    fprintf(stderr, "Error: bad file descriptor\n");
+                    return PARSELINE_ERROR;
+                }
+                if (*op != '\0' && strchr(word_ends, *op) == NULL)
+                {
+                    fprintf(stderr, "Error: bad file descriptor\n");
+                    return PARSELINE_ERROR;
+                }
+                buf = op;
+                continue;
+            }
+
+            parsing_state = ST_REDIR;
+            buf = op;
             continue;
         }
 
+        if (*buf == '|')
+        {
+            next = buf;
+            pipe_next = true;
+            goto end_stage;
+        }
+
         else if (*buf == '\'' || *buf == '\"')
         {
-            /* Detect quoted tokens */
+            /* Detect quoted tokens, ending at the same kind of quote */
             buf++;
-            next = strchr(buf, *(buf-1));
+            pos = buf - token->text;
+            while ((pos = scan_find(&map, map.quotes, pos, false)) < len &&
+                   token->text[pos] != *(buf-1))
+            {
+                pos++;
+            }
+            next = (pos < len) ? token->text + pos : NULL;
         }
        
         else
         {
-            /* Find next delimiter */
-            next = buf + strcspn(buf, delims);
+            /* Find next delimiter, which a $(...) in the arg hides, as
+               does a <(...) or >(...) that starts it */
+            subst = buf;
+            if ((*buf == '<' || *buf == '>') &&
+                (subst = subst_end(buf)) == NULL)
+            {
+                fprintf(stderr, "Error: unmatched (.\n");
+                return PARSELINE_ERROR;
+            }
+            next = token->text +
+                   scan_find(&map, map.word_ends, subst - token->text, false);
+            while ((subst = memchr(subst, '$', next - subst)) != NULL)
+            {
+                if (subst[1] != '(')
+                {
+                    subst++;
+                    continue;
+                }
+                if ((subst = subst_end(subst)) == NULL)
+                {
+                    fprintf(stderr, "Error: unmatched (.\n");
+                    return PARSELINE_ERROR;
+                }
+                if (subst > next)
+                {
+                    next = token->text + scan_find(&map, map.word_ends,
+                                                   subst - token->text, false);
+                }
+            }
         }
         
         if (next == NULL)
         {
-            /* Returned by strchr(); this means that the closing
-               quote was not found. */
+            /* The closing quote was not found. */
             fprintf (stderr, "Error: unmatched %c.\n", *(buf-1));
             return PARSELINE_ERROR;
         }
 
         /* Terminate the token */
+        pipe_next = (*next == '|');
         *next = '\0';
 
+        /* Room for this argument and a NULL after it */
+        reserve_args(token, nargs + 2, &argv_cap);
+
         /* Record the token as either the next argument or the i/o file */
         switch (parsing_state)
         {
         case ST_NORMAL:
-            token->argv[token->argc] = buf;
-            token->argc = token->argc+1;
+            token->argv[nargs++] = buf;
+            stage->argc = stage->argc+1;
             break;
-        case ST_INFILE:
-            token->infile = buf;
-            break;
-        case ST_OUTFILE:
-            token->outfile = buf;
+        case ST_REDIR:
+            redir->file = buf;
             break;
         default:
             fprintf(stderr, "Error: Ambiguous I/O redirection\n");
@@ -147,58 +444,151 @@ parseline_return parseline(const char *cmdline,
         }
         parsing_state = ST_NORMAL;
 
-        /* Check if argv is full */
-        if (token->argc >= MAXARGS-1) break;
+    end_stage:
+        /* Terminate the stage and start the next one after a '|' */
+        if (pipe_next)
+        {
+            if (parsing_state != ST_NORMAL)
+            {
+                break;
+            }
+            if (stage->argc == 0)
+            {
+                fprintf(stderr, "Error: invalid pipeline\n");
+                return PARSELINE_ERROR;
+            }
+            reserve_args(token, nargs + 2, &argv_cap);
+            token->argv[nargs++] = NULL;
+            redirs += stage->nredirs;
+            stage = &token->stages[token->nstages++];
+            stage->argc = 0;
+            stage->nredirs = 0;
+            stage->redirs = redirs;
+        }
 
         buf = next + 1;
     }
 
-    if (parsing_state != ST_NORMAL) // buf ends with < or >
+    if (parsing_state != ST_NORMAL) // buf ends with a redirection operator
     {
         fprintf(stderr, "Error: must provide file name for redirection\n");
         return PARSELINE_ERROR;
     }
 
     /* The argument list must end with a NULL pointer */
-    token->argv[token->argc] = NULL;
+    token->argv[nargs] = NULL;
+    token->argc = token->stages[0].argc;
 
-    if (token->argc == 0)                       /* ignore blank line */
+    /* Point each stage at its arguments now that argv stopped moving */
+    nargs = 0;
+    for (i = 0; i < token->nstages; i++)
     {
-        return PARSELINE_EMPTY;
+        token->stages[i].argv = &token->argv[nargs];
+        nargs += token->stages[i].argc + 1;
     }
 
-    if ((strcmp(token->argv[0], "quit")) == 0)        /* quit command */
+    /* Unquoted name=value words in front of a command are assignments,
+       which stay in argv just before the arguments */
+    for (i = 0; i < token->nstages; i++)
     {
-        token->builtin = BUILTIN_QUIT;
+        stage = &token->stages[i];
+        stage->nassigns = 0;
+        while (stage->argc > 0 && assignment_word(token, stage->argv[0]))
+        {
+            stage->nassigns++;
+            stage->argv++;
+            stage->argc--;
+        }
+        if (stage->argc == 0 && stage->nassigns > 0 && token->nstages > 1)
+        {
+            fprintf(stderr, "Error: invalid pipeline\n");
+            return PARSELINE_ERROR;
+        }
     }
-    else if ((strcmp(token->argv[0], "jobs")) == 0)   /* jobs command */
+    token->argc = token->stages[0].argc;
+
+    if (token->nstages == 1 && token->argc == 0 &&
+        stage->nassigns == 0)                   /* ignore blank line */
     {
-        token->builtin = BUILTIN_JOBS;
+        return PARSELINE_EMPTY;
     }
-    else if ((strcmp(token->argv[0], "bg")) == 0)     /* bg command */
+
+    // Returns 1 if job runs on background; 0 if job runs on foreground
+
+    parseline_return result = PARSELINE_FG;
+    if (stage->argc > 0 && *stage->argv[stage->argc-1] == '&' &&
+        word_quote(token, stage->argv[stage->argc-1]) == 0)
     {
-        token->builtin = BUILTIN_BG;
+        stage->argv[--(stage->argc)] = NULL;
+        token->argc = token->stages[0].argc;
+        result = PARSELINE_BG;
     }
-    else if ((strcmp(token->argv[0], "fg")) == 0)     /* fg command */
+
+    if (stage->argc == 0 && stage->nassigns == 0) /* pipeline ends with | */
     {
-        token->builtin = BUILTIN_FG;
+        fprintf(stderr, "Error: invalid pipeline\n");
+        return PARSELINE_ERROR;
     }
-    else
+
+    /*
+     * A lone builtin runs in the shell, unless it is backgrounded and may
+     * run in a subshell; builtins anywhere else run in subshells
+     */
+    token->builtin = BUILTIN_NONE;
+    for (i = 0; i < token->nstages; i++)
     {
-        token->builtin = BUILTIN_NONE;
+        stage = &token->stages[i];
+        stage->builtin = stage->argc > 0 ? lookup_builtin(stage->argv[0])
+                                         : BUILTIN_NONE;
+        if (stage->builtin == BUILTIN_NONE)
+        {
+            continue;
+        }
+
+        flags = builtin_entry(stage->builtin)->flags;
+        if (stage->nredirs > 0 && !(flags & BUILTIN_REDIRECTABLE))
+        {
+            fprintf(stderr, "Error: %s cannot be redirected\n",
+                    stage->argv[0]);
+            return PARSELINE_ERROR;
+        }
+        if (token->nstages == 1 && (flags & BUILTIN_RUNS_FG) &&
+            (result == PARSELINE_FG || !(flags & BUILTIN_RUNS_BG)))
+        {
+            token->builtin = stage->builtin;
+        }
+        else if (!(flags & BUILTIN_RUNS_BG))
+        {
+            fprintf(stderr, token->nstages > 1
+                            ? "Error: builtin commands cannot be piped\n"
+                            : "Error: %s cannot run in the background\n",
+                    stage->argv[0]);
+            return PARSELINE_ERROR;
+        }
     }
 
-    // Returns 1 if job runs on background; 0 if job runs on foreground
+    return result;
+}
 
-    if (*token->argv[(token->argc)-1] == '&')
+/*
+ * parseline_background - Make the tokens of a foreground pipeline those
+ * of the same pipeline run in the background: a lone builtin that may run
+ * in a subshell does, as parseline decides for a line ending with &.
+ */
+parseline_return parseline_background(struct cmdline_tokens *token)
+{
+    if (token->builtin == BUILTIN_NONE)
     {
-        token->argv[--(token->argc)] = NULL;
         return PARSELINE_BG;
     }
-    else
+    if (!(builtin_entry(token->builtin)->flags & BUILTIN_RUNS_BG))
     {
-        return PARSELINE_FG;
+        fprintf(stderr, "Error: %s cannot run in the background\n",
+                token->stages[0].argv[0]);
+        return PARSELINE_ERROR;
     }
+    token->builtin = BUILTIN_NONE;
+    return PARSELINE_BG;
 }
 
 
@@ -245,259 +635,655 @@ static void clearjob(struct job_t *job)
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
-    job->cmdline[0] = '\0';
 }
 
-/* initjobs - Initialize the job list */
-void initjobs(struct job_t *jl)
+/* pid_hash - Home position of a PID in a PID index of the given size */
+static int pid_hash(pid_t pid, int size)
 {
-    int i;
+    unsigned h = (unsigned)pid * 2654435761u;
 
-    for (i = 0; i < MAXJOBS; i++)
+    return (int)((h ^ (h >> 16)) & (unsigned)(size - 1));
+}
+
+/* pid_index_find - Position of pid in the PID index, or of its empty slot */
+static int pid_index_find(struct job_list_t *jl, pid_t pid)
+{
+    int mask = jl->pid_index_size - 1;
+    int i = pid_hash(pid, jl->pid_index_size);
+
+    while (jl->pid_index[i].pid != 0 && jl->pid_index[i].pid != pid)
     {
-        clearjob(&jl[i]);
+        i = (i + 1) & mask;
     }
+    return i;
 }
 
-/* maxjid - Returns largest allocated job ID */
-static int maxjid(struct job_t *jl) 
+/* pid_index_insert - Map pid to slot in the PID index */
+static void pid_index_insert(struct job_list_t *jl, pid_t pid, int slot)
 {
-    check_blocked();
-    int i, max=0;
+    int i = pid_index_find(jl, pid);
+
+    jl->pid_index[i].pid = pid;
+    jl->pid_index[i].slot = slot;
+}
 
-    for (i = 0; i < MAXJOBS; i++)
+/*
+ * pid_index_remove - Remove pid from the PID index. Entries that follow it
+ * in the probe sequence are shifted back instead of leaving a tombstone,
+ * so that the index never needs to be cleaned up. Only touches memory,
+ * so it is safe to call from a signal handler.
+ */
+static void pid_index_remove(struct job_list_t *jl, pid_t pid)
+{
+    int mask = jl->pid_index_size - 1;
+    int hole = pid_index_find(jl, pid);
+    int i, home;
+
+    if (jl->pid_index[hole].pid == 0)
     {
-        if (jl[i].jid > max)
+        return;
+    }
+
+    i = hole;
+    while (true)
+    {
+        i = (i + 1) & mask;
+        if (jl->pid_index[i].pid == 0)
+        {
+            break;
+        }
+        home = pid_hash(jl->pid_index[i].pid, jl->pid_index_size);
+
+        // Move the entry into the hole unless its home lies in (hole, i]
+        if ((i > hole && (home <= hole || home > i)) ||
+            (i < hole && (home <= hole && home > i)))
         {
-            max = jl[i].jid;
+            jl->pid_index[hole] = jl->pid_index[i];
+            hole = i;
         }
     }
-    return max;
+    jl->pid_index[hole].pid = 0;
 }
 
-/* addjob - Add a job to the job list */
-bool addjob(struct job_t *jl, pid_t pid, job_state state, const char *cmdline) 
+/* pid_index_slot - Slot of the job with the given PID, -1 if none */
+static int pid_index_slot(struct job_list_t *jl, pid_t pid)
 {
-    check_blocked();
+    int i = pid_index_find(jl, pid);
+
+    return jl->pid_index[i].pid == pid ? jl->pid_index[i].slot : -1;
+}
+
+/*
+ * rebuild_pid_index - Replace the PID index by an empty one of the given
+ * size, and insert the processes of all jobs into it.
+ */
+static void rebuild_pid_index(struct job_list_t *jl, int size)
+{
+    int i, j;
+
+    Free(jl->pid_index);
+    jl->pid_index_size = size;
+    jl->pid_index = Calloc(size, sizeof(struct pid_entry));
+    for (i = 0; i < jl->capacity; i++)
+    {
+        if (jl->jobs[i].pid == 0)
+        {
+            continue;
+        }
+        for (j = 0; j < jl->procs[i].nprocs; j++)
+        {
+            pid_index_insert(jl, jl->procs[i].procs[j].pid, i);
+        }
+    }
+}
+
+/*
+ * grow_jobs - Double the number of job slots. The PID index is kept at
+ * least twice as large as the number of slots, so it is rebuilt as well.
+ */
+static void grow_jobs(struct job_list_t *jl)
+{
+    int old_capacity = jl->capacity;
+    int capacity = old_capacity ? 2 * old_capacity : INITJOBS;
     int i;
 
-    if (pid < 1)
+    jl->jobs = Realloc(jl->jobs, capacity * sizeof(struct job_t));
+    jl->procs = Realloc(jl->procs, capacity * sizeof(struct job_procs));
+    jl->cmd_offset = Realloc(jl->cmd_offset, capacity * sizeof(size_t));
+    jl->free_slots = Realloc(jl->free_slots, capacity * sizeof(int));
+
+    // Push the new slots so that the lowest one is handed out first
+    for (i = capacity - 1; i >= old_capacity; i--)
     {
-        return false;
+        clearjob(&jl->jobs[i]);
+        jl->procs[i].procs = NULL;
+        jl->procs[i].nprocs = 0;
+        jl->procs[i].nlive = 0;
+        jl->procs[i].capacity = 0;
+        jl->free_slots[jl->nfree++] = i;
+    }
+    jl->capacity = capacity;
+
+    if (jl->pid_index_size < 2 * capacity)
+    {
+        rebuild_pid_index(jl, 2 * capacity);
     }
+}
+
+/* grow_jid_index - Make room in the JID index for job IDs up to jid */
+static void grow_jid_index(struct job_list_t *jl, int jid)
+{
+    int size = jl->jid_index_size;
+    int i;
+
+    while (size <= jid)
+    {
+        size *= 2;
+    }
+    jl->jid_index = Realloc(jl->jid_index, size * sizeof(int));
+    for (i = jl->jid_index_size; i < size; i++)
+    {
+        jl->jid_index[i] = -1;
+    }
+    jl->jid_index_size = size;
+}
+
+/*
+ * append_cmdline - Copy a command line into the arena and return its
+ * offset. When deleted jobs own more than half of the arena, the live
+ * command lines are first moved to a fresh arena.
+ */
+static size_t append_cmdline(struct job_list_t *jl, const char *cmdline)
+{
+    size_t len = strlen(cmdline) + 1;
+    size_t offset;
+    char *arena;
+    int i;
 
-    for (i = 0; i < MAXJOBS; i++)
+    if (jl->cmd_arena_dead > jl->cmd_arena_used / 2)
     {
-        if (jl[i].pid == 0)
+        arena = Malloc(jl->cmd_arena_size);
+        offset = 0;
+        for (i = 0; i < jl->capacity; i++)
         {
-            jl[i].pid = pid;
-            jl[i].state = state;
-            jl[i].jid = nextjid++;
-            if (nextjid > MAXJOBS)
+            if (jl->jobs[i].pid != 0)
             {
-                nextjid = 1;
+                size_t n = strlen(jl->cmd_arena + jl->cmd_offset[i]) + 1;
+                memcpy(arena + offset, jl->cmd_arena + jl->cmd_offset[i], n);
+                jl->cmd_offset[i] = offset;
+                offset += n;
             }
-            strcpy(jl[i].cmdline, cmdline);
-            if(verbose)
+        }
+        Free(jl->cmd_arena);
+        jl->cmd_arena = arena;
+        jl->cmd_arena_used = offset;
+        jl->cmd_arena_dead = 0;
+    }
+
+    if (jl->cmd_arena_used + len > jl->cmd_arena_size)
+    {
+        while (jl->cmd_arena_used + len > jl->cmd_arena_size)
+        {
+            jl->cmd_arena_size *= 2;
+        }
+        jl->cmd_arena = Realloc(jl->cmd_arena, jl->cmd_arena_size);
+    }
+
+    offset = jl->cmd_arena_used;
+    memcpy(jl->cmd_arena + offset, cmdline, len);
+    jl->cmd_arena_used += len;
+    return offset;
+}
+
+/* initjobs - Initialize the job list */
+void initjobs(struct job_list_t *jl)
+{
+    struct rlimit limit;
+    int i;
+
+    jl->jobs = NULL;
+    jl->procs = NULL;
+    jl->cmd_offset = NULL;
+    jl->capacity = 0;
+    jl->free_slots = NULL;
+    jl->nfree = 0;
+    jl->pid_index = NULL;
+    jl->pid_index_size = 0;
+    jl->npids = 0;
+    jl->maxjid = 0;
+    jl->free_jids = NULL;
+    jl->nfree_jids = 0;
+    jl->fg_slot = -1;
+
+    // Pidfds may take half of the descriptors, the rest is for the commands
+    jl->npidfds = 0;
+    jl->max_pidfds = INT_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+        limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur / 2 < INT_MAX)
+    {
+        jl->max_pidfds = limit.rlim_cur / 2;
+    }
+
+    jl->cmd_arena_size = INITJOBS * 64;
+    jl->cmd_arena = Malloc(jl->cmd_arena_size);
+    jl->cmd_arena_used = 0;
+    jl->cmd_arena_dead = 0;
+
+    jl->jid_index_size = 2 * INITJOBS;
+    jl->jid_index = Malloc(jl->jid_index_size * sizeof(int));
+    for (i = 0; i < jl->jid_index_size; i++)
+    {
+        jl->jid_index[i] = -1;
+    }
+
+    grow_jobs(jl);
+}
+
+/*
+ * nextjid - Returns the job ID to allocate next: one more than the largest
+ * allocated job ID, or 0 if none is left. Once that would exceed MAXJID,
+ * the unused job IDs are pushed on a stack, in one pass that the MAXJID
+ * allocations before it pay for, and from then on deletejob pushes the job
+ * IDs it frees, so each job ID is popped from the stack in O(1).
+ */
+static int nextjid(struct job_list_t *jl)
+{
+    int jid;
+
+    if (jl->free_jids == NULL)
+    {
+        if (jl->maxjid < MAXJID)
+        {
+            return jl->maxjid + 1;
+        }
+        jl->free_jids = Malloc(MAXJID * sizeof(int));
+        for (jid = MAXJID; jid >= 1; jid--)     // The smallest on top
+        {
+            if (jl->jid_index[jid] < 0)
             {
-                printf("Added job [%d] %d %s\n",
-                       job_list[i].jid,
-                       job_list[i].pid,
-                       job_list[i].cmdline);
+                jl->free_jids[jl->nfree_jids++] = jid;
             }
-            return true;
         }
     }
-    printf("Tried to create too many jobs\n");
-    return false;
+    if (jl->nfree_jids == 0)
+    {
+        return 0;
+    }
+    return jl->free_jids[--jl->nfree_jids];
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-bool deletejob(struct job_t *jl, pid_t pid) 
+/* addjob - Add a job to the job list */
+bool addjob(struct job_list_t *jl, pid_t pid, job_state state, const char *cmdline)
 {
     check_blocked();
-    int i;
+    struct job_t *job;
+    int slot, jid;
 
     if (pid < 1)
     {
-        if (verbose)
-        {
-            Sio_puts("deletejob: Invalid pid\n");
-        }
         return false;
     }
 
-    for (i = 0; i < MAXJOBS; i++)
+    if ((jid = nextjid(jl)) == 0)
     {
-        if (jl[i].pid == pid)
-        {
-            clearjob(&jl[i]);
-            nextjid = maxjid(jl)+1;
-            return true;
-        }
+        printf("Tried to create too many jobs\n");
+        return false;
     }
-    if (verbose)
+
+    if (jl->nfree == 0)
+    {
+        grow_jobs(jl);
+    }
+    if (jid >= jl->jid_index_size)
+    {
+        grow_jid_index(jl, jid);
+    }
+
+    slot = jl->free_slots[jl->nfree - 1];
+    jl->cmd_offset[slot] = append_cmdline(jl, cmdline);
+    jl->nfree--;
+    job = &jl->jobs[slot];
+    job->pid = pid;
+    job->jid = jid;
+    job->state = UNDEF;
+
+    jl->procs[slot].nprocs = 0;
+    jl->procs[slot].nlive = 0;
+    jl->procs[slot].failed_status = -1;
+    addjobproc(jl, job, pid);
+    jl->jid_index[jid] = slot;
+    if (jid > jl->maxjid)
     {
-        Sio_puts("deletejob: Invalid pid\n");
+        jl->maxjid = jid;
     }
-    return false;
+    setjobstate(jl, job, state);
+
+    if(verbose)
+    {
+        printf("Added job [%d] %d %s\n", job->jid, job->pid,
+               jobcmdline(jl, job));
+    }
+    return true;
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jl)
+/* addjobproc - Add a process to the pipeline of a job */
+bool addjobproc(struct job_list_t *jl, struct job_t *job, pid_t pid)
 {
     check_blocked();
-    int i;
+    int slot = job - jl->jobs;
+    struct job_procs *jp = &jl->procs[slot];
+    struct job_proc *proc;
 
-    for (i = 0; i < MAXJOBS; i++)
+    if (pid < 1)
     {
-        if (jl[i].state == FG)
-        {
-            return jl[i].pid;
-        }
+        return false;
     }
-    if (verbose)
+
+    if (jp->nprocs == jp->capacity)
     {
-        Sio_puts("fgpid: No foreground job found\n");
+        jp->capacity = jp->capacity ? 2 * jp->capacity : 1;
+        jp->procs = Realloc(jp->procs, jp->capacity * sizeof(struct job_proc));
     }
-    return 0;
+    if (2 * (jl->npids + 1) > jl->pid_index_size)
+    {
+        rebuild_pid_index(jl, 2 * jl->pid_index_size);
+    }
+
+    proc = &jp->procs[jp->nprocs++];
+    proc->pid = pid;
+    // The child cannot have been reaped yet, so pid still refers to it
+    proc->pidfd = -1;
+    if (jl->npidfds < jl->max_pidfds &&
+        (proc->pidfd = syscall(SYS_pidfd_open, pid, 0)) >= 0)
+    {
+        jl->npidfds++;
+    }
+    proc->status = -1;
+    jp->nlive++;
+
+    pid_index_insert(jl, pid, slot);
+    jl->npids++;
+    return true;
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jl, pid_t pid)
+/*
+ * getjobproc - Find a process of a job (by PID). Jobs only have as many
+ * processes as pipeline stages, so they are searched linearly.
+ */
+struct job_proc *getjobproc(struct job_list_t *jl, pid_t pid)
 {
     check_blocked();
-    int i;
+    int slot, i;
 
-    if (pid < 1)
+    if (pid < 1 || (slot = pid_index_slot(jl, pid)) < 0)
     {
-        if (verbose)
-        {
-            Sio_puts("getjobpid: Invalid pid\n");
-        }
         return NULL;
     }
-
-    for (i = 0; i < MAXJOBS; i++)
+    for (i = 0; i < jl->procs[slot].nprocs; i++)
     {
-        if (jl[i].pid == pid)
+        if (jl->procs[slot].procs[i].pid == pid)
         {
-            return &jl[i];
+            return &jl->procs[slot].procs[i];
         }
     }
-    if (verbose)
+    return NULL;
+}
+
+/*
+ * reapjobproc - Record the wait status of a reaped process. Only touches
+ * memory, so it is safe to call from a signal handler. The pidfd is left
+ * open until the job is deleted.
+ */
+bool reapjobproc(struct job_list_t *jl, pid_t pid, int status)
+{
+    check_blocked();
+    struct job_proc *proc = getjobproc(jl, pid);
+
+    if (proc == NULL)
+    {
+        return false;
+    }
+    if (proc->status < 0)
     {
-        Sio_puts("getjobpid: Invalid pid\n");
+        proc->status = status;
+        jl->procs[pid_index_slot(jl, pid)].nlive--;
     }
+    return jl->procs[pid_index_slot(jl, pid)].nlive == 0;
+}
 
-    return NULL;
+/* jobprocs - Return the processes of a job */
+struct job_proc *jobprocs(struct job_list_t *jl, struct job_t *job,
+                          int *nprocs)
+{
+    struct job_procs *jp = &jl->procs[job - jl->jobs];
+
+    *nprocs = jp->nprocs;
+    return jp->procs;
 }
 
-/* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jl, int jid) 
+/*
+ * failjobproc - Record the wait status of the last command of the pipeline
+ * of a job, which could not be started and so has no process
+ */
+void failjobproc(struct job_list_t *jl, struct job_t *job, int status)
+{
+    jl->procs[job - jl->jobs].failed_status = status;
+}
+
+/*
+ * joblaststatus - Return the wait status of the last command of the
+ * pipeline of a job: that of its process, which is the last one added,
+ * unless it could not be started
+ */
+int joblaststatus(struct job_list_t *jl, struct job_t *job)
+{
+    struct job_procs *jp = &jl->procs[job - jl->jobs];
+
+    if (jp->failed_status >= 0)
+    {
+        return jp->failed_status;
+    }
+    return jp->procs[jp->nprocs - 1].status;
+}
+
+/*
+ * deletejob - Delete the job of the process whose PID=pid from the job
+ * list. Only touches memory and closes pidfds, so it is safe to call from
+ * a signal handler; the process array is kept for the next job in the slot.
+ */
+bool deletejob(struct job_list_t *jl, pid_t pid)
 {
     check_blocked();
-    int i;
+    struct job_procs *jp;
+    int slot, i;
 
-    if (jid < 1)
+    if (pid < 1 || (slot = pid_index_slot(jl, pid)) < 0)
     {
         if (verbose)
         {
-            Sio_puts("getjobjid: Invalid jid\n");
+            Sio_puts("deletejob: Invalid pid\n");
         }
-        return NULL;
+        return false;
     }
-    
-    for (i = 0; i < MAXJOBS; i++)
+
+    jp = &jl->procs[slot];
+    for (i = 0; i < jp->nprocs; i++)
     {
-        if (jl[i].jid == jid)
+        pid_index_remove(jl, jp->procs[i].pid);
+        if (jp->procs[i].pidfd >= 0)
         {
-            return &jl[i];
+            close(jp->procs[i].pidfd);
+            jl->npidfds--;
         }
     }
+    jl->npids -= jp->nprocs;
+    jp->nprocs = 0;
+    jp->nlive = 0;
+    jl->jid_index[jl->jobs[slot].jid] = -1;
+    if (jl->free_jids != NULL)
+    {
+        jl->free_jids[jl->nfree_jids++] = jl->jobs[slot].jid;
+    }
+
+    // Until the stack is used, job IDs are allocated as maxjid + 1, so each
+    // decrement undoes an earlier allocation, and this is amortized O(1).
+    // Afterwards maxjid stays at MAXJID, as IDs come from the stack.
+    while (jl->free_jids == NULL && jl->maxjid > 0 &&
+           jl->jid_index[jl->maxjid] < 0)
+    {
+        jl->maxjid--;
+    }
+
+    if (jl->fg_slot == slot)
+    {
+        jl->fg_slot = -1;
+    }
+    jl->cmd_arena_dead += strlen(jl->cmd_arena + jl->cmd_offset[slot]) + 1;
+    clearjob(&jl->jobs[slot]);
+    jl->free_slots[jl->nfree++] = slot;
+    return true;
+}
+
+/* setjobstate - Change the state of a job */
+void setjobstate(struct job_list_t *jl, struct job_t *job, job_state state)
+{
+    check_blocked();
+    int slot = job - jl->jobs;
+
+    job->state = state;
+    if (state == FG)
+    {
+        jl->fg_slot = slot;
+    }
+    else if (jl->fg_slot == slot)
+    {
+        jl->fg_slot = -1;
+    }
+}
+
+/* jobcmdline - Return the command line of a job */
+const char *jobcmdline(struct job_list_t *jl, struct job_t *job)
+{
+    return jl->cmd_arena + jl->cmd_offset[job - jl->jobs];
+}
+
+/* jobpidfd - Return the pidfd of the leader of a job, -1 if none */
+int jobpidfd(struct job_list_t *jl, struct job_t *job)
+{
+    return jl->procs[job - jl->jobs].procs[0].pidfd;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct job_list_t *jl)
+{
+    check_blocked();
+
+    if (jl->fg_slot >= 0)
+    {
+        return jl->jobs[jl->fg_slot].pid;
+    }
     if (verbose)
     {
-        Sio_puts("getjobjid: Invalid jid\n");
+        Sio_puts("fgpid: No foreground job found\n");
     }
-    return NULL;
+    return 0;
 }
 
-/* pid2jid - Map process ID to job ID */
-int pid2jid(struct job_t *jl, pid_t pid) 
+/* getjobpid  - Find a job (by PID) on the job list */
+struct job_t *getjobpid(struct job_list_t *jl, pid_t pid)
 {
     check_blocked();
-    int i;
+    int slot;
 
-    if (pid < 1)
+    if (pid < 1 || (slot = pid_index_slot(jl, pid)) < 0)
     {
         if (verbose)
         {
-            Sio_puts("pid2jid: Invalid pid\n");
+            Sio_puts("getjobpid: Invalid pid\n");
         }
-        return 0;
+        return NULL;
     }
-    for (i = 0; i < MAXJOBS; i++)
+    return &jl->jobs[slot];
+}
+
+/* getjobjid  - Find a job (by JID) on the job list */
+struct job_t *getjobjid(struct job_list_t *jl, int jid)
+{
+    check_blocked();
+
+    if (jid < 1 || jid > jl->maxjid || jl->jid_index[jid] < 0)
     {
-        if (jl[i].pid == pid)
+        if (verbose)
         {
-            return jl[i].jid;
+            Sio_puts("getjobjid: Invalid jid\n");
         }
+        return NULL;
     }
-    if (verbose)
-    {
-        Sio_puts("pid2jid: Invalid pid\n");
-    }
-    return 0;
+    return &jl->jobs[jl->jid_index[jid]];
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jl, int output_fd) 
+/* pid2jid - Map process ID to job ID */
+int pid2jid(struct job_list_t *jl, pid_t pid)
 {
     check_blocked();
-    int i;
+    struct job_t *job = getjobpid(jl, pid);
+
+    return job != NULL ? job->jid : 0;
+}
+
+/* listjobs - Print the job list, in order of job ID */
+void listjobs(struct job_list_t *jl, int output_fd)
+{
+    check_blocked();
+    int jid;
+    struct job_t *job;
+    const char *cmdline;
     char buf[MAXLINE_TSH + 1];
 
-    for (i = 0; i < MAXJOBS; i++)
+    for (jid = 1; jid <= jl->maxjid; jid++)
     {
+        if (jl->jid_index[jid] < 0)
+        {
+            continue;
+        }
+        job = &jl->jobs[jl->jid_index[jid]];
+
         memset(buf, '\0', MAXLINE_TSH);
-        if (jl[i].pid != 0)
+        sprintf(buf, "[%d] (%d) ", job->jid, job->pid);
+        if(write(output_fd, buf, strlen(buf)) < 0)
         {
-            sprintf(buf, "[%d] (%d) ", jl[i].jid, jl[i].pid);
-            if(write(output_fd, buf, strlen(buf)) < 0)
-            {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(EXIT_FAILURE);
-            }
-            memset(buf, '\0', MAXLINE_TSH);
-            switch (jl[i].state)
-            {
-            case BG:
-                sprintf(buf, "Running    ");
-                break;
-            case FG:
-                sprintf(buf, "Foreground ");
-                break;
-            case ST:
-                sprintf(buf, "Stopped    ");
-                break;
-            default:
-                sprintf(buf, "listjobs: Internal error: job[%d].state=%d ",
-                        i, jl[i].state);
-            }
+            fprintf(stderr, "Error writing to output file\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(buf, '\0', MAXLINE_TSH);
+        switch (job->state)
+        {
+        case BG:
+            sprintf(buf, "Running    ");
+            break;
+        case FG:
+            sprintf(buf, "Foreground ");
+            break;
+        case ST:
+            sprintf(buf, "Stopped    ");
+            break;
+        default:
+            sprintf(buf, "listjobs: Internal error: job[%d].state=%d ",
+                    jid, job->state);
+        }
 
-            if(write(output_fd, buf, strlen(buf)) < 0)
-            {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(EXIT_FAILURE);
-            }
+        if(write(output_fd, buf, strlen(buf)) < 0)
+        {
+            fprintf(stderr, "Error writing to output file\n");
+            exit(EXIT_FAILURE);
+        }
 
-            memset(buf, '\0', MAXLINE_TSH);
-            sprintf(buf, "%s\n", jl[i].cmdline);
-            if(write(output_fd, buf, strlen(buf)) < 0)
-            {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(EXIT_FAILURE);
-            }
+        cmdline = jobcmdline(jl, job);
+        if(write(output_fd, cmdline, strlen(cmdline)) < 0 ||
+           write(output_fd, "\n", 1) < 0)
+        {
+            fprintf(stderr, "Error writing to output file\n");
+            exit(EXIT_FAILURE);
         }
     }
 }
@@ -515,10 +1301,12 @@ void listjobs(struct job_t *jl, int output_fd)
  */
 void usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpef]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -e   handle signals in a signalfd/epoll event loop\n");
+    printf("   -f   launch jobs with fork and execve instead of posix_spawn\n");
     exit(EXIT_FAILURE);
 }
 
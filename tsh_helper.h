@@ -15,11 +15,16 @@
 #include <assert.h>
 #include "csapp.h"
 #include <stdbool.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include "arena.h"
+#include "scanner.h"
+#include "vars.h"
 
-#define MAXLINE_TSH     1024    // max line size
-#define MAXARGS         128     // max args on a command line
-#define MAXJOBS         16      // max jobs at any point in time
-#define MAXJID          1<<16   // max job ID
+#define MAXLINE_TSH     1024    // max size of a composed message
+#define INITJOBS        16      // initial capacity of the job list
+#define MAXJID          (1<<22) // max job ID
 
 /* 
  * Job states: FG (foreground), BG (background), ST (stopped),
@@ -50,32 +55,167 @@ typedef enum parseline_return
     PARSELINE_ERROR
 } parseline_return;
 
-// Builtin states for shell to execute
+// Redirection types
+typedef enum redir_type
+{
+    REDIR_IN,                   // [n]<file
+    REDIR_OUT,                  // [n]>file
+    REDIR_APPEND,               // [n]>>file
+    REDIR_RDWR,                 // [n]<>file
+    REDIR_DUP,                  // [n]>&m, [n]<&m, or [n]>&- to close
+    REDIR_HEREDOC,              // [n]<<word, the body gathered into word
+    REDIR_HERESTRING            // [n]<<<word
+} redir_type;
+
+// Builtin states for shell to execute, one for each entry of builtins.def
 typedef enum builtin_state
 {
     BUILTIN_NONE,
-    BUILTIN_QUIT,
-    BUILTIN_JOBS,
-    BUILTIN_BG,
-    BUILTIN_FG
+#define BUILTIN(id, name, function, flags) BUILTIN_##id,
+#include "builtins.def"
+#undef BUILTIN
+    NBUILTINS
 } builtin_state;
 
-struct job_t                    // The job struct
+// Where a builtin may run, see builtins.def
+enum builtin_flags
+{
+    BUILTIN_RUNS_FG = 1,        // In the shell, as a foreground command
+    BUILTIN_REDIRECTABLE = 2,   // With its I/O redirected
+    BUILTIN_RUNS_BG = 4,        // In a forked subshell
+    BUILTIN_REPLACES_PATH = 8   // For /bin/name and /usr/bin/name too
+};
+
+struct builtin_info             // The registry entry of a builtin
+{
+    const char *name;           // The name it is typed as
+    int flags;                  // Where it may run, from builtin_flags
+};
+
+extern const struct builtin_info builtin_info[NBUILTINS];
+extern bool builtin_disabled[NBUILTINS];    // Turned off by enable -n
+
+/*
+ * Hashes a builtin name with a seed, for the perfect hash generated by
+ * mkbuiltins. Stops at the end of the name or after BUILTIN_MAXNAME bytes.
+ */
+#define BUILTIN_MAXNAME 16
+static inline uint32_t builtin_hash(const char *name, uint32_t seed) {
+    uint32_t h = seed;
+    int i;
+
+    for (i = 0; name[i] != '\0' && i < BUILTIN_MAXNAME; i++) {
+        h = (h ^ (unsigned char) name[i]) * 16777619u;
+    }
+    return h ^ (h >> 15) ^ i;
+}
+
+struct job_t                    // The job struct (hot fields only)
 {
     pid_t pid;                  // Job PID
     int jid;                    // Job ID [1, 2, ...] defined in tsh_helper.c
     job_state state;            // UNDEF, BG, FG, or ST
-    char cmdline[MAXLINE_TSH];  // Command line
 };
 
-struct cmdline_tokens
+struct job_proc                 // A process of a job
+{
+    pid_t pid;                  // Process ID
+    int pidfd;                  // Pidfd of the process, -1 if none
+    int status;                 // Wait status once reaped, -1 before
+};
+
+struct job_procs                // The processes of a job, in pipeline order
+{
+    struct job_proc *procs;     // The processes, reused by later jobs
+    int nprocs;                 // Number of processes in the job
+    int nlive;                  // Number of processes not yet reaped
+    int failed_status;          // Wait status of a last command that could
+                                // not be started, -1 if it was started
+    int capacity;               // Number of entries allocated in procs
+};
+
+struct pid_entry                // An entry of the PID hash index
+{
+    pid_t pid;                  // Job PID, 0 if the entry is empty
+    int slot;                   // Slot of the job in jobs[]
+};
+
+/*
+ * The job list. Jobs live in a growable array of slots, and unused slots
+ * are recycled through a stack. A PID hash index (open addressing with
+ * linear probing) and a direct JID index map each key to its slot, and the
+ * slot of the foreground job is cached, so no lookup scans the slots.
+ *
+ * Only the fields that lookups compare are kept in the slots. Command lines
+ * are appended to a string arena and found through a parallel array of
+ * offsets; the arena is compacted once deleted jobs own most of it.
+ *
+ * A job is a pipeline of one or more processes that share a process group
+ * led by the first one. Every process of a job is in the PID index, and
+ * holds a pidfd opened when it is added, so signals and waits can target
+ * the job even if a PID is reused after its process was reaped. Pidfds
+ * take at most half of the descriptors RLIMIT_NOFILE allows, so many live
+ * jobs leave room for pipes and files; a process added past that holds
+ * none, and is reaped through SIGCHLD and waitpid instead.
+ */
+struct job_list_t
+{
+    struct job_t *jobs;         // Job slots
+    int capacity;               // Number of allocated slots
+    int *free_slots;            // Stack of unused slots
+    int nfree;                  // Number of slots on the free stack
+    struct pid_entry *pid_index; // PID hash index
+    int pid_index_size;         // Number of entries, a power of two
+    int npids;                  // Number of PIDs in the index
+    int *jid_index;             // Slot of each job ID, -1 if unused
+    int jid_index_size;         // Number of entries in jid_index
+    int maxjid;                 // Largest allocated job ID, MAXJID once
+                                // free_jids is used
+    int *free_jids;             // Stack of unused job IDs, once MAXJID was
+                                // reached, NULL before
+    int nfree_jids;             // Number of job IDs on the stack
+    int fg_slot;                // Slot of the foreground job, -1 if none
+    int npidfds;                // Number of pidfds open
+    int max_pidfds;             // Number of pidfds that may be open at once
+    struct job_procs *procs;    // Processes of each slot's job
+    size_t *cmd_offset;         // Offset of each slot's command line
+    char *cmd_arena;            // NUL-terminated command lines
+    size_t cmd_arena_size;      // Number of bytes allocated for cmd_arena
+    size_t cmd_arena_used;      // Number of bytes appended to cmd_arena
+    size_t cmd_arena_dead;      // Number of bytes owned by deleted jobs
+};
+
+struct redirection              // One redirection of a command
+{
+    int fd;                     // The descriptor that is redirected
+    redir_type type;            // How it is redirected
+    char *file;                 // The file, NULL for REDIR_DUP, or the
+                                // text of a here-document or here-string
+    int dup_fd;                 // The descriptor copied, -1 to close fd
+};
+
+struct cmd_stage                // One command of a pipeline
 {
-    char text[MAXLINE_TSH];     // Modified text from command line
     int argc;                   // Number of arguments
-    char *argv[MAXARGS];        // The arguments list
-    char *infile;               // The input file
-    char *outfile;              // The output file
-    builtin_state builtin;      // Indicates if argv[0] is a builtin command
+    char **argv;                // The arguments list, NULL terminated
+    int nassigns;               // Assignments in front, at argv[-nassigns]
+    int nredirs;                // Number of redirections
+    struct redirection *redirs; // Redirections, in command order
+    builtin_state builtin;      // The builtin argv[0] names, if any
+};
+
+/*
+ * The tokens of a command line, allocated from command_arena, so they
+ * stay valid until the arena is reset after the command.
+ */
+struct cmdline_tokens
+{
+    char *text;                 // Modified text from command line
+    int argc;                   // Number of arguments of the first stage
+    char **argv;                // The arguments of all stages, in order
+    int nstages;                // Number of commands in the pipeline
+    struct cmd_stage *stages;   // The commands, linked by pipes
+    builtin_state builtin;      // The builtin the shell runs itself, if any
 
 };
 
@@ -85,11 +225,12 @@ extern char prompt[];               // Command line prompt (do not change)
 extern bool verbose;                // If true, prints additional output
 extern bool check_block;            // If true, check that signals are blocked
 
-extern struct job_t job_list[MAXJOBS];  // The job list
+extern struct job_list_t job_list;  // The job list
 
 /*
  * parseline takes in the command line and pointer to a token struct.
- * It parses the command line and populates the token struct
+ * It parses the command line and populates the token struct, with memory
+ * from command_arena. Lines and argument lists can be of any length.
  * It returns the following values of enumerated type parseline_return:
  *   PARSELINE_EMPTY        if the command line is empty
  *   PARSELINE_BG           if the user has requested a BG job
@@ -99,6 +240,37 @@ extern struct job_t job_list[MAXJOBS];  // The job list
 parseline_return parseline(const char *cmdline,
                            struct cmdline_tokens *token);
 
+/*
+ * parseline_background makes the tokens of a pipeline that parseline
+ * returned PARSELINE_FG for those of the same pipeline followed by &, so
+ * a pipeline parsed once can run either way. It returns PARSELINE_BG, or
+ * PARSELINE_ERROR if its builtin cannot run in the background.
+ */
+parseline_return parseline_background(struct cmdline_tokens *token);
+
+/*
+ * lookup_builtin returns the builtin a command name stands for, or
+ * BUILTIN_NONE, in constant time. Disabled builtins are not found.
+ */
+builtin_state lookup_builtin(const char *name);
+
+/*
+ * word_quote returns the quote character a word of parsed tokens was
+ * enclosed in, or 0 if it was not quoted.
+ */
+char word_quote(const struct cmdline_tokens *token, const char *word);
+
+/*
+ * subst_end returns the byte after the ) that closes the command
+ * substitution a $( starts at p, or NULL if it is not closed.
+ */
+const char *subst_end(const char *p);
+
+/*
+ * builtin_entry returns the registry entry of a builtin.
+ */
+const struct builtin_info *builtin_entry(builtin_state id);
+
 /*
  * sigquit_handler terminates the shell due to SIGQUIT signal.
  */
@@ -107,7 +279,7 @@ void sigquit_handler(int sig);
 /*
  * initjobs initializes the supplied job list.
  */
-void initjobs(struct job_t *jl);
+void initjobs(struct job_list_t *jl);
 
 /*
  * addjob takes in a job list, a process ID, a job state, and the command line
@@ -115,45 +287,106 @@ void initjobs(struct job_t *jl);
  * the job list. Returns true on success, and false otherwise.
  * See the job_t struct above for more details.
  */
-bool addjob(struct job_t *jl, pid_t pid, job_state state,
+bool addjob(struct job_list_t *jl, pid_t pid, job_state state,
             const char *cmdline);
 
 /*
- * deletejob deletes the job with the supplied process ID from the job list.
+ * addjobproc adds a process to the pipeline of the supplied job.
+ * Returns true on success, and false otherwise.
+ */
+bool addjobproc(struct job_list_t *jl, struct job_t *job, pid_t pid);
+
+/*
+ * reapjobproc records the wait status of the process with the supplied
+ * process ID. It returns true if no process of the job is left to reap.
+ */
+bool reapjobproc(struct job_list_t *jl, pid_t pid, int status);
+
+/*
+ * getjobproc returns the process with the supplied process ID, or NULL
+ * if no job has a process with this pid.
+ */
+struct job_proc *getjobproc(struct job_list_t *jl, pid_t pid);
+
+/*
+ * jobprocs returns the processes of the supplied job, in pipeline order,
+ * and stores their number in nprocs.
+ */
+struct job_proc *jobprocs(struct job_list_t *jl, struct job_t *job,
+                          int *nprocs);
+
+/*
+ * failjobproc records that the last command of the pipeline of the
+ * supplied job could not be started, with the wait status to report for
+ * it in place of one of a process.
+ */
+void failjobproc(struct job_list_t *jl, struct job_t *job, int status);
+
+/*
+ * joblaststatus returns the wait status of the last command of the
+ * pipeline of the supplied job, once every process of it was reaped.
+ */
+int joblaststatus(struct job_list_t *jl, struct job_t *job);
+
+/*
+ * deletejob deletes the job that the process with the supplied process ID
+ * belongs to from the job list, closing the pidfds of its processes.
  * It returns true if successful and false if no job with this pid is found.
  */
-bool deletejob(struct job_t *jl, pid_t pid);
+bool deletejob(struct job_list_t *jl, pid_t pid);
+
+/*
+ * setjobstate changes the state of the supplied job, keeping track of
+ * which job is in the foreground. Job states must only be changed
+ * through this routine.
+ */
+void setjobstate(struct job_list_t *jl, struct job_t *job, job_state state);
+
+/*
+ * jobcmdline returns the command line of the supplied job. The string
+ * is only valid until the next call to addjob.
+ */
+const char *jobcmdline(struct job_list_t *jl, struct job_t *job);
+
+/*
+ * jobpidfd returns the pidfd of the process group leader of the supplied
+ * job, or -1 if the kernel does not support pidfds or the leader was added
+ * while the job list held as many pidfds as it may. It stays open until
+ * the job is deleted, so it names the process group even after the
+ * leader was reaped.
+ */
+int jobpidfd(struct job_list_t *jl, struct job_t *job);
 
 /*
  * fgpid returns the process ID of the foreground job in the
  * supplied job list.
  */
-pid_t fgpid(struct job_t *jl);
+pid_t fgpid(struct job_list_t *jl);
 
 /*
  * getjobpid takes in a job list and a process ID, and returns either
  * a pointer the job struct with the respective process ID, or
  * NULL if a job with the given process ID does not exist.
  */
-struct job_t *getjobpid(struct job_t *jl, pid_t pid);
+struct job_t *getjobpid(struct job_list_t *jl, pid_t pid);
 
 /*
  * getjobjid takes in a job list and a job ID, and returns either
  * a pointer the job struct with the respective job ID, or
  * NULL if a job with the given job ID does not exist.
  */
-struct job_t *getjobjid(struct job_t *jl, int jid);
+struct job_t *getjobjid(struct job_list_t *jl, int jid);
 
 /*
  * pid2jid converts the supplied process ID into its corresponding
  * job ID in the job list.
  */
-int pid2jid(struct job_t *jl, pid_t pid); 
+int pid2jid(struct job_list_t *jl, pid_t pid); 
 
 /*
  * listjobs prints the job list.
  */
-void listjobs(struct job_t *jl, int output_fd);
+void listjobs(struct job_list_t *jl, int output_fd);
 
 /*
  * usage prints the usage of the tiny shell.
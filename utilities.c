@@ -6,8 +6,35 @@
 
 /* Global variables */
 sigset_t job_control_mask;      // Signal set of the job control signals.
-int in_fd = STDIN_FILENO;       // Input file descriptor.
-int out_fd = STDOUT_FILENO;     // Output file descriptor.
+bool event_loop = false;        // If true, signals are read from signal_fd.
+int signal_fd = -1;             // Signalfd for the job control signals.
+int epoll_fd = -1;              // Epoll instance of the event loop.
+bool fork_launch = false;       // If true, jobs are started with fork.
+int last_status = 0;            // Exit status of the last command, $?
+bool subshell = false;          // If true, this is a background list.
+volatile sig_atomic_t interrupted = false;  // SIGINT arrived during the line
+int loop_depth = 0;             // Number of loops the command runs in
+int loop_breaks = 0;            // Loops a break still has to leave
+int loop_continues = 0;         // Loops a continue still has to leave
+bool returning = false;         // If true, return leaves the function
+int script_argc = 0;            // Number of arguments of the function, $#
+char **script_argv = NULL;      // Arguments of the function, $1 to $9
+
+static struct saved_fd *fd_stack = NULL;    // Descriptors saved by builtins
+static int fd_stack_size = 0;               // Number of entries allocated
+static int fd_stack_used = 0;               // Number of entries in use
+static unsigned user_fds = 0;   // Bit n set if the shell started with fd n
+
+/*
+ * Converts a wait status to an exit status for $?: the exit status of a
+ * process that exited, or 128 plus the signal that terminated it.
+ *
+ * @param wstatus the wait status.
+ * @return the exit status.
+ */
+int wait_status_code(int wstatus) {
+    return WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+}
 
 /*
  * Restores signals to their default behaviors.
@@ -51,28 +78,136 @@ sigset_t create_mask(int argc, ...) {
     return mask;
 }
 
+/*
+ * Blocks the job control signals before the job list is accessed.
+ *
+ * In event loop mode the job control signals are always blocked,
+ * so no action is taken.
+ *
+ * @param old_mask if not NULL, receives the previous signal mask.
+ * @return void
+ */
+void block_job_signals(sigset_t *old_mask) {
+    if (!event_loop) {
+        Sigprocmask(SIG_BLOCK, &job_control_mask, old_mask);
+    }
+}
+
+/*
+ * Unblocks the job control signals after the job list was accessed.
+ *
+ * In event loop mode the job control signals are always blocked,
+ * so no action is taken.
+ *
+ * @return void
+ */
+void unblock_job_signals(void) {
+    if (!event_loop) {
+        Sigprocmask(SIG_UNBLOCK, &job_control_mask, NULL);
+    }
+}
+
+/*
+ * Sends a signal to the process group of a job.
+ *
+ * The signal goes through the job's pidfd, so it cannot reach an unrelated
+ * process group that reused the job's PID. Falls back to kill() when the
+ * kernel cannot signal a process group through a pidfd, or when the leader
+ * was reaped while the rest of its group runs on, as the subshell of a
+ * process substitution may be; its PID is not reused while the group lives.
+ *
+ * This function is signal safe.
+ *
+ * @param job the job to signal.
+ * @param sig the signal to send.
+ * @return void
+ */
+void signal_job(struct job_t *job, int sig) {
+    int pidfd = jobpidfd(&job_list, job);
+
+    if (pidfd >= 0 && syscall(SYS_pidfd_send_signal, pidfd, sig, NULL,
+                              PIDFD_SIGNAL_PROCESS_GROUP) == 0) {
+        return;
+    }
+    if (pidfd >= 0 && errno == ESRCH) {
+        kill(-job->pid, sig);
+    } else if (pidfd < 0 || errno == EINVAL || errno == ENOSYS) {
+        Kill(-job->pid, sig);
+    }
+}
+
+/*
+ * Adds the pidfds of the processes of a job to the epoll instance of the
+ * event loop, so the exit of the job wakes the shell up even while it
+ * waits for input.
+ *
+ * In signal handler mode, or if the job is NULL or has no pidfds,
+ * no action is taken.
+ *
+ * @param job the job to watch.
+ * @return void
+ */
+void watch_job(struct job_t *job) {
+    struct epoll_event event;
+    struct job_proc *procs;
+    int i, nprocs;
+
+    if (!event_loop || job == NULL) {
+        return;
+    }
+    procs = jobprocs(&job_list, job, &nprocs);
+    for (i = 0; i < nprocs; i++) {
+        if (procs[i].pidfd < 0 || procs[i].status >= 0) {
+            continue;           // Reaped before the job was watched
+        }
+        event.events = EPOLLIN;
+        event.data.u64 = procs[i].pid;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, procs[i].pidfd, &event) < 0) {
+            unix_error("epoll_ctl error");
+        }
+    }
+}
+
+/*
+ * Removes the pidfd of a process of a job from the epoll instance of the
+ * event loop. Must be called once the process was reaped, since its pidfd
+ * stays readable until the job is deleted.
+ *
+ * In signal handler mode, or if the process is NULL or has no pidfd,
+ * no action is taken.
+ *
+ * @param proc the process to stop watching.
+ * @return void
+ */
+void unwatch_proc(struct job_proc *proc) {
+    if (event_loop && proc != NULL && proc->pidfd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, proc->pidfd, NULL);
+    }
+}
+
 /* Prints a message to the shell when a job is terminated or stopped by a signal.
  *
  * This function is signal safe and is intended for use in a signal handler.
  *
  * @param jid the jod id of the job that was terminated or stopped.
  * @param pid the process id of the job that was terminated or stopped.
- * @param sig expected to be either SIGINT or SIGTSTP.
+ * @param wstatus the wait status of the process that was terminated or
+ *        stopped by a signal.
  * @return void.
  */
-void printMsg(int jid, pid_t pid, int sig) {
+void printMsg(int jid, pid_t pid, int wstatus) {
     Sio_puts("Job [");
     Sio_putl(jid);
     Sio_puts("] (");
     Sio_putl(pid);
     Sio_puts(") ");
-    if (sig == SIGINT) {
-        Sio_puts("terminated");
-    } else if (sig == SIGTSTP) {
-        Sio_puts("stopped");
+    if (WIFSTOPPED(wstatus)) {
+        Sio_puts("stopped by signal ");
+        Sio_putl(WSTOPSIG(wstatus));
+    } else {
+        Sio_puts("terminated by signal ");
+        Sio_putl(WTERMSIG(wstatus));
     }
-    Sio_puts(" by signal ");
-    Sio_putl(sig);
     Sio_puts("\n");
 }
 
@@ -89,50 +224,274 @@ int cmdjid_to_int(char *cmdjid) {
 }
 
 /*
- * Redirects I/O from a file descriptor to another file.
+ * Checks whether a descriptor is open once the steps of a plan so far
+ * have been applied.
+ *
+ * @param plan the plan being built.
+ * @param fd the descriptor to check.
+ * @return true if fd would be open, false otherwise.
+ */
+static bool plan_has_fd(const struct redir_plan *plan, int fd) {
+    int i;
+
+    for (i = plan->nactions - 1; i >= 0; i--) {
+        if (plan->actions[i].dst == fd) {
+            return plan->actions[i].src >= 0;
+        }
+    }
+
+    // The other descriptors of the shell are its own, not the user's
+    return fd < REDIR_MIN_FD && (user_fds & (1u << fd)) != 0 &&
+           fcntl(fd, F_GETFD) >= 0;
+}
+
+/*
+ * Records the descriptors below REDIR_MIN_FD that the shell was started
+ * with, the only ones of its own that [n]>&m may copy. The shell opens its
+ * signalfd, epoll instance, pidfds, inotify instance and the directories of
+ * PATH afterwards, in the lowest free descriptors, and a job must not get
+ * them.
  *
- * For output redirection if file does not exists it will be created.
- * However, file must exists already for input redirection.
+ * @return void
+ */
+void redir_init(void) {
+    int fd;
+
+    for (fd = 0; fd < REDIR_MIN_FD; fd++) {
+        if (fcntl(fd, F_GETFD) >= 0) {
+            user_fds |= 1u << fd;
+        }
+    }
+}
+
+/*
+ * Resolves the redirections of a command into a plan of dup2 steps.
  *
- * @param from expected to be either STDOUT_FILENO or STDIN_FILENO.
- * @param to the name of the file that the descriptor will be redirected to.
+ * The files are opened here, in the shell, with close-on-exec set and the
+ * open flags and mode of each redirection, and the descriptors copied by
+ * [n]>&m are checked, so applying the plan cannot fail. Output files are
+ * truncated, and >> opens them in append mode, so concurrent jobs can
+ * append to one file without overwriting each other's writes. The text of
+ * a here-document or here-string is put in a sealed memfd instead.
+ *
+ * The plan is allocated from command_arena. On failure an error message
+ * is printed and nothing is left open.
+ *
+ * @param stage the command whose redirections are resolved.
+ * @param plan the plan to fill in.
+ * @return true if the plan was built, false otherwise.
  */
-void redirect_io(int from, char* to) {
-    int file;
+bool plan_redirections(const struct cmd_stage *stage, struct redir_plan *plan) {
+    const struct redirection *redir;
+    int i, fd, flags;
+
+    plan->nactions = 0;
+    plan->nopened = 0;
+    plan->actions = arena_alloc(&command_arena,
+                                stage->nredirs * sizeof(struct fd_action));
+    plan->opened = arena_alloc(&command_arena, stage->nredirs * sizeof(int));
+
+    for (i = 0; i < stage->nredirs; i++) {
+        redir = &stage->redirs[i];
 
-    switch (from) {
-        case STDIN_FILENO:
-            if ((file = open(to, O_RDONLY)) < 0) {
-                unix_error("open error");
-                exit(1);
+        if (redir->type == REDIR_DUP) {
+            if (redir->dup_fd >= 0 && !plan_has_fd(plan, redir->dup_fd)) {
+                fprintf(stderr, "%d: Bad file descriptor\n", redir->dup_fd);
+                close_redirections(plan);
+                return false;
             }
-            in_fd = file;
-            break;
-        case STDOUT_FILENO:
-            if ((file = open(to, O_CREAT | O_WRONLY)) < 0) {
-                unix_error("open error");
-                exit(1);
+            plan->actions[plan->nactions].src = redir->dup_fd;
+            plan->actions[plan->nactions++].dst = redir->fd;
+            continue;
+        }
+
+        switch (redir->type) {
+            case REDIR_IN:
+                flags = O_RDONLY;
+                break;
+            case REDIR_OUT:
+                flags = O_WRONLY | O_CREAT | O_TRUNC;
+                break;
+            case REDIR_APPEND:
+                flags = O_WRONLY | O_CREAT | O_APPEND;
+                break;
+            case REDIR_HEREDOC:
+            case REDIR_HERESTRING:
+                flags = -1;     // Held by a memfd rather than a file
+                break;
+            default:
+                flags = O_RDWR | O_CREAT;
+                break;
+        }
+
+        fd = flags < 0
+             ? heredoc_open(redir->file, redir->type == REDIR_HERESTRING)
+             : open(redir->file, flags | O_CLOEXEC, DEF_MODE);
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n",
+                    flags < 0 ? "here-document" : redir->file,
+                    strerror(errno));
+            close_redirections(plan);
+            return false;
+        }
+
+        // Keep the file clear of the descriptors the plan replaces
+        if (fd < REDIR_MIN_FD) {
+            int moved = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_MIN_FD);
+            close(fd);
+            if ((fd = moved) < 0) {
+                fprintf(stderr, "%s: %s\n", redir->file, strerror(errno));
+                close_redirections(plan);
+                return false;
             }
-            out_fd = file;
-            break;
+        }
+
+        plan->opened[plan->nopened++] = fd;
+        plan->actions[plan->nactions].src = fd;
+        plan->actions[plan->nactions++].dst = redir->fd;
     }
+    return true;
+}
+
+/*
+ * Applies a redirection plan to the calling process, with one dup2 or
+ * close per step. Intended for the child of a job, before it executes the
+ * command. Only makes async-signal-safe calls.
+ *
+ * @param plan the plan to apply.
+ * @return true on success, false if a step failed.
+ */
+bool apply_redirections(const struct redir_plan *plan) {
+    const struct fd_action *action;
+    int i;
 
-    Dup2(file, from);
+    for (i = 0; i < plan->nactions; i++) {
+        action = &plan->actions[i];
+        if (action->src < 0) {
+            close(action->dst);
+        } else if (action->src == action->dst) {
+            // The descriptor is kept, but must survive the exec
+            if (fcntl(action->dst, F_SETFD, 0) < 0) {
+                return false;
+            }
+        } else if (dup2(action->src, action->dst) < 0) {
+            return false;
+        }
+    }
+    return true;
 }
 
 /*
- * Sets the file descriptor for input to STDIN_FILENO and
- * the file descriptor for output to STDOUT_FILENO.
+ * Closes the files opened for a redirection plan. The shell calls this
+ * once the job using the plan was started.
+ *
+ * @param plan the plan whose files are closed.
+ * @return void
  */
-void set_std_io(void) {
-    if (in_fd != STDIN_FILENO) {
-        Dup2(in_fd, STDIN_FILENO);
-        close(in_fd);
-        in_fd = STDIN_FILENO;
+void close_redirections(struct redir_plan *plan) {
+    int i;
+
+    for (i = 0; i < plan->nopened; i++) {
+        close(plan->opened[i]);
     }
-    if (out_fd != STDOUT_FILENO) {
-        Dup2(in_fd, STDOUT_FILENO);
-        close(out_fd);
-        out_fd = STDOUT_FILENO;
+    plan->nopened = 0;
+}
+
+/*
+ * Saves a descriptor of the shell on the fd stack, so it can be put back
+ * exactly with restore_fds. The copy is made with F_DUPFD_CLOEXEC, so it
+ * never leaks into the jobs started while it is saved.
+ *
+ * @param fd the descriptor to save.
+ * @return true on success, false if no copy could be made.
+ */
+bool save_fd(int fd) {
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, REDIR_MIN_FD);
+
+    if (copy < 0 && errno != EBADF) {
+        fprintf(stderr, "%d: %s\n", fd, strerror(errno));
+        return false;
+    }
+    if (fd_stack_used == fd_stack_size) {
+        fd_stack_size = fd_stack_size ? 2 * fd_stack_size : 16;
+        fd_stack = Realloc(fd_stack, fd_stack_size * sizeof(struct saved_fd));
+    }
+    fd_stack[fd_stack_used].fd = fd;
+    fd_stack[fd_stack_used].flags = copy >= 0 ? fcntl(fd, F_GETFD) : 0;
+    fd_stack[fd_stack_used++].copy = copy;
+    return true;
+}
+
+/*
+ * Returns the current depth of the fd stack, to be passed to restore_fds.
+ *
+ * @return the depth of the fd stack.
+ */
+int fd_stack_mark(void) {
+    return fd_stack_used;
+}
+
+/*
+ * Puts back every descriptor saved since the supplied mark, most recent
+ * first, so nested redirections unwind in the reverse order they were
+ * made.
+ *
+ * @param mark a depth returned by fd_stack_mark.
+ * @return void
+ */
+void restore_fds(int mark) {
+    struct saved_fd *saved;
+
+    fflush(stdout);             // Output of the builtin goes to its file
+    while (fd_stack_used > mark) {
+        saved = &fd_stack[--fd_stack_used];
+        if (saved->copy >= 0) {
+            dup2(saved->copy, saved->fd);
+            if (saved->flags != 0) {
+                fcntl(saved->fd, F_SETFD, saved->flags);
+            }
+            close(saved->copy);
+        } else {
+            close(saved->fd);   // The shell did not have this descriptor
+        }
+    }
+}
+
+/*
+ * Applies a redirection plan to the shell itself, for a builtin command.
+ * The descriptors it replaces are saved on the fd stack, and the files of
+ * the plan are closed once they were copied into place.
+ *
+ * @param plan the plan to apply.
+ * @return the mark to pass to restore_fds afterwards, or -1 if the shell's
+ *         descriptors could not be saved, in which case nothing was changed.
+ */
+int redirect_shell(struct redir_plan *plan) {
+    int mark = fd_stack_mark();
+    int i, j, fd;
+
+    fflush(stdout);             // Earlier output still goes to the old file
+    for (i = 0; i < plan->nactions; i++) {
+        fd = plan->actions[i].dst;
+
+        // Only the first redirection of a descriptor needs to save it
+        for (j = 0; j < i; j++) {
+            if (plan->actions[j].dst == fd) {
+                break;
+            }
+        }
+        if (j == i && !save_fd(fd)) {
+            restore_fds(mark);
+            close_redirections(plan);
+            return -1;
+        }
+
+        if (plan->actions[i].src < 0) {
+            close(fd);
+        } else if (plan->actions[i].src != fd) {
+            dup2(plan->actions[i].src, fd);
+        }
     }
+    close_redirections(plan);
+    return mark;
 }
@@ -8,13 +8,62 @@
 //#define DEBUG       // Uncomment for debugging printouts.
 
 #include "tsh_helper.h"
+#include "heredoc.h"
 #include <string.h>
 #include <stdarg.h>
+#include <sys/epoll.h>
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP  (1UL << 2)  // Linux 6.9 and later
+#endif
+
+#define REDIR_MIN_FD    10      // Files of a plan are opened at or above this
+
+struct fd_action                // One step of a redirection plan
+{
+    int src;                    // Descriptor to copy, -1 to close dst
+    int dst;                    // Descriptor that is replaced
+};
+
+struct saved_fd                 // A descriptor of the shell, while redirected
+{
+    int fd;                     // The descriptor that was replaced
+    int copy;                   // Close-on-exec copy of it, -1 if it was closed
+    int flags;                  // Its descriptor flags, dup2 clears them
+};
+
+struct redir_plan               // The redirections of a command, resolved
+{
+    int nactions;               // Number of steps
+    struct fd_action *actions;  // The steps, in command order
+    int nopened;                // Number of files opened for the plan
+    int *opened;                // The opened files, close-on-exec
+};
 
 /* Global variables */
 extern sigset_t job_control_mask;   // Signal set of the job control signals.
-extern int in_fd;                   // Input file descriptor.
-extern int out_fd;                  // Output file descriptor.
+extern bool event_loop;             // If true, signals are read from signal_fd.
+extern int signal_fd;               // Signalfd for the job control signals.
+extern int epoll_fd;                // Epoll instance of the event loop.
+extern bool fork_launch;            // If true, jobs are started with fork.
+extern int last_status;             // Exit status of the last command, $?
+extern bool subshell;               // If true, this is a background list.
+extern volatile sig_atomic_t interrupted;   // SIGINT arrived during the line
+extern int loop_depth;              // Number of loops the command runs in
+extern int loop_breaks;             // Loops a break still has to leave
+extern int loop_continues;          // Loops a continue still has to leave
+extern bool returning;              // If true, return leaves the function
+extern int script_argc;             // Number of arguments of the function, $#
+extern char **script_argv;          // Arguments of the function, $1 to $9
+
+/*
+ * Converts a wait status to an exit status for $?: the exit status of a
+ * process that exited, or 128 plus the signal that terminated it.
+ *
+ * @param wstatus the wait status.
+ * @return the exit status.
+ */
+int wait_status_code(int wstatus);
 
 /*
  * Restores signals to their default behaviors.
@@ -37,6 +86,67 @@ void restore_signal_defaults(int argc, ...);
  */
 sigset_t create_mask(int argc, ...);
 
+/*
+ * Blocks the job control signals before the job list is accessed.
+ *
+ * In event loop mode the job control signals are always blocked,
+ * so no action is taken.
+ *
+ * @param old_mask if not NULL, receives the previous signal mask.
+ * @return void
+ */
+void block_job_signals(sigset_t *old_mask);
+
+/*
+ * Unblocks the job control signals after the job list was accessed.
+ *
+ * In event loop mode the job control signals are always blocked,
+ * so no action is taken.
+ *
+ * @return void
+ */
+void unblock_job_signals(void);
+
+/*
+ * Sends a signal to the process group of a job.
+ *
+ * The signal goes through the job's pidfd, so it cannot reach an unrelated
+ * process group that reused the job's PID. Falls back to kill() when the
+ * kernel cannot signal a process group through a pidfd.
+ *
+ * This function is signal safe.
+ *
+ * @param job the job to signal.
+ * @param sig the signal to send.
+ * @return void
+ */
+void signal_job(struct job_t *job, int sig);
+
+/*
+ * Adds the pidfds of the processes of a job to the epoll instance of the
+ * event loop, so the exit of the job wakes the shell up even while it
+ * waits for input.
+ *
+ * In signal handler mode, or if the job is NULL or has no pidfds,
+ * no action is taken.
+ *
+ * @param job the job to watch.
+ * @return void
+ */
+void watch_job(struct job_t *job);
+
+/*
+ * Removes the pidfd of a process of a job from the epoll instance of the
+ * event loop. Must be called once the process was reaped, since its pidfd
+ * stays readable until the job is deleted.
+ *
+ * In signal handler mode, or if the process is NULL or has no pidfd,
+ * no action is taken.
+ *
+ * @param proc the process to stop watching.
+ * @return void
+ */
+void unwatch_proc(struct job_proc *proc);
 
 /* Prints a message to the shell when a job is terminated or stopped by a signal.
  *
@@ -44,10 +154,11 @@ sigset_t create_mask(int argc, ...);
  *
  * @param jid the jod id of the job that was terminated or stopped.
  * @param pid the process id of the job that was terminated or stopped.
- * @param sig expected to be either SIGINT or SIGTSTP.
+ * @param wstatus the wait status of the process that was terminated or
+ *        stopped by a signal.
  * @return void.
  */
-void printMsg(int jid, pid_t pid, int sig);
+void printMsg(int jid, pid_t pid, int wstatus);
 
 /*
  * Converts a job id specified on the command line in the form of %jid to an integer.
@@ -58,20 +169,88 @@ void printMsg(int jid, pid_t pid, int sig);
 int cmdjid_to_int(char* cmdjid);
 
 /*
- * Redirects I/O from a file descriptor to another file.
+ * Resolves the redirections of a command into a plan of dup2 steps.
+ *
+ * The files are opened here, in the shell, with close-on-exec set and the
+ * open flags and mode of each redirection, and the descriptors copied by
+ * [n]>&m are checked, so applying the plan cannot fail. Output files are
+ * truncated, and >> opens them in append mode, so concurrent jobs can
+ * append to one file without overwriting each other's writes. The text of
+ * a here-document or here-string is put in a sealed memfd instead.
+ *
+ * The plan is allocated from command_arena. On failure an error message
+ * is printed and nothing is left open.
+ *
+ * @param stage the command whose redirections are resolved.
+ * @param plan the plan to fill in.
+ * @return true if the plan was built, false otherwise.
+ */
+bool plan_redirections(const struct cmd_stage *stage, struct redir_plan *plan);
+
+/*
+ * Records the descriptors below REDIR_MIN_FD that the shell was started
+ * with, the only ones of its own that [n]>&m may copy. Called before the
+ * shell opens any descriptor of its own.
+ *
+ * @return void
+ */
+void redir_init(void);
+
+/*
+ * Applies a redirection plan to the calling process, with one dup2 or
+ * close per step. Intended for the child of a job, before it executes the
+ * command. Only makes async-signal-safe calls.
+ *
+ * @param plan the plan to apply.
+ * @return true on success, false if a step failed.
+ */
+bool apply_redirections(const struct redir_plan *plan);
+
+/*
+ * Closes the files opened for a redirection plan. The shell calls this
+ * once the job using the plan was started.
  *
- * For output redirection if file does not exists it will be created.
- * However, file must exists already for input redirection.
+ * @param plan the plan whose files are closed.
+ * @return void
+ */
+void close_redirections(struct redir_plan *plan);
+
+/*
+ * Saves a descriptor of the shell on the fd stack, so it can be put back
+ * exactly with restore_fds. The copy is made with F_DUPFD_CLOEXEC, so it
+ * never leaks into the jobs started while it is saved.
  *
- * @param from expected to be either STDOUT_FILENO or STDIN_FILENO.
- * @param to the name of the file that the descriptor will be redirected to.
+ * @param fd the descriptor to save.
+ * @return true on success, false if no copy could be made.
  */
-void redirect_io(int from, char* to);
+bool save_fd(int fd);
 
 /*
- * Sets the file descriptor for input to STDIN_FILENO and
- * the file descriptor for output to STDOUT_FILENO.
+ * Returns the current depth of the fd stack, to be passed to restore_fds.
+ *
+ * @return the depth of the fd stack.
+ */
+int fd_stack_mark(void);
+
+/*
+ * Puts back every descriptor saved since the supplied mark, most recent
+ * first, so nested redirections unwind in the reverse order they were
+ * made.
+ *
+ * @param mark a depth returned by fd_stack_mark.
+ * @return void
+ */
+void restore_fds(int mark);
+
+/*
+ * Applies a redirection plan to the shell itself, for a builtin command.
+ * The descriptors it replaces are saved on the fd stack, and the files of
+ * the plan are closed once they were copied into place.
+ *
+ * @param plan the plan to apply.
+ * @return the mark to pass to restore_fds afterwards, or -1 if the shell's
+ *         descriptors could not be saved, in which case nothing was changed.
  */
-void set_std_io(void);
+int redirect_shell(struct redir_plan *plan);
 
 #endif //TINY_LINUX_SHELL_UTILITIES_H
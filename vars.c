@@ -0,0 +1,371 @@
+//
+// vars.c - Shell variables and the environment of commands
+//
+
+#include "vars.h"
+
+#define INITBUCKETS 64      // Initial number of hash buckets
+
+struct var {
+    char *entry;                // name=value
+    size_t name_len;            // Length of the name in entry
+    unsigned hash;              // Hash of the name
+    bool exported;              // If true, entry is in the environment
+    struct var *next;           // Next variable in the same bucket
+};
+
+/* Global variables */
+static struct var **buckets = NULL;     // Hash table of the variables
+static int nbuckets = 0;                // Number of buckets, a power of two
+static int nvars = 0;                   // Number of variables
+static int nexported = 0;               // Number of exported variables
+static unsigned long generation = 1;    // Bumped when an export changes
+static unsigned long built = 0;         // Generation env_array was built for
+static char **env_array = NULL;         // ENV_HEADROOM slots, then environ
+static size_t env_size = 0;             // Number of slots in env_array
+static char **retired = NULL;           // Entries env_array may still hold
+static size_t nretired = 0, retired_size = 0;
+
+/*
+ * Hashes a variable name with FNV-1a.
+ *
+ * @param name the name.
+ * @param len the length of the name.
+ * @return the hash value.
+ */
+static unsigned hash_name(const char *name, size_t len) {
+    unsigned h = 2166136261u;
+    while (len-- > 0) {
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Finds a variable.
+ *
+ * @param name the name.
+ * @param len the length of the name.
+ * @param link if not NULL, receives the pointer to the variable, or to
+ *        the end of its bucket if it is not set.
+ * @return the variable, or NULL if it is not set.
+ */
+static struct var *find_var(const char *name, size_t len, struct var ***link) {
+    unsigned h = hash_name(name, len);
+    struct var **v;
+
+    if (nbuckets == 0) {
+        buckets = Calloc(INITBUCKETS, sizeof(struct var *));
+        nbuckets = INITBUCKETS;
+    }
+    for (v = &buckets[h & (nbuckets - 1)]; *v != NULL; v = &(*v)->next) {
+        if ((*v)->hash == h && (*v)->name_len == len &&
+            strncmp((*v)->entry, name, len) == 0) {
+            break;
+        }
+    }
+    if (link != NULL) {
+        *link = v;
+    }
+    return *v;
+}
+
+/*
+ * Doubles the number of buckets once there are more variables than buckets.
+ */
+static void grow_buckets(void) {
+    struct var **old = buckets, *v, *next;
+    int i, nold = nbuckets;
+
+    if (nvars <= nbuckets) {
+        return;
+    }
+    nbuckets *= 2;
+    buckets = Calloc(nbuckets, sizeof(struct var *));
+    for (i = 0; i < nold; i++) {
+        for (v = old[i]; v != NULL; v = next) {
+            next = v->next;
+            v->next = buckets[v->hash & (nbuckets - 1)];
+            buckets[v->hash & (nbuckets - 1)] = v;
+        }
+    }
+    Free(old);
+}
+
+/*
+ * Drops the entry of a variable. The entry of an exported variable may be
+ * in environ until it is rebuilt, so it is freed then.
+ *
+ * @param v the variable.
+ */
+static void retire_entry(struct var *v) {
+    if (!v->exported) {
+        Free(v->entry);
+        return;
+    }
+    if (nretired == retired_size) {
+        retired_size = retired_size ? 2 * retired_size : 16;
+        retired = Realloc(retired, retired_size * sizeof(char *));
+    }
+    retired[nretired++] = v->entry;
+    generation++;
+}
+
+/*
+ * Imports the environment the shell was started with, as exported
+ * variables.
+ *
+ * @param envp the environment, NULL terminated.
+ * @return void
+ */
+void vars_init(char **envp) {
+    char *eq;
+
+    for (; *envp != NULL; envp++) {
+        if ((eq = strchr(*envp, '=')) != NULL &&
+            var_valid_name(*envp, eq - *envp)) {
+            var_set(*envp, true);
+        }
+    }
+}
+
+/*
+ * Looks up the value of a variable.
+ *
+ * @param name the name, which need not be NUL terminated.
+ * @param len the length of the name.
+ * @return the value, valid until the variable changes, or NULL if the
+ *         variable is not set.
+ */
+const char *var_get(const char *name, size_t len) {
+    struct var *v = find_var(name, len, NULL);
+    return v != NULL ? v->entry + len + 1 : NULL;
+}
+
+/*
+ * Sets a variable from an assignment, keeping it exported if it was.
+ *
+ * @param assign the assignment, name=value, with a valid name.
+ * @param export true to export the variable as well.
+ * @return void
+ */
+void var_set(const char *assign, bool export) {
+    size_t len = strchr(assign, '=') - assign;
+    struct var *v, **link;
+
+    if ((v = find_var(assign, len, &link)) == NULL) {
+        v = Malloc(sizeof(struct var));
+        v->name_len = len;
+        v->hash = hash_name(assign, len);
+        v->exported = false;
+        v->next = NULL;
+        *link = v;
+        nvars++;
+        grow_buckets();
+    } else {
+        retire_entry(v);
+    }
+
+    if ((v->entry = strdup(assign)) == NULL) {
+        unix_error("strdup error");
+    }
+    if (export && !v->exported) {
+        v->exported = true;
+        nexported++;
+    }
+    if (v->exported) {
+        generation++;
+    }
+}
+
+/*
+ * Exports a variable, setting it to the empty string if it is not set.
+ *
+ * @param name the name of the variable.
+ * @return void
+ */
+void var_export(const char *name) {
+    size_t len = strlen(name);
+    struct var *v;
+    char *assign;
+
+    if ((v = find_var(name, len, NULL)) == NULL) {
+        assign = arena_alloc(&command_arena, len + 2);
+        sprintf(assign, "%s=", name);
+        var_set(assign, true);
+    } else if (!v->exported) {
+        v->exported = true;
+        nexported++;
+        generation++;
+    }
+}
+
+/*
+ * Removes a variable.
+ *
+ * @param name the name of the variable.
+ * @return void
+ */
+void var_unset(const char *name) {
+    struct var *v, **link;
+
+    if ((v = find_var(name, strlen(name), &link)) == NULL) {
+        return;
+    }
+    *link = v->next;
+    retire_entry(v);
+    if (v->exported) {
+        nexported--;
+    }
+    Free(v);
+    nvars--;
+}
+
+/*
+ * Orders variables by name.
+ */
+static int compare_vars(const void *a, const void *b) {
+    const struct var *va = *(struct var * const *) a;
+    const struct var *vb = *(struct var * const *) b;
+    size_t len = va->name_len < vb->name_len ? va->name_len : vb->name_len;
+    int diff = strncmp(va->entry, vb->entry, len);
+
+    return diff != 0 ? diff : (int) va->name_len - (int) vb->name_len;
+}
+
+/*
+ * Prints the variables as name=value lines, sorted by name.
+ *
+ * @param exported_only true to print only the exported variables, each
+ *        preceded by "export ".
+ * @return void
+ */
+void vars_list(bool exported_only) {
+    struct var **sorted, *v;
+    int i, n = 0;
+
+    sorted = arena_alloc(&command_arena, (nvars + 1) * sizeof(struct var *));
+    for (i = 0; i < nbuckets; i++) {
+        for (v = buckets[i]; v != NULL; v = v->next) {
+            if (v->exported || !exported_only) {
+                sorted[n++] = v;
+            }
+        }
+    }
+    qsort(sorted, n, sizeof(struct var *), compare_vars);
+    for (i = 0; i < n; i++) {
+        printf("%s%s\n", exported_only ? "export " : "", sorted[i]->entry);
+    }
+}
+
+/*
+ * Returns the environment of the exported variables, rebuilding it first
+ * if one of them changed, and points environ at it.
+ *
+ * @return the environment, NULL terminated.
+ */
+char **vars_environ(void) {
+    struct var *v;
+    size_t n = ENV_HEADROOM;
+    int i;
+
+    if (built == generation) {
+        return env_array + ENV_HEADROOM;
+    }
+
+    if (env_size < ENV_HEADROOM + nexported + 1) {
+        env_size = 2 * (ENV_HEADROOM + nexported + 1);
+        env_array = Realloc(env_array, env_size * sizeof(char *));
+    }
+    for (i = 0; i < nbuckets; i++) {
+        for (v = buckets[i]; v != NULL; v = v->next) {
+            if (v->exported) {
+                env_array[n++] = v->entry;
+            }
+        }
+    }
+    env_array[n] = NULL;
+    environ = env_array + ENV_HEADROOM;
+    built = generation;
+
+    // Nothing refers to the replaced entries any more
+    while (nretired > 0) {
+        Free(retired[--nretired]);
+    }
+    return environ;
+}
+
+/*
+ * Checks whether an environment entry has the same name as an assignment.
+ */
+static bool same_name(const char *entry, const char *assign) {
+    size_t len = strchr(assign, '=') - assign;
+    return strncmp(entry, assign, len) == 0 && entry[len] == '=';
+}
+
+/*
+ * Checks whether an assignment is overridden by a later one of the same
+ * name in front of the same command.
+ */
+static bool assigned_again(char **assigns, int i, int nassigns) {
+    int j;
+
+    for (j = i + 1; j < nassigns && !same_name(assigns[j], assigns[i]); j++);
+    return j < nassigns;
+}
+
+/*
+ * Returns the environment of a command, the exported variables with the
+ * assignments in front of the command layered over them.
+ *
+ * The assignments are used as environment entries as they are, the last
+ * one winning when a name is assigned more than once. When none
+ * of them replaces an exported variable and there are at most ENV_HEADROOM,
+ * they go into the free slots in front of the environment; otherwise the
+ * entries are gathered into one array from command_arena. Either way the
+ * result is only valid until the next call.
+ *
+ * @param assigns the assignments, name=value.
+ * @param nassigns the number of assignments.
+ * @return the environment, NULL terminated.
+ */
+char **vars_command_env(char **assigns, int nassigns) {
+    char **base = vars_environ(), **envp, **e;
+    bool shadows = false, headroom;
+    struct var *v;
+    int i, n, nkept = 0;
+
+    if (nassigns == 0) {
+        return base;
+    }
+    for (i = 0; i < nassigns; i++) {
+        v = find_var(assigns[i], strchr(assigns[i], '=') - assigns[i], NULL);
+        shadows = shadows || (v != NULL && v->exported);
+        nkept += !assigned_again(assigns, i, nassigns);
+    }
+
+    headroom = !shadows && nkept <= ENV_HEADROOM;
+    if (headroom) {
+        envp = base - nkept;
+    } else {
+        envp = arena_alloc(&command_arena,
+                           (nkept + nexported + 1) * sizeof(char *));
+    }
+    for (i = 0, n = 0; i < nassigns; i++) {
+        if (!assigned_again(assigns, i, nassigns)) {
+            envp[n++] = assigns[i];
+        }
+    }
+    if (headroom) {
+        return envp;
+    }
+
+    for (e = base; *e != NULL; e++) {
+        for (i = 0; i < nassigns && !same_name(*e, assigns[i]); i++);
+        if (i == nassigns) {
+            envp[n++] = *e;
+        }
+    }
+    envp[n] = NULL;
+    return envp;
+}
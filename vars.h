@@ -0,0 +1,126 @@
+//
+// vars.h - Shell variables and the environment of commands
+//
+
+#ifndef TINY_LINUX_SHELL_VARS_H
+#define TINY_LINUX_SHELL_VARS_H
+
+#include "csapp.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <ctype.h>
+
+#define ENV_HEADROOM    16      // Command assignments layered without a copy
+
+/*
+ * The shell variables live in a hash table keyed by name, each stored as
+ * one "name=value" string that doubles as its environment entry. The
+ * exported ones make up the environment of the commands the shell starts.
+ *
+ * The environment array is rebuilt only when an exported variable changed
+ * since it was last built, which a generation counter tracks, and it keeps
+ * ENV_HEADROOM free slots in front of the entries. The assignments in
+ * front of a command (VAR=value cmd) that add new names are written into
+ * those slots, so starting a command costs no copy of the environment.
+ */
+
+/*
+ * Imports the environment the shell was started with, as exported
+ * variables.
+ *
+ * @param envp the environment, NULL terminated.
+ * @return void
+ */
+void vars_init(char **envp);
+
+/*
+ * Checks that a string is a valid variable name, letters, digits and
+ * underscores not starting with a digit, up to a length.
+ *
+ * @param name the string.
+ * @param len the length of the name in it.
+ * @return true if the name is valid, false otherwise.
+ */
+static inline bool var_valid_name(const char *name, size_t len) {
+    size_t i;
+
+    if (len == 0 || isdigit((unsigned char) name[0])) {
+        return false;
+    }
+    for (i = 0; i < len; i++) {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Looks up the value of a variable.
+ *
+ * @param name the name, which need not be NUL terminated.
+ * @param len the length of the name.
+ * @return the value, valid until the variable changes, or NULL if the
+ *         variable is not set.
+ */
+const char *var_get(const char *name, size_t len);
+
+/*
+ * Sets a variable from an assignment, keeping it exported if it was.
+ *
+ * @param assign the assignment, name=value, with a valid name.
+ * @param export true to export the variable as well.
+ * @return void
+ */
+void var_set(const char *assign, bool export);
+
+/*
+ * Exports a variable, setting it to the empty string if it is not set.
+ *
+ * @param name the name of the variable.
+ * @return void
+ */
+void var_export(const char *name);
+
+/*
+ * Removes a variable.
+ *
+ * @param name the name of the variable.
+ * @return void
+ */
+void var_unset(const char *name);
+
+/*
+ * Prints the variables as name=value lines, sorted by name.
+ *
+ * @param exported_only true to print only the exported variables, each
+ *        preceded by "export ".
+ * @return void
+ */
+void vars_list(bool exported_only);
+
+/*
+ * Returns the environment of the exported variables, rebuilding it first
+ * if one of them changed, and points environ at it.
+ *
+ * @return the environment, NULL terminated.
+ */
+char **vars_environ(void);
+
+/*
+ * Returns the environment of a command, the exported variables with the
+ * assignments in front of the command layered over them.
+ *
+ * The assignments are used as environment entries as they are. When none
+ * of them replaces an exported variable and there are at most ENV_HEADROOM,
+ * they go into the free slots in front of the environment; otherwise the
+ * entries are gathered into one array from command_arena. Either way the
+ * result is only valid until the next call.
+ *
+ * @param assigns the assignments, name=value.
+ * @param nassigns the number of assignments.
+ * @return the environment, NULL terminated.
+ */
+char **vars_command_env(char **assigns, int nassigns);
+
+#endif //TINY_LINUX_SHELL_VARS_H
@@ -0,0 +1,297 @@
+//
+// wildcard.c - Pathname expansion from cached directory listings
+//
+
+#include "wildcard.h"
+#include <sys/syscall.h>
+
+struct linux_dirent64 {         // A record getdents64 fills in
+    uint64_t d_ino;             // Inode number
+    int64_t d_off;              // Offset of the next record
+    unsigned short d_reclen;    // Size of this record
+    unsigned char d_type;       // File type, DT_*
+    char d_name[];              // Name, NUL terminated
+};
+
+struct dir_entry {              // An entry of a directory listing
+    size_t name;                // Offset of its name in names
+    unsigned char type;         // File type, DT_*
+};
+
+struct dir_listing {            // The entries of a directory, as last read
+    char *path;                 // Path it was read through, NULL if unused
+    dev_t dev;                  // Device of the directory
+    ino_t ino;                  // Inode of the directory
+    struct timespec mtime;      // Its mtime before it was read
+    struct timespec read_at;    // When it was read
+    char *names;                // Names of the entries, NUL terminated
+    size_t names_size;          // Bytes allocated for names
+    struct dir_entry *entries;  // The entries
+    int nentries;               // Number of entries
+    int entries_size;           // Entries allocated
+    unsigned long used;         // When it was last used, for eviction
+};
+
+struct path_list {              // A vector of paths in command_arena
+    char **paths;               // The paths
+    int n;                      // Number of paths
+    int size;                   // Paths allocated
+};
+
+/* Global variables */
+static struct dir_listing listings[DIRCACHE_ENTRIES];  // The cache
+static unsigned long use_clock = 0;     // Counts the uses of listings
+static char *dirent_buf = NULL;         // Records read by getdents64
+
+/*
+ * Returns the difference of two times in nanoseconds.
+ */
+static long long timespec_diff(const struct timespec *a,
+                               const struct timespec *b) {
+    return (a->tv_sec - b->tv_sec) * 1000000000LL +
+           (a->tv_nsec - b->tv_nsec);
+}
+
+/*
+ * Reads the entries of a directory into a listing with getdents64.
+ *
+ * @param listing the listing to fill in.
+ * @param path the path of the directory.
+ * @param st the status of the directory, from before it is read.
+ * @return true if the directory was read, false otherwise.
+ */
+static bool read_listing(struct dir_listing *listing, const char *path,
+                         const struct stat *st) {
+    struct linux_dirent64 *d;
+    size_t names_len = 0, len;
+    long n, off;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        return false;
+    }
+    if (dirent_buf == NULL) {
+        dirent_buf = Malloc(DIRCACHE_BUFSIZE);
+    }
+
+    listing->nentries = 0;
+    while ((n = syscall(SYS_getdents64, fd, dirent_buf,
+                        DIRCACHE_BUFSIZE)) > 0) {
+        for (off = 0; off < n; off += d->d_reclen) {
+            d = (struct linux_dirent64 *) (dirent_buf + off);
+            len = strlen(d->d_name) + 1;
+            if (names_len + len > listing->names_size) {
+                listing->names_size = 2 * (names_len + len);
+                listing->names = Realloc(listing->names, listing->names_size);
+            }
+            if (listing->nentries == listing->entries_size) {
+                listing->entries_size = listing->entries_size
+                                        ? 2 * listing->entries_size : 64;
+                listing->entries = Realloc(listing->entries,
+                                           listing->entries_size *
+                                           sizeof(struct dir_entry));
+            }
+            memcpy(listing->names + names_len, d->d_name, len);
+            listing->entries[listing->nentries].name = names_len;
+            listing->entries[listing->nentries++].type = d->d_type;
+            names_len += len;
+        }
+    }
+    close(fd);
+    if (n < 0) {
+        return false;
+    }
+
+    listing->dev = st->st_dev;
+    listing->ino = st->st_ino;
+    listing->mtime = st->st_mtim;
+    clock_gettime(CLOCK_REALTIME, &listing->read_at);
+    return true;
+}
+
+/*
+ * Returns the listing of a directory, from the cache if the directory did
+ * not change since it was read, and otherwise read afresh.
+ *
+ * A listing read within DIRCACHE_RACY_NS of the mtime of the directory
+ * is not trusted, as a change right after the read can leave the mtime
+ * as it was.
+ *
+ * @param path the path of the directory.
+ * @return the listing, or NULL if the directory could not be read.
+ */
+static struct dir_listing *get_listing(const char *path) {
+    struct dir_listing *listing = NULL, *victim = &listings[0];
+    struct stat st;
+    int i;
+
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+
+    for (i = 0; i < DIRCACHE_ENTRIES; i++) {
+        if (listings[i].path != NULL && strcmp(listings[i].path, path) == 0) {
+            listing = &listings[i];
+            break;
+        }
+        if (listings[i].used < victim->used) {
+            victim = &listings[i];
+        }
+    }
+
+    if (listing != NULL && listing->dev == st.st_dev &&
+        listing->ino == st.st_ino &&
+        timespec_diff(&listing->mtime, &st.st_mtim) == 0 &&
+        timespec_diff(&listing->read_at, &st.st_mtim) >= DIRCACHE_RACY_NS) {
+        listing->used = ++use_clock;
+        return listing;
+    }
+
+    if (listing == NULL) {
+        listing = victim;
+        Free(listing->path);
+        if ((listing->path = strdup(path)) == NULL) {
+            unix_error("strdup error");
+        }
+    }
+    if (!read_listing(listing, path, &st)) {
+        Free(listing->path);
+        listing->path = NULL;
+        listing->used = 0;
+        return NULL;
+    }
+    listing->used = ++use_clock;
+    return listing;
+}
+
+/*
+ * Checks whether a word is a pattern, containing *, ? or a [ with a ]
+ * after it. A lone [ is not, so the test command is not globbed.
+ *
+ * @param word the word.
+ * @return true if the word is a pattern.
+ */
+bool wildcard_pattern(const char *word) {
+    const char *p;
+
+    for (p = word; *p != '\0'; p++) {
+        if (*p == '*' || *p == '?') {
+            return true;
+        }
+        if (*p == '[' && p[1] != '\0' && strchr(p + 2, ']') != NULL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Appends a path, made of a prefix, a name and a suffix, to a list.
+ */
+static void add_path(struct path_list *list, const char *prefix,
+                     const char *name, const char *suffix) {
+    size_t len = strlen(prefix) + strlen(name) + strlen(suffix);
+
+    if (list->n == list->size) {
+        list->size = list->size ? 2 * list->size : 16;
+        list->paths = arena_grow(&command_arena, list->paths,
+                                 list->n * sizeof(char *),
+                                 list->size * sizeof(char *));
+    }
+    list->paths[list->n] = arena_alloc(&command_arena, len + 1);
+    sprintf(list->paths[list->n++], "%s%s%s", prefix, name, suffix);
+}
+
+/*
+ * Checks whether an entry of a listing is a directory, from its type if
+ * getdents64 reported one, and otherwise with stat(), following links.
+ */
+static bool entry_is_dir(const struct dir_listing *listing,
+                         const struct dir_entry *entry, const char *prefix) {
+    struct stat st;
+    char *path;
+
+    if (entry->type != DT_LNK && entry->type != DT_UNKNOWN) {
+        return entry->type == DT_DIR;
+    }
+    path = arena_alloc(&command_arena,
+                       strlen(prefix) + strlen(listing->names + entry->name) + 1);
+    sprintf(path, "%s%s", prefix, listing->names + entry->name);
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Orders paths as POSIX glob does.
+ */
+static int compare_paths(const void *a, const void *b) {
+    return strcoll(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Expands a pattern into the paths that match it, sorted with strcoll as
+ * POSIX glob sorts them.
+ *
+ * The directories the pattern names are read with getdents64, and the
+ * type getdents64 reports for an entry decides whether it is a directory,
+ * so only symbolic links and entries of unknown type are stat()ed. The
+ * listings of the last DIRCACHE_ENTRIES directories read are kept and
+ * reused while the inode and mtime of the directory stay the same, so a
+ * glob over a directory seen before costs one stat() call.
+ *
+ * A * or ? does not match a leading . of a name, and a pattern that ends
+ * in / matches directories only, keeping the / on the paths.
+ *
+ * @param pattern the pattern.
+ * @param matches receives the matching paths, allocated from command_arena.
+ * @return the number of matches.
+ */
+int wildcard_expand(const char *pattern, char ***matches) {
+    struct path_list prefixes = {NULL, 0, 0}, found;
+    struct dir_listing *listing;
+    struct stat st;
+    const char *p = pattern, *next, *suffix, *name;
+    char *component;
+    bool last, need_dir;
+    size_t len;
+    int i, j;
+
+    add_path(&prefixes, *p == '/' ? "/" : "", "", "");
+    p += strspn(p, "/");
+
+    // Match one component of the pattern at a time against the paths so far
+    while (*p != '\0' && prefixes.n > 0) {
+        len = strcspn(p, "/");
+        component = arena_strndup(&command_arena, p, len);
+        next = p + len + strspn(p + len, "/");
+        last = *next == '\0';
+        need_dir = p[len] == '/';
+        suffix = need_dir ? "/" : "";
+        found = (struct path_list) {NULL, 0, 0};
+
+        for (i = 0; i < prefixes.n; i++) {
+            if (!wildcard_pattern(component)) {
+                // A literal name only has to exist, and only at the end
+                add_path(&found, prefixes.paths[i], component, suffix);
+                if (last && lstat(found.paths[found.n - 1], &st) < 0) {
+                    found.n--;
+                }
+                continue;
+            }
+            listing = get_listing(*prefixes.paths[i] ? prefixes.paths[i] : ".");
+            for (j = 0; listing != NULL && j < listing->nentries; j++) {
+                name = listing->names + listing->entries[j].name;
+                if (fnmatch(component, name, FNM_PERIOD) == 0 &&
+                    (!need_dir || entry_is_dir(listing, &listing->entries[j],
+                                               prefixes.paths[i]))) {
+                    add_path(&found, prefixes.paths[i], name, suffix);
+                }
+            }
+        }
+        prefixes = found;
+        p = next;
+    }
+
+    qsort(prefixes.paths, prefixes.n, sizeof(char *), compare_paths);
+    *matches = prefixes.paths;
+    return prefixes.n;
+}
@@ -0,0 +1,50 @@
+//
+// wildcard.h - Pathname expansion from cached directory listings
+//
+
+#ifndef TINY_LINUX_SHELL_WILDCARD_H
+#define TINY_LINUX_SHELL_WILDCARD_H
+
+#include "csapp.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <time.h>
+
+#define DIRCACHE_ENTRIES    32          // Directory listings remembered
+#define DIRCACHE_BUFSIZE    (1 << 18)   // Bytes read by one getdents64 call
+#define DIRCACHE_RACY_NS    20000000L   // Listings this close to a change
+                                        // are read again, as the mtime
+                                        // could miss a later change
+
+/*
+ * Checks whether a word is a pattern, containing *, ? or a [ with a ]
+ * after it. A lone [ is not, so the test command is not globbed.
+ *
+ * @param word the word.
+ * @return true if the word is a pattern.
+ */
+bool wildcard_pattern(const char *word);
+
+/*
+ * Expands a pattern into the paths that match it, sorted with strcoll as
+ * POSIX glob sorts them.
+ *
+ * The directories the pattern names are read with getdents64, and the
+ * type getdents64 reports for an entry decides whether it is a directory,
+ * so only symbolic links and entries of unknown type are stat()ed. The
+ * listings of the last DIRCACHE_ENTRIES directories read are kept and
+ * reused while the inode and mtime of the directory stay the same, so a
+ * glob over a directory seen before costs one stat() call.
+ *
+ * A * or ? does not match a leading . of a name, and a pattern that ends
+ * in / matches directories only, keeping the / on the paths.
+ *
+ * @param pattern the pattern.
+ * @param matches receives the matching paths, allocated from command_arena.
+ * @return the number of matches.
+ */
+int wildcard_expand(const char *pattern, char ***matches);
+
+#endif //TINY_LINUX_SHELL_WILDCARD_H